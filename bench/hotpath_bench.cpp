@@ -0,0 +1,437 @@
+// Microbenchmarks for the request/response hot path: query decoding, request
+// parsing and routing to a cached player, hiscore CSV parsing, URL encoding,
+// JSON escaping and serialization, and response framing.
+//
+// Each benchmark reports ns/op and heap allocations per op. With --baseline
+// the results are compared against a stored run, and the exit status is
+// non-zero when any benchmark got slower than --max-slowdown times its
+// baseline or allocates more than it used to.
+//
+// Built by the hotpath_bench target (see CMakeLists.txt):
+//   cmake --build build --target hotpath_bench
+//   build/hotpath_bench --baseline bench/baseline.txt
+//   build/hotpath_bench --write-baseline bench/baseline.txt   # after an intended change
+
+#include "http_request.h"
+#include "http_response.h"
+#include "json_writer.h"
+#include "osrs_hiscore.h"
+#include "player_cache.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef BENCH_DATA_DIR
+#define BENCH_DATA_DIR "bench/data"
+#endif
+
+namespace {
+    std::atomic<std::uint64_t> g_allocations(0);
+
+    void *countedAllocate(std::size_t size)
+    {
+        g_allocations.fetch_add(1, std::memory_order_relaxed);
+        if (void *memory = std::malloc(size ? size : 1))
+        {
+            return memory;
+        }
+        throw std::bad_alloc();
+    }
+}
+
+// Every allocation in the process goes through here, so a benchmark's count is exact.
+void *operator new(std::size_t size)
+{
+    return countedAllocate(size);
+}
+
+void *operator new[](std::size_t size)
+{
+    return countedAllocate(size);
+}
+
+void operator delete(void *memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void *memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void *memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    // Keeps the compiler from discarding a result nobody reads.
+    template <typename T>
+    void keep(const T &value)
+    {
+        asm volatile("" : : "g"(&value) : "memory");
+    }
+
+    struct Result
+    {
+        std::string name;
+        double nsPerOp;
+        double allocsPerOp;
+    };
+
+    // Runs op in growing batches until one batch takes at least a millisecond,
+    // then keeps running batches until seconds have passed.
+    Result measure(const std::string &name, double seconds, const std::function<void()> &op)
+    {
+        for (int i = 0; i < 100; ++i)
+        {
+            op(); // warm caches and grow reused buffers before counting
+        }
+
+        std::uint64_t batch = 1;
+        while (true)
+        {
+            const Clock::time_point start = Clock::now();
+            for (std::uint64_t i = 0; i < batch; ++i)
+            {
+                op();
+            }
+            if (Clock::now() - start >= std::chrono::milliseconds(1))
+            {
+                break;
+            }
+            batch *= 2;
+        }
+
+        std::uint64_t iterations = 0;
+        const std::uint64_t allocationsBefore = g_allocations.load(std::memory_order_relaxed);
+        const Clock::time_point start = Clock::now();
+        Clock::time_point now = start;
+        do
+        {
+            for (std::uint64_t i = 0; i < batch; ++i)
+            {
+                op();
+            }
+            iterations += batch;
+            now = Clock::now();
+        } while (std::chrono::duration<double>(now - start).count() < seconds);
+
+        const double allocations = static_cast<double>(g_allocations.load(std::memory_order_relaxed) - allocationsBefore);
+        const double nanos = std::chrono::duration<double, std::nano>(now - start).count();
+        return Result{name, nanos / static_cast<double>(iterations), allocations / static_cast<double>(iterations)};
+    }
+
+    std::string readFile(const std::string &path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+        {
+            std::fprintf(stderr, "Cannot read %s\n", path.c_str());
+            std::exit(2);
+        }
+        std::ostringstream contents;
+        contents << file.rdbuf();
+        return contents.str();
+    }
+
+    // Percent-encodes every byte, the worst case urlDecode sees.
+    std::string encodeEverything(const std::string &value)
+    {
+        static const char kHex[] = "0123456789ABCDEF";
+        std::string encoded;
+        for (unsigned char ch : value)
+        {
+            encoded += '%';
+            encoded += kHex[ch >> 4];
+            encoded += kHex[ch & 15];
+        }
+        return encoded;
+    }
+
+    // name -> {ns/op, allocs/op}
+    std::map<std::string, std::pair<double, double>> readBaseline(const std::string &path)
+    {
+        std::map<std::string, std::pair<double, double>> baseline;
+        std::ifstream file(path);
+        if (!file)
+        {
+            std::fprintf(stderr, "Cannot read baseline %s\n", path.c_str());
+            std::exit(2);
+        }
+        std::string line;
+        while (std::getline(file, line))
+        {
+            if (line.empty() || line[0] == '#')
+            {
+                continue;
+            }
+            std::istringstream fields(line);
+            std::string name;
+            double ns = 0;
+            double allocs = 0;
+            if (fields >> name >> ns >> allocs)
+            {
+                baseline[name] = {ns, allocs};
+            }
+        }
+        return baseline;
+    }
+
+    bool writeBaseline(const std::string &path, const std::vector<Result> &results)
+    {
+        std::ofstream file(path);
+        if (!file)
+        {
+            return false;
+        }
+        file << "# hotpath_bench baseline: name ns_per_op allocs_per_op\n";
+        for (const Result &result : results)
+        {
+            char line[160];
+            std::snprintf(line, sizeof(line), "%s %.1f %.2f\n", result.name.c_str(), result.nsPerOp, result.allocsPerOp);
+            file << line;
+        }
+        return static_cast<bool>(file);
+    }
+
+    void usage()
+    {
+        std::fprintf(stderr,
+                     "usage: hotpath_bench [--quick] [--seconds S] [--filter TEXT] [--data DIR]\n"
+                     "                     [--baseline FILE [--max-slowdown R]] [--write-baseline FILE]\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = 0.5;
+    double maxSlowdown = 1.25;
+    std::string filter;
+    std::string dataDir = BENCH_DATA_DIR;
+    std::string baselinePath;
+    std::string writePath;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--quick")
+        {
+            seconds = 0.05;
+        }
+        else if (arg == "--seconds" && hasValue)
+        {
+            seconds = std::atof(argv[++i]);
+        }
+        else if (arg == "--filter" && hasValue)
+        {
+            filter = argv[++i];
+        }
+        else if (arg == "--data" && hasValue)
+        {
+            dataDir = argv[++i];
+        }
+        else if (arg == "--baseline" && hasValue)
+        {
+            baselinePath = argv[++i];
+        }
+        else if (arg == "--max-slowdown" && hasValue)
+        {
+            maxSlowdown = std::atof(argv[++i]);
+        }
+        else if (arg == "--write-baseline" && hasValue)
+        {
+            writePath = argv[++i];
+        }
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+
+    // Hiscore answers for a maxed account (every activity ranked) and a mid-level
+    // one (mostly "-1,-1"), in the index_lite.ws line format.
+    const std::string maxedBody = readFile(dataDir + "/index_lite_maxed.txt");
+    const std::string midBody = readFile(dataDir + "/index_lite_mid.txt");
+
+    osrs::PlayerSnapshot maxed;
+    maxed.name = "Lynx Titan";
+    maxed.upstreamStatus = 200;
+    if (!osrs::HiscoreClient::parseBody(maxedBody, maxed))
+    {
+        std::fprintf(stderr, "index_lite_maxed.txt did not parse\n");
+        return 2;
+    }
+
+    // A clan-sized /players query with every byte percent-encoded, and a plain one.
+    std::string clanNames;
+    for (int i = 0; i < 50; ++i)
+    {
+        clanNames += (i > 0 ? "," : "") + std::string("Clan Mate ") + std::to_string(i);
+    }
+    const std::string encodedClan = encodeEverything(clanNames);
+    const std::string query = "format=json&names=" + encodedClan + "&name=Lynx%20Titan&v=2";
+
+    const std::string request =
+        "GET /player?name=Lynx%20Titan HTTP/1.1\r\n"
+        "Host: localhost\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/126.0 Safari/537.36\r\n"
+        "Accept: application/json, text/plain, */*\r\n"
+        "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+        "Accept-Language: en-GB,en;q=0.9\r\n"
+        "If-None-Match: \"5f2a9c1d7e3b4a60\"\r\n"
+        "Connection: keep-alive\r\n"
+        "\r\n";
+
+    osrs::PlayerCache cache;
+    cache.insert(osrs::normalizeName("Lynx Titan"), std::make_shared<const osrs::PlayerSnapshot>(maxed));
+
+    std::string scratch;
+    std::string json;
+    std::string response;
+    osrs::ToJson(maxed, json);
+    const std::string body = json;
+
+    struct Benchmark
+    {
+        const char *name;
+        std::function<void()> op;
+    };
+    const Benchmark benchmarks[] = {
+        {"url_decode_name", [&]() {
+             https::urlDecode("Lynx%20Titan", scratch);
+             keep(scratch);
+         }},
+        {"url_decode_encoded_clan", [&]() {
+             https::urlDecode(encodedClan, scratch);
+             keep(scratch);
+         }},
+        {"find_query_param", [&]() { keep(https::findQueryParam(query, "name", scratch)); }},
+        {"request_parse", [&]() {
+             https::HttpRequestParser parser(16384, 65536);
+             https::HttpRequest parsed;
+             keep(parser.parse(request, parsed));
+         }},
+        // What handleRequest does for a cached /player hit, short of the socket:
+        // parse, route, decode the name, normalize it and look it up.
+        {"route_cached_player", [&]() {
+             https::HttpRequestParser parser(16384, 65536);
+             https::HttpRequest parsed;
+             if (parser.parse(request, parsed) == https::ParseStatus::Complete && parsed.method == "GET" &&
+                 parsed.path == "/player" && https::findQueryParam(parsed.query, "name", scratch))
+             {
+                 keep(cache.find(osrs::normalizeName(scratch)));
+             }
+         }},
+        {"parse_body_maxed", [&]() {
+             osrs::PlayerSnapshot snapshot;
+             keep(osrs::HiscoreClient::parseBody(maxedBody, snapshot));
+         }},
+        {"parse_body_mid", [&]() {
+             osrs::PlayerSnapshot snapshot;
+             keep(osrs::HiscoreClient::parseBody(midBody, snapshot));
+         }},
+        // The body as the upstream reader hands it over: in pieces that split lines.
+        {"parse_body_streamed", [&]() {
+             osrs::PlayerSnapshot snapshot;
+             osrs::HiscoreBodyParser parser(snapshot);
+             const std::string_view body(maxedBody);
+             for (std::size_t offset = 0; offset < body.size(); offset += 100)
+             {
+                 parser.feed(body.substr(offset, 100));
+             }
+             keep(parser.finish());
+         }},
+        {"url_encode_name", [&]() { keep(osrs::HiscoreClient::urlEncode("Lynx Titan")); }},
+        {"url_encode_symbols", [&]() { keep(osrs::HiscoreClient::urlEncode("Iron_Man-99 \xC3\xA9!")); }},
+        {"escape_json_plain", [&]() {
+             scratch.clear();
+             osrs::appendJsonString(scratch, "Lynx Titan");
+             keep(scratch);
+         }},
+        {"escape_json_special", [&]() {
+             scratch.clear();
+             osrs::appendJsonString(scratch, "\"Zezima\"\\\tfan\n");
+             keep(scratch);
+         }},
+        {"to_json_maxed", [&]() {
+             json.clear();
+             osrs::ToJson(maxed, json);
+             keep(json);
+         }},
+        {"build_http_response", [&]() {
+             response.clear();
+             https::appendResponse(response, 200, body, true, "ETag: \"5f2a9c1d7e3b4a60\"\r\nCache-Control: public, max-age=60\r\n");
+             keep(response);
+         }},
+    };
+
+    std::map<std::string, std::pair<double, double>> baseline;
+    if (!baselinePath.empty())
+    {
+        baseline = readBaseline(baselinePath);
+    }
+
+    std::printf("%-26s %12s %10s %14s %9s\n", "benchmark", "ns/op", "allocs/op", "baseline ns/op", "change");
+    std::vector<Result> results;
+    int regressions = 0;
+    for (const auto &benchmark : benchmarks)
+    {
+        if (!filter.empty() && std::strstr(benchmark.name, filter.c_str()) == nullptr)
+        {
+            continue;
+        }
+        const Result result = measure(benchmark.name, seconds, benchmark.op);
+        results.push_back(result);
+
+        auto previous = baseline.find(result.name);
+        if (previous == baseline.end())
+        {
+            std::printf("%-26s %12.1f %10.2f %14s %9s\n", result.name.c_str(), result.nsPerOp, result.allocsPerOp, "-", "-");
+            continue;
+        }
+
+        const double ratio = result.nsPerOp / previous->second.first;
+        // Timings are noisy, so they get a tolerance; allocation counts are exact.
+        const bool slower = ratio > maxSlowdown;
+        const bool allocates = result.allocsPerOp > previous->second.second + 0.01;
+        std::printf("%-26s %12.1f %10.2f %14.1f %+8.1f%%%s%s\n", result.name.c_str(), result.nsPerOp, result.allocsPerOp,
+                    previous->second.first, (ratio - 1) * 100, slower ? "  SLOWER" : "", allocates ? "  MORE ALLOCATIONS" : "");
+        if (slower || allocates)
+        {
+            ++regressions;
+        }
+    }
+
+    if (!writePath.empty() && !writeBaseline(writePath, results))
+    {
+        std::fprintf(stderr, "Cannot write baseline %s\n", writePath.c_str());
+        return 2;
+    }
+    if (regressions > 0)
+    {
+        std::printf("%d benchmark(s) regressed against %s (allowed slowdown %.2fx)\n", regressions, baselinePath.c_str(), maxSlowdown);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,102 @@
+// Serialization throughput of osrs::ToJson into a reused buffer, next to the
+// ostringstream serializer it replaced.
+//
+// Built by the serialize_bench target (see CMakeLists.txt):
+//   cmake --build build --target serialize_bench
+//   build/serialize_bench
+
+#include "osrs_hiscore.h"
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <sstream>
+#include <string>
+
+namespace {
+    osrs::PlayerSnapshot makeSnapshot(std::size_t activities)
+    {
+        osrs::PlayerSnapshot snapshot;
+        snapshot.name = "Lynx Titan";
+        snapshot.success = true;
+        snapshot.upstreamStatus = 200;
+        for (std::size_t i = 0; i < osrs::kSkillCount; ++i)
+        {
+            snapshot.skills[i] = osrs::SkillStats{static_cast<int>(1 + i * 37), 99, 200000000 - static_cast<std::int64_t>(i) * 12345};
+            snapshot.skillMask |= std::uint32_t(1) << i;
+        }
+        for (std::size_t i = 0; i < activities; ++i)
+        {
+            snapshot.activities[i] = osrs::ActivityStats{static_cast<int>(i * 101), static_cast<int>(i * 7)};
+        }
+        snapshot.activityCount = static_cast<std::uint16_t>(activities);
+        return snapshot;
+    }
+
+    // The serializer before the buffer rewrite, kept for comparison.
+    std::string legacyToJson(const osrs::PlayerSnapshot &snapshot)
+    {
+        std::ostringstream json;
+        json << "{\"name\":\"" << snapshot.name << "\",\"success\":" << (snapshot.success ? "true" : "false");
+        json << ",\"skills\":{";
+        for (std::size_t i = 0; i < osrs::kSkillCount; ++i)
+        {
+            const osrs::SkillStats &stats = snapshot.skills[i];
+            json << (i > 0 ? "," : "") << "\"" << osrs::kSkillOrder[i] << "\":{\"rank\":" << stats.rank
+                 << ",\"level\":" << stats.level << ",\"experience\":" << stats.experience << "}";
+        }
+        json << "}";
+        if (snapshot.activityCount > 0)
+        {
+            json << ",\"activities\":[";
+            for (std::size_t i = 0; i < snapshot.activityCount; ++i)
+            {
+                json << (i > 0 ? "," : "") << "{\"rank\":" << snapshot.activities[i].rank
+                     << ",\"score\":" << snapshot.activities[i].score << "}";
+            }
+            json << "]";
+        }
+        json << "}";
+        return json.str();
+    }
+
+    // Runs serialize for about a second and prints snapshots per second.
+    void measure(const char *label, const std::function<std::size_t()> &serialize)
+    {
+        using Clock = std::chrono::steady_clock;
+        std::size_t iterations = 0;
+        std::size_t bytes = 0;
+        const Clock::time_point start = Clock::now();
+        Clock::time_point now = start;
+        while (now - start < std::chrono::seconds(1))
+        {
+            for (int i = 0; i < 1000; ++i)
+            {
+                bytes += serialize();
+            }
+            iterations += 1000;
+            now = Clock::now();
+        }
+
+        const double seconds = std::chrono::duration<double>(now - start).count();
+        std::printf("%-36s %10.0f snapshots/s %8.1f MB/s\n", label, iterations / seconds, bytes / seconds / 1e6);
+    }
+}
+
+int main()
+{
+    for (std::size_t activities : {std::size_t(0), std::size_t(80)})
+    {
+        const osrs::PlayerSnapshot snapshot = makeSnapshot(activities);
+        std::string buffer;
+        const std::string suffix = " (" + std::to_string(activities) + " activities)";
+
+        measure(("ToJson into reused buffer" + suffix).c_str(), [&]() {
+            buffer.clear();
+            osrs::ToJson(snapshot, buffer);
+            return buffer.size();
+        });
+        measure(("ostringstream baseline" + suffix).c_str(), [&]() { return legacyToJson(snapshot).size(); });
+    }
+    return 0;
+}
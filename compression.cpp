@@ -0,0 +1,233 @@
+#include "compression.h"
+#include "http_request.h"
+
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+#include <memory>
+
+#include <zlib.h>
+#ifdef HTTPS_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+    using https::equalsIgnoreCase;
+
+    const int kGzipLevel = 6;
+    const int kZstdLevel = 3;
+
+    std::atomic<std::uint64_t> g_bytesSent[https::kContentEncodingCount];
+    std::atomic<std::uint64_t> g_bytesBeforeCompression(0);
+
+    std::string_view trim(std::string_view value)
+    {
+        while (!value.empty() && std::isspace(static_cast<unsigned char>(value.front())))
+        {
+            value.remove_prefix(1);
+        }
+        while (!value.empty() && std::isspace(static_cast<unsigned char>(value.back())))
+        {
+            value.remove_suffix(1);
+        }
+        return value;
+    }
+
+    // q-value of one Accept-Encoding entry such as "gzip;q=0.8"; 1 when absent.
+    double qualityOf(std::string_view parameters)
+    {
+        while (!parameters.empty())
+        {
+            const std::size_t semicolon = parameters.find(';');
+            std::string_view parameter = trim(parameters.substr(0, semicolon));
+            if (parameter.size() > 2 && (parameter[0] == 'q' || parameter[0] == 'Q') && parameter[1] == '=')
+            {
+                return std::strtod(std::string(parameter.substr(2)).c_str(), nullptr);
+            }
+            parameters = semicolon == std::string_view::npos ? std::string_view() : parameters.substr(semicolon + 1);
+        }
+        return 1.0;
+    }
+
+    // One deflate stream per thread, reset between bodies instead of reallocated.
+    struct GzipStream
+    {
+        z_stream stream;
+        bool ready;
+
+        GzipStream() : stream(), ready(false)
+        {
+            // windowBits 15 + 16 asks zlib for a gzip wrapper rather than a raw zlib one.
+            ready = deflateInit2(&stream, kGzipLevel, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+        }
+
+        ~GzipStream()
+        {
+            if (ready)
+            {
+                deflateEnd(&stream);
+            }
+        }
+    };
+
+    bool gzip(std::string_view input, std::string &out)
+    {
+        thread_local GzipStream gz;
+        if (!gz.ready || deflateReset(&gz.stream) != Z_OK)
+        {
+            return false;
+        }
+
+        out.resize(deflateBound(&gz.stream, static_cast<uLong>(input.size())));
+        gz.stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(input.data()));
+        gz.stream.avail_in = static_cast<uInt>(input.size());
+        gz.stream.next_out = reinterpret_cast<Bytef *>(&out[0]);
+        gz.stream.avail_out = static_cast<uInt>(out.size());
+        if (deflate(&gz.stream, Z_FINISH) != Z_STREAM_END)
+        {
+            return false;
+        }
+        out.resize(gz.stream.total_out);
+        return true;
+    }
+
+#ifdef HTTPS_WITH_ZSTD
+    bool zstd(std::string_view input, std::string &out)
+    {
+        thread_local std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx *)> context(ZSTD_createCCtx(), &ZSTD_freeCCtx);
+        if (!context)
+        {
+            return false;
+        }
+
+        out.resize(ZSTD_compressBound(input.size()));
+        const size_t written = ZSTD_compressCCtx(context.get(), &out[0], out.size(), input.data(), input.size(), kZstdLevel);
+        if (ZSTD_isError(written))
+        {
+            return false;
+        }
+        out.resize(written);
+        return true;
+    }
+#endif
+}
+
+namespace https
+{
+    std::string_view encodingName(ContentEncoding encoding)
+    {
+        switch (encoding)
+        {
+        case ContentEncoding::Gzip:
+            return "gzip";
+        case ContentEncoding::Zstd:
+            return "zstd";
+        default:
+            return "identity";
+        }
+    }
+
+    bool encodingSupported(ContentEncoding encoding)
+    {
+        switch (encoding)
+        {
+        case ContentEncoding::Identity:
+        case ContentEncoding::Gzip:
+            return true;
+        case ContentEncoding::Zstd:
+#ifdef HTTPS_WITH_ZSTD
+            return true;
+#else
+            return false;
+#endif
+        default:
+            return false;
+        }
+    }
+
+    ContentEncoding negotiateEncoding(std::string_view acceptEncoding)
+    {
+        // -1 marks codings the client did not name; they take the "*" entry's q, if any.
+        double quality[kContentEncodingCount] = {-1.0, -1.0, -1.0};
+        double wildcard = 0.0;
+        while (!acceptEncoding.empty())
+        {
+            const std::size_t comma = acceptEncoding.find(',');
+            const std::string_view entry = acceptEncoding.substr(0, comma);
+            const std::size_t semicolon = entry.find(';');
+            const std::string_view token = trim(entry.substr(0, semicolon));
+            const double q = semicolon == std::string_view::npos ? 1.0 : qualityOf(entry.substr(semicolon + 1));
+
+            if (equalsIgnoreCase(token, "gzip") || equalsIgnoreCase(token, "x-gzip"))
+            {
+                quality[static_cast<std::size_t>(ContentEncoding::Gzip)] = q;
+            }
+            else if (equalsIgnoreCase(token, "zstd"))
+            {
+                quality[static_cast<std::size_t>(ContentEncoding::Zstd)] = q;
+            }
+            else if (token == "*")
+            {
+                wildcard = q;
+            }
+            acceptEncoding = comma == std::string_view::npos ? std::string_view() : acceptEncoding.substr(comma + 1);
+        }
+
+        // Highest q wins; on a tie our preference is zstd, then gzip.
+        ContentEncoding best = ContentEncoding::Identity;
+        double bestQuality = 0.0;
+        for (ContentEncoding candidate : {ContentEncoding::Zstd, ContentEncoding::Gzip})
+        {
+            double q = quality[static_cast<std::size_t>(candidate)];
+            if (q < 0.0)
+            {
+                q = wildcard;
+            }
+            if (encodingSupported(candidate) && q > bestQuality)
+            {
+                best = candidate;
+                bestQuality = q;
+            }
+        }
+        return best;
+    }
+
+    bool compress(ContentEncoding encoding, std::string_view input, std::string &out)
+    {
+        bool compressed = false;
+        switch (encoding)
+        {
+        case ContentEncoding::Gzip:
+            compressed = gzip(input, out);
+            break;
+#ifdef HTTPS_WITH_ZSTD
+        case ContentEncoding::Zstd:
+            compressed = zstd(input, out);
+            break;
+#endif
+        default:
+            break;
+        }
+        return compressed && out.size() < input.size();
+    }
+
+    void recordResponseBytes(ContentEncoding encoding, std::size_t wireBytes, std::size_t originalBytes)
+    {
+        g_bytesSent[static_cast<std::size_t>(encoding)].fetch_add(wireBytes, std::memory_order_relaxed);
+        if (encoding != ContentEncoding::Identity)
+        {
+            g_bytesBeforeCompression.fetch_add(originalBytes, std::memory_order_relaxed);
+        }
+    }
+
+    CompressionStats compressionStats()
+    {
+        CompressionStats stats{};
+        for (std::size_t i = 0; i < kContentEncodingCount; ++i)
+        {
+            stats.bytesSent[i] = g_bytesSent[i].load(std::memory_order_relaxed);
+        }
+        stats.bytesBeforeCompression = g_bytesBeforeCompression.load(std::memory_order_relaxed);
+        return stats;
+    }
+} // namespace https
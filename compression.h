@@ -0,0 +1,49 @@
+#ifndef INCLUDED_COMPRESSION
+#define INCLUDED_COMPRESSION
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace https
+{
+    // Content codings the server can produce. zstd needs the build to define
+    // HTTPS_WITH_ZSTD and link libzstd; without it, clients asking for zstd get gzip.
+    enum class ContentEncoding
+    {
+        Identity,
+        Gzip,
+        Zstd,
+        Count
+    };
+
+    constexpr std::size_t kContentEncodingCount = static_cast<std::size_t>(ContentEncoding::Count);
+
+    struct CompressionStats
+    {
+        // Response body bytes sent per coding, indexed by ContentEncoding.
+        std::uint64_t bytesSent[kContentEncodingCount];
+        // What the compressed bodies among those would have cost uncompressed.
+        std::uint64_t bytesBeforeCompression;
+    };
+
+    // The token used in Content-Encoding, e.g. "gzip".
+    std::string_view encodingName(ContentEncoding encoding);
+
+    bool encodingSupported(ContentEncoding encoding);
+
+    // Picks the best coding this build supports from an Accept-Encoding value,
+    // honouring q-values (q=0 refuses a coding). Identity when nothing matches.
+    ContentEncoding negotiateEncoding(std::string_view acceptEncoding);
+
+    // Compresses input into out (replacing its contents). Returns false, leaving
+    // out unspecified, if the coding is unsupported or the result is not smaller.
+    bool compress(ContentEncoding encoding, std::string_view input, std::string &out);
+
+    // Counts a response body of wireBytes sent with encoding, originally originalBytes long.
+    void recordResponseBytes(ContentEncoding encoding, std::size_t wireBytes, std::size_t originalBytes);
+    CompressionStats compressionStats();
+} // namespace https
+
+#endif
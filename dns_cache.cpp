@@ -0,0 +1,203 @@
+#include "dns_cache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include <netdb.h>
+#include <netinet/in.h>
+
+namespace https
+{
+    bool systemResolve(const std::string &host, int port, DnsAnswer &answer)
+    {
+        addrinfo hints;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC; // A and AAAA
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_ADDRCONFIG | AI_NUMERICSERV;
+
+        addrinfo *results = nullptr;
+        const std::string service = std::to_string(port);
+        if (getaddrinfo(host.c_str(), service.c_str(), &hints, &results) != 0)
+        {
+            return false;
+        }
+
+        answer.addresses.clear();
+        for (addrinfo *result = results; result; result = result->ai_next)
+        {
+            if (result->ai_addrlen > sizeof(sockaddr_storage))
+            {
+                continue;
+            }
+            ResolvedAddress address;
+            std::memset(&address.address, 0, sizeof(address.address));
+            std::memcpy(&address.address, result->ai_addr, result->ai_addrlen);
+            address.length = result->ai_addrlen;
+            answer.addresses.push_back(address);
+        }
+        freeaddrinfo(results);
+        return !answer.addresses.empty();
+    }
+
+    DnsCache::DnsCache(DnsCacheOptions options, Resolver resolver) : m_options(options),
+                                                                     m_resolver(resolver ? std::move(resolver) : Resolver(&systemResolve)),
+                                                                     m_stopping(false),
+                                                                     m_lookups(0),
+                                                                     m_resolutions(0),
+                                                                     m_failures(0),
+                                                                     m_staleServed(0),
+                                                                     m_refresher(&DnsCache::refreshLoop, this)
+    {
+    }
+
+    DnsCache::~DnsCache()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wakeRefresher.notify_all();
+        m_refresher.join();
+    }
+
+    DnsCache::Entry &DnsCache::entryFor(const std::string &host, int port)
+    {
+        const std::string key = host + ":" + std::to_string(port);
+        auto it = m_entries.find(key);
+        if (it == m_entries.end())
+        {
+            Entry entry;
+            entry.host = host;
+            entry.port = port;
+            entry.refreshAt = std::chrono::steady_clock::now();
+            it = m_entries.emplace(key, std::move(entry)).first;
+            m_wakeRefresher.notify_one();
+        }
+        return it->second;
+    }
+
+    void DnsCache::prefetch(const std::string &host, int port)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        entryFor(host, port);
+    }
+
+    std::vector<ResolvedAddress> DnsCache::candidates(const std::string &host, int port, std::chrono::steady_clock::time_point deadline)
+    {
+        std::vector<ResolvedAddress> v6;
+        std::vector<ResolvedAddress> v4;
+        std::size_t rotation;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            ++m_lookups;
+            Entry &entry = entryFor(host, port);
+            if (!entry.resolved)
+            {
+                // Unordered_map references survive rehashing, so entry stays valid across the wait.
+                const auto waitUntil = std::min(deadline, std::chrono::steady_clock::now() + std::chrono::milliseconds(m_options.firstLookupTimeoutMs));
+                m_resolved.wait_until(lock, waitUntil, [&entry, this] { return entry.resolved || m_stopping; });
+            }
+            if (!entry.addresses.empty() && std::chrono::steady_clock::now() >= entry.expiresAt)
+            {
+                ++m_staleServed;
+            }
+
+            rotation = entry.rotation++;
+            for (const ResolvedAddress &address : entry.addresses)
+            {
+                (address.family() == AF_INET6 ? v6 : v4).push_back(address);
+            }
+        }
+
+        // Each call starts one record further along, in both families.
+        if (!v6.empty())
+        {
+            std::rotate(v6.begin(), v6.begin() + rotation % v6.size(), v6.end());
+        }
+        if (!v4.empty())
+        {
+            std::rotate(v4.begin(), v4.begin() + rotation % v4.size(), v4.end());
+        }
+
+        // IPv6 first, then alternate, so a broken family costs one attempt delay rather than a timeout.
+        std::vector<ResolvedAddress> ordered;
+        ordered.reserve(v6.size() + v4.size());
+        for (std::size_t i = 0; i < std::max(v6.size(), v4.size()); ++i)
+        {
+            if (i < v6.size())
+            {
+                ordered.push_back(v6[i]);
+            }
+            if (i < v4.size())
+            {
+                ordered.push_back(v4[i]);
+            }
+        }
+        return ordered;
+    }
+
+    DnsCache::Stats DnsCache::stats() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return Stats{m_lookups, m_resolutions, m_failures, m_staleServed};
+    }
+
+    void DnsCache::refreshLoop()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_stopping)
+        {
+            const auto now = std::chrono::steady_clock::now();
+            Entry *due = nullptr;
+            auto nextWake = now + std::chrono::hours(1);
+            for (auto &item : m_entries)
+            {
+                Entry &entry = item.second;
+                if (entry.refreshAt <= now)
+                {
+                    due = &entry;
+                    break;
+                }
+                nextWake = std::min(nextWake, entry.refreshAt);
+            }
+
+            if (!due)
+            {
+                m_wakeRefresher.wait_until(lock, nextWake);
+                continue;
+            }
+
+            // getaddrinfo can take seconds; nobody waits on it but a host's very first lookup.
+            const std::string host = due->host;
+            const int port = due->port;
+            lock.unlock();
+            DnsAnswer answer;
+            const bool ok = m_resolver(host, port, answer) && !answer.addresses.empty();
+            lock.lock();
+
+            const auto resolvedAt = std::chrono::steady_clock::now();
+            if (ok)
+            {
+                ++m_resolutions;
+                const int ttl = answer.ttlSeconds >= 0 ? answer.ttlSeconds : m_options.ttlSeconds;
+                due->addresses = std::move(answer.addresses);
+                due->expiresAt = resolvedAt + std::chrono::seconds(ttl);
+                due->refreshAt = resolvedAt + std::chrono::seconds(std::max(1, ttl - m_options.refreshAheadSeconds));
+            }
+            else
+            {
+                // Keep serving the last good answer, however old, and try again soon.
+                ++m_failures;
+                due->refreshAt = resolvedAt + std::chrono::seconds(std::max(1, m_options.retrySeconds));
+            }
+            if (!due->resolved)
+            {
+                due->resolved = true;
+                m_resolved.notify_all();
+            }
+        }
+        m_resolved.notify_all();
+    }
+} // namespace https
@@ -0,0 +1,119 @@
+#ifndef INCLUDED_DNS_CACHE
+#define INCLUDED_DNS_CACHE
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/socket.h>
+
+namespace https
+{
+    // One address to connect to, IPv4 or IPv6, port included.
+    struct ResolvedAddress
+    {
+        sockaddr_storage address;
+        socklen_t length;
+
+        int family() const { return address.ss_family; }
+    };
+
+    struct DnsAnswer
+    {
+        std::vector<ResolvedAddress> addresses;
+        // Seconds the answer may be used for. getaddrinfo does not report record
+        // TTLs, so the system resolver leaves this at -1 and the cache's default applies.
+        int ttlSeconds = -1;
+    };
+
+    // Resolves host and port into every A and AAAA address. Returns false on failure.
+    using Resolver = std::function<bool(const std::string &host, int port, DnsAnswer &answer)>;
+
+    // The blocking getaddrinfo() resolver the cache uses unless given another one.
+    bool systemResolve(const std::string &host, int port, DnsAnswer &answer);
+
+    struct DnsCacheOptions
+    {
+        // Lifetime of answers that carry no TTL of their own.
+        int ttlSeconds = 60;
+        // Answers are re-resolved in the background this long before they expire.
+        int refreshAheadSeconds = 10;
+        // Delay before retrying after a failed refresh. The last good answer stays in use meanwhile.
+        int retrySeconds = 5;
+        // How long the very first lookup of a host may wait for its initial resolution.
+        int firstLookupTimeoutMs = 5000;
+    };
+
+    // Resolved upstream addresses, refreshed by a background thread so that
+    // callers only ever read from memory. Thread-safe.
+    class DnsCache
+    {
+        public:
+            struct Stats
+            {
+                std::uint64_t lookups;     // calls to candidates()
+                std::uint64_t resolutions; // successful resolver calls
+                std::uint64_t failures;    // failed resolver calls
+                std::uint64_t staleServed; // lookups answered from an expired entry whose refresh failed
+            };
+
+            explicit DnsCache(DnsCacheOptions options = DnsCacheOptions(), Resolver resolver = Resolver());
+            ~DnsCache();
+
+            DnsCache(const DnsCache &) = delete;
+            DnsCache &operator=(const DnsCache &) = delete;
+
+            // Starts resolving host in the background so the first lookup finds it ready.
+            void prefetch(const std::string &host, int port);
+
+            // Addresses to try for host, in connection order: rotated across calls
+            // so load spreads over every record, and alternating IPv6 and IPv4 for
+            // happy eyeballs. Only a host never seen before waits for the resolver,
+            // until deadline at the latest; empty if that first resolution fails or times out.
+            std::vector<ResolvedAddress> candidates(const std::string &host, int port,
+                                                    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max());
+
+            Stats stats() const;
+
+        private:
+            struct Entry
+            {
+                std::string host;
+                int port = 0;
+                std::vector<ResolvedAddress> addresses; // last good answer
+                std::chrono::steady_clock::time_point expiresAt;
+                std::chrono::steady_clock::time_point refreshAt;
+                std::size_t rotation = 0;
+                bool resolved = false; // the first resolution finished, successfully or not
+            };
+
+            DnsCacheOptions m_options;
+            Resolver m_resolver;
+
+            mutable std::mutex m_mutex;
+            std::condition_variable m_wakeRefresher;
+            std::condition_variable m_resolved;
+            std::unordered_map<std::string, Entry> m_entries; // keyed by "host:port"
+            bool m_stopping;
+
+            std::uint64_t m_lookups;
+            std::uint64_t m_resolutions;
+            std::uint64_t m_failures;
+            std::uint64_t m_staleServed;
+
+            std::thread m_refresher; // started last, once everything above is initialized
+
+            Entry &entryFor(const std::string &host, int port);
+            void refreshLoop();
+    };
+} // namespace https
+
+#endif
@@ -0,0 +1,499 @@
+#include "history_store.h"
+#include "json_writer.h"
+#include "logger.h"
+#include "player_cache.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    const char kMagic[8] = {'O', 'S', 'R', 'S', 'H', 'I', 'S', '1'};
+
+    // Mappings grow in steps of at least this much so appends rarely remap.
+    const std::size_t kMinMapLength = 64 * 1024 * 1024;
+
+    // Record types. A player record introduces the numeric id later samples
+    // refer to; a keyframe is encoded against zeroed skills instead of the
+    // previous sample.
+    enum RecordType : unsigned char {
+        kPlayerRecord = 1,
+        kSampleRecord = 2,
+        kKeyframeRecord = 3,
+    };
+
+    void putVarint(std::string &out, std::uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    bool getVarint(const unsigned char *&p, const unsigned char *end, std::uint64_t &value)
+    {
+        value = 0;
+        for (int shift = 0; shift < 64 && p < end; shift += 7)
+        {
+            const unsigned char byte = *p++;
+            value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Small negative deltas (a rank improving) should stay as short as small positive ones.
+    std::uint64_t zigzag(std::int64_t value)
+    {
+        return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+    }
+
+    std::int64_t unzigzag(std::uint64_t value)
+    {
+        return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+    }
+
+    // Splits the framed record at p into its type, player id and body, and moves p past it.
+    bool nextRecord(const unsigned char *&p, const unsigned char *end, unsigned char &type, std::uint64_t &id,
+                    const unsigned char *&body, const unsigned char *&bodyEnd)
+    {
+        std::uint64_t length = 0;
+        if (!getVarint(p, end, length) || length == 0 || length > static_cast<std::uint64_t>(end - p))
+        {
+            return false;
+        }
+
+        const unsigned char *recordEnd = p + length;
+        type = *p++;
+        if (!getVarint(p, recordEnd, id))
+        {
+            return false;
+        }
+
+        body = p;
+        bodyEnd = recordEnd;
+        p = recordEnd;
+        return true;
+    }
+
+    // Applies a sample body to the running time and skill values.
+    bool applySample(const unsigned char *p, const unsigned char *end, bool keyframe, std::int64_t &time,
+                     osrs::HistoryStore::Skills &skills)
+    {
+        std::uint64_t encodedTime = 0;
+        std::uint64_t mask = 0;
+        if (!getVarint(p, end, encodedTime) || !getVarint(p, end, mask) || (mask >> osrs::kSkillCount) != 0)
+        {
+            return false;
+        }
+
+        if (keyframe)
+        {
+            time = static_cast<std::int64_t>(encodedTime);
+            skills.fill(osrs::SkillStats());
+        }
+        else
+        {
+            time += static_cast<std::int64_t>(encodedTime);
+        }
+
+        for (std::size_t i = 0; i < osrs::kSkillCount; ++i)
+        {
+            if (!(mask & (std::uint64_t(1) << i)))
+            {
+                continue;
+            }
+            std::uint64_t rank = 0;
+            std::uint64_t level = 0;
+            std::uint64_t experience = 0;
+            if (!getVarint(p, end, rank) || !getVarint(p, end, level) || !getVarint(p, end, experience))
+            {
+                return false;
+            }
+            skills[i].rank += static_cast<int>(unzigzag(rank));
+            skills[i].level += static_cast<int>(unzigzag(level));
+            skills[i].experience += unzigzag(experience);
+        }
+        return p == end;
+    }
+}
+
+namespace osrs {
+
+std::unique_ptr<HistoryStore> HistoryStore::open(const HistoryStoreOptions &options)
+{
+    const int fd = ::open(options.path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        https::logEvent(https::LogLevel::Error, "history_open_failed", options.path + ": " + std::strerror(errno));
+        return nullptr;
+    }
+
+    std::unique_ptr<HistoryStore> store(new HistoryStore(fd, options));
+    if (!store->load())
+    {
+        https::logEvent(https::LogLevel::Error, "history_load_failed", options.path);
+        return nullptr;
+    }
+    return store;
+}
+
+HistoryStore::HistoryStore(int fd, const HistoryStoreOptions &options)
+    : m_options(options),
+      m_fd(fd),
+      m_map(nullptr),
+      m_mapLength(0),
+      m_size(0),
+      m_samples(0)
+{
+    if (m_options.keyframeInterval == 0)
+    {
+        m_options.keyframeInterval = 1;
+    }
+}
+
+HistoryStore::~HistoryStore()
+{
+    if (m_map)
+    {
+        munmap(const_cast<unsigned char *>(m_map), m_mapLength);
+    }
+    close(m_fd);
+}
+
+bool HistoryStore::load()
+{
+    struct stat info;
+    if (fstat(m_fd, &info) != 0)
+    {
+        return false;
+    }
+
+    if (info.st_size == 0)
+    {
+        if (!writeAtEnd(std::string(kMagic, sizeof(kMagic))))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        m_size = static_cast<std::uint64_t>(info.st_size);
+        if (!mapAtLeast(m_size) || m_size < sizeof(kMagic) || std::memcmp(m_map, kMagic, sizeof(kMagic)) != 0)
+        {
+            return false;
+        }
+    }
+
+    const unsigned char *const begin = m_map;
+    const unsigned char *const end = m_map + m_size;
+    const unsigned char *p = begin + sizeof(kMagic);
+    while (p < end)
+    {
+        const unsigned char *record = p;
+        unsigned char type = 0;
+        std::uint64_t id = 0;
+        const unsigned char *body = nullptr;
+        const unsigned char *bodyEnd = nullptr;
+        bool valid = nextRecord(p, end, type, id, body, bodyEnd);
+
+        if (valid && type == kPlayerRecord)
+        {
+            std::string key(reinterpret_cast<const char *>(body), static_cast<std::size_t>(bodyEnd - body));
+            valid = id == m_seriesById.size() && m_series.find(key) == m_series.end();
+            if (valid)
+            {
+                Series &series = m_series[key];
+                series.id = id;
+                m_seriesById.push_back(&series);
+            }
+        }
+        else if (valid && (type == kSampleRecord || type == kKeyframeRecord))
+        {
+            valid = id < m_seriesById.size();
+            if (valid)
+            {
+                Series &series = *m_seriesById[id];
+                const bool keyframe = type == kKeyframeRecord;
+                // Decode into copies so a torn record leaves the series' base values intact.
+                std::int64_t time = series.lastTime;
+                Skills skills = series.last;
+                valid = (keyframe || !series.samples.empty()) && applySample(body, bodyEnd, keyframe, time, skills);
+                if (valid)
+                {
+                    series.last = skills;
+                    series.lastTime = time;
+                    series.samples.push_back(IndexEntry{time, static_cast<std::uint64_t>(record - begin), keyframe});
+                    series.sinceKeyframe = keyframe ? 0 : series.sinceKeyframe + 1;
+                    ++m_samples;
+                }
+            }
+        }
+        else
+        {
+            valid = false;
+        }
+
+        if (!valid)
+        {
+            // Only the tail can be damaged, by a crash part way through an append.
+            https::logEvent(https::LogLevel::Warn, "history_truncated", m_options.path,
+                            {{"offset", static_cast<std::int64_t>(record - begin)}});
+            m_size = static_cast<std::uint64_t>(record - begin);
+            return ftruncate(m_fd, static_cast<off_t>(m_size)) == 0;
+        }
+    }
+    return true;
+}
+
+bool HistoryStore::mapAtLeast(std::uint64_t size)
+{
+    if (size <= m_mapLength)
+    {
+        return true;
+    }
+
+    // Map past the end of the file so the mapping can follow appends without
+    // being replaced each time; bytes beyond m_size are never touched.
+    std::size_t length = std::max(kMinMapLength, m_mapLength * 2);
+    while (length < size)
+    {
+        length *= 2;
+    }
+
+    void *map = mmap(nullptr, length, PROT_READ, MAP_SHARED, m_fd, 0);
+    if (map == MAP_FAILED)
+    {
+        return false;
+    }
+
+    if (m_map)
+    {
+        munmap(const_cast<unsigned char *>(m_map), m_mapLength);
+    }
+    m_map = static_cast<const unsigned char *>(map);
+    m_mapLength = length;
+    return true;
+}
+
+bool HistoryStore::writeAtEnd(const std::string &bytes)
+{
+    std::size_t written = 0;
+    while (written < bytes.size())
+    {
+        const ssize_t result = pwrite(m_fd, bytes.data() + written, bytes.size() - written,
+                                      static_cast<off_t>(m_size + written));
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            // Drop the partial record rather than leave it for the next load to trip over.
+            if (ftruncate(m_fd, static_cast<off_t>(m_size)) != 0)
+            {
+                https::logEvent(https::LogLevel::Error, "history_rollback_failed", std::strerror(errno));
+            }
+            return false;
+        }
+        written += static_cast<std::size_t>(result);
+    }
+
+    if (!mapAtLeast(m_size + bytes.size()))
+    {
+        return false;
+    }
+    m_size += bytes.size();
+    return true;
+}
+
+bool HistoryStore::append(const std::string &key, const PlayerSnapshot &snapshot, std::int64_t time)
+{
+    // Skills missing from the response keep their defaults, exactly as they decode.
+    const Skills &current = snapshot.skills;
+
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+
+    std::string bytes;
+    auto it = m_series.find(key);
+    const bool newPlayer = it == m_series.end();
+    const std::uint64_t id = newPlayer ? m_seriesById.size() : it->second.id;
+    if (newPlayer)
+    {
+        std::string record;
+        record.push_back(static_cast<char>(kPlayerRecord));
+        putVarint(record, id);
+        record += key;
+        putVarint(bytes, record.size());
+        bytes += record;
+    }
+
+    const Series *series = newPlayer ? nullptr : &it->second;
+    const bool keyframe = !series || series->samples.empty() ||
+                          series->sinceKeyframe + 1 >= m_options.keyframeInterval;
+    // Samples are indexed by time, so a clock stepping backwards must not reorder them.
+    if (series && time < series->lastTime)
+    {
+        time = series->lastTime;
+    }
+
+    // Ranks drift between almost any two samples as other players move, so
+    // they only make a skill worth storing in a keyframe; otherwise a rank is
+    // carried along when its skill's level or experience changes.
+    const Skills base = keyframe ? Skills() : series->last;
+    Skills stored = base;
+    std::uint64_t mask = 0;
+    std::string deltas;
+    for (std::size_t i = 0; i < kSkillCount; ++i)
+    {
+        const bool trained = current[i].level != base[i].level || current[i].experience != base[i].experience;
+        if (!trained && (!keyframe || current[i].rank == base[i].rank))
+        {
+            continue;
+        }
+        mask |= std::uint64_t(1) << i;
+        stored[i] = current[i];
+        putVarint(deltas, zigzag(static_cast<std::int64_t>(current[i].rank) - base[i].rank));
+        putVarint(deltas, zigzag(static_cast<std::int64_t>(current[i].level) - base[i].level));
+        putVarint(deltas, zigzag(current[i].experience - base[i].experience));
+    }
+
+    std::string record;
+    record.push_back(static_cast<char>(keyframe ? kKeyframeRecord : kSampleRecord));
+    putVarint(record, id);
+    putVarint(record, static_cast<std::uint64_t>(keyframe ? time : time - series->lastTime));
+    putVarint(record, mask);
+    record += deltas;
+
+    const std::uint64_t sampleOffset = m_size + bytes.size();
+    putVarint(bytes, record.size());
+    bytes += record;
+
+    // The player record and its first sample go out in one write.
+    if (!writeAtEnd(bytes))
+    {
+        return false;
+    }
+
+    Series &target = newPlayer ? m_series[key] : it->second;
+    if (newPlayer)
+    {
+        target.id = id;
+        m_seriesById.push_back(&target);
+    }
+    target.samples.push_back(IndexEntry{time, sampleOffset, keyframe});
+    // What a reader decodes, stale ranks included, so the next sample is encoded against that.
+    target.last = stored;
+    target.lastTime = time;
+    target.sinceKeyframe = keyframe ? 0 : target.sinceKeyframe + 1;
+    ++m_samples;
+    return true;
+}
+
+bool HistoryStore::query(const std::string &key, std::int64_t from, std::int64_t to, const Visitor &visit) const
+{
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+
+    auto it = m_series.find(key);
+    if (it == m_series.end())
+    {
+        return false;
+    }
+
+    const std::vector<IndexEntry> &samples = it->second.samples;
+    auto first = std::lower_bound(samples.begin(), samples.end(), from,
+                                  [](const IndexEntry &entry, std::int64_t time) { return entry.time < time; });
+    if (first == samples.end() || first->time > to)
+    {
+        return true;
+    }
+
+    // Decode forward from the keyframe at or before the first sample in range.
+    std::size_t index = static_cast<std::size_t>(first - samples.begin());
+    std::size_t start = index;
+    while (!samples[start].keyframe)
+    {
+        --start;
+    }
+
+    const unsigned char *const end = m_map + m_size;
+    std::int64_t time = 0;
+    Skills skills;
+    for (std::size_t i = start; i < samples.size() && samples[i].time <= to; ++i)
+    {
+        const unsigned char *p = m_map + samples[i].offset;
+        unsigned char type = 0;
+        std::uint64_t id = 0;
+        const unsigned char *body = nullptr;
+        const unsigned char *bodyEnd = nullptr;
+        if (!nextRecord(p, end, type, id, body, bodyEnd) ||
+            !applySample(body, bodyEnd, type == kKeyframeRecord, time, skills))
+        {
+            break; // validated on load and append, so only reachable if the file was edited underneath us
+        }
+        if (i >= index)
+        {
+            visit(time, skills);
+        }
+    }
+    return true;
+}
+
+HistoryStore::Stats HistoryStore::stats() const
+{
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    return Stats{m_series.size(), m_samples, m_size};
+}
+
+bool HistoryToJson(const HistoryStore &store, const std::string &playerName, std::int64_t from, std::int64_t to,
+                   std::string &json)
+{
+    json.clear();
+    json += "{\"name\":";
+    appendJsonString(json, playerName);
+    json += ",\"skills\":[";
+    for (std::size_t i = 0; i < kSkillCount; ++i)
+    {
+        if (i > 0)
+        {
+            json += ',';
+        }
+        json += '"';
+        json += kSkillOrder[i];
+        json += '"';
+    }
+    json += "],\"samples\":[";
+
+    bool firstSample = true;
+    const bool found = store.query(normalizeName(playerName), from, to,
+                                   [&json, &firstSample](std::int64_t time, const HistoryStore::Skills &skills) {
+                                       json += firstSample ? "{\"time\":" : ",{\"time\":";
+                                       firstSample = false;
+                                       appendInt(json, time);
+                                       json += ",\"experience\":[";
+                                       for (std::size_t i = 0; i < kSkillCount; ++i)
+                                       {
+                                           if (i > 0)
+                                           {
+                                               json += ',';
+                                           }
+                                           appendInt(json, skills[i].experience);
+                                       }
+                                       json += "]}";
+                                   });
+    json += "]}";
+    return found;
+}
+
+} // namespace osrs
@@ -0,0 +1,110 @@
+#ifndef OSRS_HISTORY_STORE_H
+#define OSRS_HISTORY_STORE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "osrs_hiscore.h"
+
+namespace osrs {
+
+struct HistoryStoreOptions {
+    // Append-only data file, created on first use. Nothing removes old samples,
+    // so the file grows with every fetch; empty (the default) records nothing.
+    std::string path;
+    // Every Nth sample of a player is stored in full, so a range read never
+    // decodes more than N-1 samples before the range starts.
+    std::size_t keyframeInterval = 64;
+};
+
+// Embedded time-series store of player snapshots.
+//
+// Samples are appended to a single file as varint records. Each one holds only
+// the skills whose level or experience changed since the player's previous
+// sample, so a snapshot in which nobody trained is a handful of bytes. Ranks
+// are kept at keyframes and alongside those changes, so a visited rank may be
+// older than its sample. The file is mapped read-only and queries decode
+// straight out of the mapping; the per-player index of sample offsets lives in
+// memory and is rebuilt by scanning the file on open.
+//
+// Safe to use from any thread.
+class HistoryStore {
+public:
+    using Skills = std::array<SkillStats, kSkillCount>;
+    // Receives the unix time of a sample and every skill's value at that time.
+    using Visitor = std::function<void(std::int64_t time, const Skills &skills)>;
+
+    struct Stats {
+        std::uint64_t players;
+        std::uint64_t samples;
+        std::uint64_t bytes; // size of the data file
+    };
+
+    // Returns nullptr (after printing why) if the file cannot be opened or is
+    // not a history file.
+    static std::unique_ptr<HistoryStore> open(const HistoryStoreOptions &options);
+
+    ~HistoryStore();
+
+    HistoryStore(const HistoryStore &) = delete;
+    HistoryStore &operator=(const HistoryStore &) = delete;
+
+    // Records a successful snapshot for a normalized key at unix time `time`.
+    bool append(const std::string &key, const PlayerSnapshot &snapshot, std::int64_t time);
+
+    // Visits the samples of key with from <= time <= to, oldest first. Returns
+    // false if nothing has ever been recorded for key.
+    bool query(const std::string &key, std::int64_t from, std::int64_t to, const Visitor &visit) const;
+
+    Stats stats() const;
+
+private:
+    struct IndexEntry {
+        std::int64_t time;
+        std::uint64_t offset; // start of the record in the file
+        bool keyframe;
+    };
+
+    struct Series {
+        std::uint64_t id = 0;
+        std::vector<IndexEntry> samples;
+        // Values after the newest sample: the base the next one is encoded against.
+        Skills last;
+        std::int64_t lastTime = 0;
+        std::size_t sinceKeyframe = 0;
+    };
+
+    HistoryStore(int fd, const HistoryStoreOptions &options);
+
+    // Rebuilds the index from the file, cutting off a record torn by a crash mid-append.
+    bool load();
+    bool mapAtLeast(std::uint64_t size);
+    bool writeAtEnd(const std::string &bytes);
+
+    HistoryStoreOptions m_options;
+    int m_fd;
+    const unsigned char *m_map;
+    std::size_t m_mapLength;
+    std::uint64_t m_size;
+
+    mutable std::shared_mutex m_mutex;
+    std::unordered_map<std::string, Series> m_series;
+    std::vector<Series *> m_seriesById;
+    std::uint64_t m_samples;
+};
+
+// {"name":...,"skills":[...],"samples":[{"time":...,"experience":[...]}]}
+// for the samples of playerName in [from, to]. Returns false if the player has no history.
+bool HistoryToJson(const HistoryStore &store, const std::string &playerName, std::int64_t from, std::int64_t to,
+                   std::string &json);
+
+} // namespace osrs
+
+#endif // OSRS_HISTORY_STORE_H
@@ -0,0 +1,357 @@
+#include "http_request.h"
+
+#include <charconv>
+
+namespace {
+    constexpr std::string_view kCrlf = "\r\n";
+    constexpr std::string_view kHeadTerminator = "\r\n\r\n";
+
+    char asciiLower(char ch)
+    {
+        return (ch >= 'A' && ch <= 'Z') ? static_cast<char>(ch - 'A' + 'a') : ch;
+    }
+
+    int hexValue(char ch)
+    {
+        if (ch >= '0' && ch <= '9')
+        {
+            return ch - '0';
+        }
+        if (ch >= 'a' && ch <= 'f')
+        {
+            return ch - 'a' + 10;
+        }
+        if (ch >= 'A' && ch <= 'F')
+        {
+            return ch - 'A' + 10;
+        }
+        return -1;
+    }
+
+    std::string_view trim(std::string_view value)
+    {
+        while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+        {
+            value.remove_prefix(1);
+        }
+        while (!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+        {
+            value.remove_suffix(1);
+        }
+        return value;
+    }
+
+    bool needsDecoding(std::string_view value)
+    {
+        return value.find_first_of("%+") != std::string_view::npos;
+    }
+}
+
+namespace https
+{
+    HttpRequestParser::HttpRequestParser(std::size_t maxHeaderBytes, std::size_t maxBodyBytes) : m_maxHeaderBytes(maxHeaderBytes),
+                                                                                                 m_maxBodyBytes(maxBodyBytes),
+                                                                                                 m_scanned(0),
+                                                                                                 m_headerEnd(0),
+                                                                                                 m_contentLength(0)
+    {
+    }
+
+    void HttpRequestParser::reset()
+    {
+        m_scanned = 0;
+        m_headerEnd = 0;
+        m_contentLength = 0;
+    }
+
+    ParseStatus HttpRequestParser::parse(std::string_view input, HttpRequest &request)
+    {
+        if (m_headerEnd == 0)
+        {
+            // Stray CRLFs between pipelined requests are skipped rather than read as an empty head.
+            std::size_t start = 0;
+            while (input.substr(start, kCrlf.size()) == kCrlf)
+            {
+                start += kCrlf.size();
+            }
+
+            // Resume just before where the last call stopped, in case the terminator straddles reads.
+            std::size_t from = m_scanned > kHeadTerminator.size() - 1 ? m_scanned - (kHeadTerminator.size() - 1) : 0;
+            if (from < start)
+            {
+                from = start;
+            }
+            const std::size_t terminator = input.find(kHeadTerminator, from);
+            if (terminator == std::string_view::npos)
+            {
+                m_scanned = input.size();
+                return input.size() > m_maxHeaderBytes ? ParseStatus::HeaderTooLarge : ParseStatus::Incomplete;
+            }
+
+            const std::size_t headerEnd = terminator + kHeadTerminator.size();
+            if (headerEnd > m_maxHeaderBytes)
+            {
+                return ParseStatus::HeaderTooLarge;
+            }
+
+            request = HttpRequest();
+            if (!parseHead(input.substr(0, terminator), request))
+            {
+                return ParseStatus::Invalid;
+            }
+            if (request.contentLength > m_maxBodyBytes)
+            {
+                return ParseStatus::BodyTooLarge;
+            }
+
+            if (input.size() - headerEnd >= request.contentLength)
+            {
+                request.body = input.substr(headerEnd, request.contentLength);
+                request.length = headerEnd + request.contentLength;
+                reset();
+                return ParseStatus::Complete;
+            }
+
+            m_headerEnd = headerEnd;
+            m_contentLength = request.contentLength;
+            return ParseStatus::Incomplete;
+        }
+
+        // Only the body was missing. The buffer may have moved since the head was
+        // parsed, so the views are rebuilt once the body is complete.
+        if (input.size() - m_headerEnd < m_contentLength)
+        {
+            return ParseStatus::Incomplete;
+        }
+
+        request = HttpRequest();
+        parseHead(input.substr(0, m_headerEnd - kHeadTerminator.size()), request);
+        request.body = input.substr(m_headerEnd, m_contentLength);
+        request.length = m_headerEnd + m_contentLength;
+        reset();
+        return ParseStatus::Complete;
+    }
+
+    bool HttpRequestParser::parseHead(std::string_view head, HttpRequest &request)
+    {
+        while (head.substr(0, kCrlf.size()) == kCrlf)
+        {
+            head.remove_prefix(kCrlf.size());
+        }
+
+        std::size_t lineEnd = head.find(kCrlf);
+        std::string_view requestLine = head.substr(0, lineEnd);
+        head = lineEnd == std::string_view::npos ? std::string_view() : head.substr(lineEnd + kCrlf.size());
+
+        const std::size_t methodEnd = requestLine.find(' ');
+        if (methodEnd == std::string_view::npos || methodEnd == 0)
+        {
+            return false;
+        }
+        const std::size_t targetEnd = requestLine.find(' ', methodEnd + 1);
+        if (targetEnd == std::string_view::npos || targetEnd == methodEnd + 1)
+        {
+            return false;
+        }
+
+        request.method = requestLine.substr(0, methodEnd);
+        request.target = requestLine.substr(methodEnd + 1, targetEnd - methodEnd - 1);
+        request.version = requestLine.substr(targetEnd + 1);
+        if (request.version != "HTTP/1.1" && request.version != "HTTP/1.0")
+        {
+            return false;
+        }
+
+        const std::size_t queryPos = request.target.find('?');
+        request.path = request.target.substr(0, queryPos);
+        if (queryPos != std::string_view::npos)
+        {
+            request.query = request.target.substr(queryPos + 1);
+        }
+
+        bool hasContentLength = false;
+        while (!head.empty())
+        {
+            lineEnd = head.find(kCrlf);
+            std::string_view line = head.substr(0, lineEnd);
+            head = lineEnd == std::string_view::npos ? std::string_view() : head.substr(lineEnd + kCrlf.size());
+
+            const std::size_t colon = line.find(':');
+            if (colon == std::string_view::npos || colon == 0)
+            {
+                return false;
+            }
+
+            const std::string_view name = line.substr(0, colon);
+            const std::string_view value = trim(line.substr(colon + 1));
+
+            if (equalsIgnoreCase(name, "Host"))
+            {
+                request.host = value;
+            }
+            else if (equalsIgnoreCase(name, "Accept-Encoding"))
+            {
+                request.acceptEncoding = value;
+            }
+            else if (equalsIgnoreCase(name, "If-None-Match"))
+            {
+                request.ifNoneMatch = value;
+            }
+            else if (equalsIgnoreCase(name, "Connection"))
+            {
+                request.connection = value;
+            }
+            else if (equalsIgnoreCase(name, "Content-Length"))
+            {
+                std::size_t length = 0;
+                const char *end = value.data() + value.size();
+                auto result = std::from_chars(value.data(), end, length);
+                if (value.empty() || result.ec != std::errc() || result.ptr != end ||
+                    (hasContentLength && length != request.contentLength))
+                {
+                    return false;
+                }
+                request.contentLength = length;
+                hasContentLength = true;
+            }
+            else if (equalsIgnoreCase(name, "Transfer-Encoding"))
+            {
+                return false; // chunked request bodies are not accepted
+            }
+        }
+
+        // HTTP/1.1 connections persist unless the client sends "Connection: close";
+        // HTTP/1.0 ones only when it asks for "Connection: keep-alive".
+        if (request.version == "HTTP/1.1")
+        {
+            request.keepAlive = !containsToken(request.connection, "close");
+        }
+        else
+        {
+            request.keepAlive = containsToken(request.connection, "keep-alive");
+        }
+
+        return true;
+    }
+
+    void urlDecode(std::string_view value, std::string &output)
+    {
+        output.clear();
+        output.reserve(value.size());
+
+        for (std::size_t i = 0; i < value.size(); ++i)
+        {
+            char ch = value[i];
+            if (ch == '+')
+            {
+                output.push_back(' ');
+                continue;
+            }
+
+            if (ch == '%' && i + 2 < value.size())
+            {
+                const int high = hexValue(value[i + 1]);
+                const int low = hexValue(value[i + 2]);
+                if (high >= 0 && low >= 0)
+                {
+                    output.push_back(static_cast<char>((high << 4) | low));
+                    i += 2;
+                    continue;
+                }
+            }
+
+            output.push_back(ch);
+        }
+    }
+
+    bool findQueryParam(std::string_view query, std::string_view key, std::string &output)
+    {
+        std::string_view match;
+        bool found = false;
+        std::string decodedKey;
+
+        while (!query.empty())
+        {
+            const std::size_t end = query.find('&');
+            const std::string_view pair = query.substr(0, end);
+            query = end == std::string_view::npos ? std::string_view() : query.substr(end + 1);
+
+            const std::size_t separator = pair.find('=');
+            const std::string_view rawKey = pair.substr(0, separator);
+            const std::string_view rawValue = separator == std::string_view::npos ? std::string_view() : pair.substr(separator + 1);
+
+            bool keyMatches = rawKey == key;
+            if (!keyMatches && needsDecoding(rawKey))
+            {
+                urlDecode(rawKey, decodedKey);
+                keyMatches = decodedKey == key;
+            }
+
+            if (keyMatches)
+            {
+                match = rawValue;
+                found = true;
+            }
+        }
+
+        if (found)
+        {
+            urlDecode(match, output);
+        }
+        return found;
+    }
+
+    bool equalsIgnoreCase(std::string_view lhs, std::string_view rhs)
+    {
+        if (lhs.size() != rhs.size())
+        {
+            return false;
+        }
+        for (std::size_t i = 0; i < lhs.size(); ++i)
+        {
+            if (asciiLower(lhs[i]) != asciiLower(rhs[i]))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool containsToken(std::string_view value, std::string_view token)
+    {
+        while (!value.empty())
+        {
+            const std::size_t comma = value.find(',');
+            if (equalsIgnoreCase(trim(value.substr(0, comma)), token))
+            {
+                return true;
+            }
+            value = comma == std::string_view::npos ? std::string_view() : value.substr(comma + 1);
+        }
+        return false;
+    }
+
+    bool etagMatches(std::string_view ifNoneMatch, std::string_view etag)
+    {
+        if (etag.size() > 2 && etag.substr(0, 2) == "W/")
+        {
+            etag.remove_prefix(2);
+        }
+
+        while (!ifNoneMatch.empty())
+        {
+            const std::size_t comma = ifNoneMatch.find(',');
+            std::string_view candidate = trim(ifNoneMatch.substr(0, comma));
+            if (candidate.size() > 2 && candidate.substr(0, 2) == "W/")
+            {
+                candidate.remove_prefix(2);
+            }
+            if (candidate == "*" || candidate == etag)
+            {
+                return true;
+            }
+            ifNoneMatch = comma == std::string_view::npos ? std::string_view() : ifNoneMatch.substr(comma + 1);
+        }
+        return false;
+    }
+} // namespace https
@@ -0,0 +1,80 @@
+#ifndef INCLUDED_HTTP_REQUEST
+#define INCLUDED_HTTP_REQUEST
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace https
+{
+    // A parsed request. Every view points into the connection's read buffer and
+    // is only valid until that buffer is next modified.
+    struct HttpRequest
+    {
+        std::string_view method;
+        std::string_view target;
+        std::string_view path;
+        std::string_view query;
+        std::string_view version;
+
+        std::string_view host;
+        std::string_view acceptEncoding;
+        std::string_view ifNoneMatch;
+        std::string_view connection;
+
+        std::string_view body;
+        std::size_t contentLength = 0;
+        bool keepAlive = false;
+
+        // Bytes of the input buffer this request occupies, head and body.
+        std::size_t length = 0;
+    };
+
+    enum class ParseStatus
+    {
+        Incomplete,
+        Complete,
+        Invalid,
+        HeaderTooLarge,
+        BodyTooLarge
+    };
+
+    // Resumable request parser. Call parse() with everything buffered so far
+    // each time more bytes arrive; it remembers how far it has scanned so a
+    // request split across many reads is not rescanned from the start.
+    class HttpRequestParser
+    {
+        public:
+            HttpRequestParser(std::size_t maxHeaderBytes, std::size_t maxBodyBytes);
+
+            ParseStatus parse(std::string_view input, HttpRequest &request);
+            void reset();
+
+        private:
+            std::size_t m_maxHeaderBytes;
+            std::size_t m_maxBodyBytes;
+            std::size_t m_scanned;   // bytes already searched for the end of the head
+            std::size_t m_headerEnd; // non-zero once the head is complete and only the body is missing
+            std::size_t m_contentLength;
+
+            static bool parseHead(std::string_view head, HttpRequest &request);
+    };
+
+    // Decodes an application/x-www-form-urlencoded value into output, reusing its capacity.
+    void urlDecode(std::string_view value, std::string &output);
+
+    // Looks up the query parameter named key (the last one wins when repeated)
+    // and decodes its value into output. Returns false when it is absent.
+    bool findQueryParam(std::string_view query, std::string_view key, std::string &output);
+
+    bool equalsIgnoreCase(std::string_view lhs, std::string_view rhs);
+
+    // True when a comma-separated header value such as "keep-alive, Upgrade" lists token.
+    bool containsToken(std::string_view value, std::string_view token);
+
+    // True when an If-None-Match value ("*" or a list of entity tags) matches
+    // etag. Uses the weak comparison RFC 9110 prescribes for If-None-Match.
+    bool etagMatches(std::string_view ifNoneMatch, std::string_view etag);
+} // namespace https
+
+#endif
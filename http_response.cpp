@@ -0,0 +1,82 @@
+#include "http_response.h"
+#include "json_writer.h"
+
+#include <cstdint>
+
+namespace https
+{
+    std::string_view responseHeadPrefix(int statusCode)
+    {
+#define HEAD_PREFIX(status) "HTTP/1.1 " status "\r\nContent-Type: application/json\r\nContent-Length: "
+        switch (statusCode)
+        {
+        case 200:
+            return HEAD_PREFIX("200 OK");
+        case 400:
+            return HEAD_PREFIX("400 Bad Request");
+        case 404:
+            return HEAD_PREFIX("404 Not Found");
+        case 405:
+            return HEAD_PREFIX("405 Method Not Allowed");
+        case 413:
+            return HEAD_PREFIX("413 Payload Too Large");
+        case 431:
+            return HEAD_PREFIX("431 Request Header Fields Too Large");
+        case 502:
+            return HEAD_PREFIX("502 Bad Gateway");
+        case 503:
+            return HEAD_PREFIX("503 Service Unavailable");
+        case 504:
+            return HEAD_PREFIX("504 Gateway Timeout");
+        default:
+            return HEAD_PREFIX("500 Internal Server Error");
+        }
+#undef HEAD_PREFIX
+    }
+
+    std::string_view connectionHeader(bool keepAlive)
+    {
+        return keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+    }
+
+    std::string_view encodingHeaders(ContentEncoding encoding)
+    {
+        switch (encoding)
+        {
+        case ContentEncoding::Gzip:
+            return "Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n";
+        case ContentEncoding::Zstd:
+            return "Content-Encoding: zstd\r\nVary: Accept-Encoding\r\n";
+        default:
+            return {};
+        }
+    }
+
+    void appendFramed(std::string &out, std::string_view prefix, std::string_view body, bool keepAlive, std::string_view headers)
+    {
+        const std::string_view connection = connectionHeader(keepAlive);
+
+        const std::size_t start = out.size();
+        out.resize(start + prefix.size() + osrs::kMaxIntChars + 2 + headers.size() + connection.size() + body.size());
+        char *p = &out[start];
+        p = osrs::writeRaw(p, prefix);
+        p = osrs::writeInt(p, static_cast<std::int64_t>(body.size()));
+        p = osrs::writeRaw(p, "\r\n");
+        p = osrs::writeRaw(p, headers);
+        p = osrs::writeRaw(p, connection);
+        p = osrs::writeRaw(p, body);
+        out.resize(static_cast<std::size_t>(p - out.data()));
+    }
+
+    void appendResponse(std::string &out, int statusCode, std::string_view body, bool keepAlive, std::string_view headers)
+    {
+        appendFramed(out, responseHeadPrefix(statusCode), body, keepAlive, headers);
+    }
+
+    void appendNotModified(std::string &out, bool keepAlive, std::string_view headers)
+    {
+        out += "HTTP/1.1 304 Not Modified\r\n";
+        out += headers;
+        out += connectionHeader(keepAlive);
+    }
+} // namespace https
@@ -0,0 +1,30 @@
+#ifndef INCLUDED_HTTP_RESPONSE
+#define INCLUDED_HTTP_RESPONSE
+
+#include <string>
+#include <string_view>
+
+#include "compression.h"
+
+namespace https
+{
+    // Status line plus the fixed headers every JSON response carries, up to the Content-Length value.
+    std::string_view responseHeadPrefix(int statusCode);
+
+    std::string_view connectionHeader(bool keepAlive);
+
+    // Extra headers announcing a compressed body, or none for identity.
+    std::string_view encodingHeaders(ContentEncoding encoding);
+
+    // Appends a complete response: prefix is a head up to the Content-Length
+    // value, and headers holds any extra header lines, each ending in CRLF.
+    // Sized once up front, so a reused out does not allocate.
+    void appendFramed(std::string &out, std::string_view prefix, std::string_view body, bool keepAlive, std::string_view headers);
+
+    // A JSON response with statusCode.
+    void appendResponse(std::string &out, int statusCode, std::string_view body, bool keepAlive, std::string_view headers = {});
+
+    void appendNotModified(std::string &out, bool keepAlive, std::string_view headers);
+} // namespace https
+
+#endif
@@ -1,79 +1,209 @@
 #include "https_client.h"
+#include "http_request.h"
+#include "logger.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
 #include <cstring>
+#include <string_view>
+#include <vector>
 #include <unistd.h>
 #include <netdb.h>
+#include <poll.h>
+
+namespace {
+    const std::size_t kMaxHeaderBytes = 16384;
+    const std::size_t kMaxBodyBytes = 1 << 20;
+    // A whole TLS record fits in one SSL_read.
+    const std::size_t kReadBytes = 16384;
+    // RFC 8305 happy eyeballs: the next address is tried if the last has not connected within this.
+    const int kConnectAttemptDelayMs = 250;
+    const int kConnectTimeoutMs = 5000;
+
+    using Clock = std::chrono::steady_clock;
+
+    // Milliseconds left until deadline, for poll(); -1 (wait forever) if there is no deadline.
+    int pollTimeout(Clock::time_point deadline) {
+        if (deadline == Clock::time_point::max()) return -1;
+        const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+        return static_cast<int>(std::max<long long>(left, 0));
+    }
+
+    std::chrono::microseconds since(Clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start);
+    }
+
+    // Connects to the first candidate that answers, starting a new attempt every
+    // kConnectAttemptDelayMs (or as soon as one fails) while earlier ones are still
+    // pending. Returns the connected, non-blocking socket, or -1; timedOut tells
+    // whether it was the deadline that ended the attempts.
+    int connectFirst(const std::vector<https::ResolvedAddress>& candidates, Clock::time_point deadline, bool& timedOut) {
+        const Clock::time_point limit = std::min(deadline, Clock::now() + std::chrono::milliseconds(kConnectTimeoutMs));
+        std::vector<pollfd> attempts;
+        std::size_t next = 0;
+        Clock::time_point nextStart = Clock::now();
+        int connected = -1;
+
+        while (connected < 0) {
+            const Clock::time_point now = Clock::now();
+            if (now >= limit) break;
+
+            if (next < candidates.size() && (attempts.empty() || now >= nextStart)) {
+                const https::ResolvedAddress& candidate = candidates[next++];
+                const int fd = socket(candidate.family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+                if (fd < 0) continue;
+                if (connect(fd, reinterpret_cast<const sockaddr*>(&candidate.address), candidate.length) == 0) {
+                    connected = fd;
+                    break;
+                }
+                if (errno != EINPROGRESS) {
+                    close(fd);
+                    continue;
+                }
+                attempts.push_back(pollfd{fd, POLLOUT, 0});
+                nextStart = now + std::chrono::milliseconds(kConnectAttemptDelayMs);
+            }
+            if (attempts.empty()) {
+                if (next >= candidates.size()) break;
+                continue;
+            }
+
+            Clock::time_point wakeAt = limit;
+            if (next < candidates.size()) wakeAt = std::min(wakeAt, nextStart);
+            if (poll(attempts.data(), attempts.size(), pollTimeout(wakeAt)) < 0 && errno != EINTR) break;
+
+            for (std::size_t i = 0; i < attempts.size();) {
+                if (attempts[i].revents == 0) {
+                    ++i;
+                    continue;
+                }
+                int error = 0;
+                socklen_t length = sizeof(error);
+                if (getsockopt(attempts[i].fd, SOL_SOCKET, SO_ERROR, &error, &length) == 0 && error == 0) {
+                    connected = attempts[i].fd;
+                    attempts.erase(attempts.begin() + i);
+                    break;
+                }
+                // This one failed: no reason to keep waiting before trying the next.
+                close(attempts[i].fd);
+                attempts.erase(attempts.begin() + i);
+                nextStart = Clock::now();
+            }
+        }
+
+        for (const pollfd& attempt : attempts) close(attempt.fd);
+        // Running out of addresses, or hitting kConnectTimeoutMs first, is a plain failure.
+        timedOut = connected < 0 && Clock::now() >= deadline;
+        return connected;
+    }
+
+    // Index of the CRLF ending the line that starts at pos, or npos if it has not arrived yet.
+    std::size_t findLineEnd(const std::string& buffer, std::size_t pos) {
+        return buffer.find("\r\n", pos);
+    }
+}
 
 namespace https {
-    HttpsClient::HttpsClient(const std::string& hostname, int port, const std::string& caCertPath)
-        : m_hostname(hostname), m_port(port), m_socket(-1), m_caCertPath(caCertPath), m_ctx(nullptr), m_ssl(nullptr) {}
+    HttpsClient::HttpsClient(const std::string& hostname, int port, const std::string& caCertPath,
+                             std::shared_ptr<DnsCache> dns)
+        : m_hostname(hostname), m_port(port), m_socket(-1), m_caCertPath(caCertPath), m_dns(std::move(dns)), m_ssl(nullptr),
+          m_deadline(Clock::time_point::max()) {}
 
     HttpsClient::~HttpsClient() {
         cleanupSSL();
     }
 
-    bool HttpsClient::initSSL() {
-        SSL_library_init();
-        SSL_load_error_strings();
-        OpenSSL_add_all_algorithms();
-
-        const SSL_METHOD* method = TLS_client_method();
-        m_ctx = SSL_CTX_new(method);
-        if (!m_ctx) return false;
+    void HttpsClient::setDeadline(std::chrono::steady_clock::time_point deadline) {
+        m_deadline = deadline;
+        m_timings = UpstreamTimings();
+    }
 
-        if (SSL_CTX_load_verify_locations(m_ctx, m_caCertPath.c_str(), nullptr) != 1) {
-            std::cerr << "Failed to load CA certificate from " << m_caCertPath << std::endl;
+    bool HttpsClient::waitForSsl(int result, UpstreamStage stage) {
+        pollfd pfd{m_socket, 0, 0};
+        switch (SSL_get_error(m_ssl, result)) {
+        case SSL_ERROR_WANT_READ:
+            pfd.events = POLLIN;
+            break;
+        case SSL_ERROR_WANT_WRITE:
+            pfd.events = POLLOUT;
+            break;
+        default:
             return false;
         }
 
-        SSL_CTX_set_verify(m_ctx, SSL_VERIFY_PEER, nullptr);
-        return true;
+        int ready;
+        while ((ready = poll(&pfd, 1, pollTimeout(m_deadline))) < 0 && errno == EINTR) {
+        }
+        if (ready == 0) m_timings.timedOut = stage;
+        return ready > 0;
+    }
+
+    bool HttpsClient::initSSL() {
+        // The context (and its parsed CA bundle) is shared process-wide.
+        if (!m_tls) m_tls = ClientTlsContext::forCaBundle(m_caCertPath);
+        return m_tls != nullptr;
     }
 
     bool HttpsClient::connectToServer() {
         if (!initSSL()) return false;
 
-        m_socket = socket(AF_INET, SOCK_STREAM, 0);
-        if (m_socket < 0) return false;
-
-        struct hostent* host = gethostbyname(m_hostname.c_str());
-        if (!host) return false;
-
-        sockaddr_in server_addr;
-        std::memset(&server_addr, 0, sizeof(server_addr));
-        server_addr.sin_family = AF_INET;
-        server_addr.sin_port = htons(m_port);
-        std::memcpy(&server_addr.sin_addr.s_addr, host->h_addr, host->h_length);
+        Clock::time_point start = Clock::now();
+        std::vector<ResolvedAddress> candidates;
+        if (m_dns) {
+            candidates = m_dns->candidates(m_hostname, m_port, m_deadline);
+        } else {
+            DnsAnswer answer;
+            if (systemResolve(m_hostname, m_port, answer)) candidates = std::move(answer.addresses);
+        }
+        m_timings[UpstreamStage::Dns] = since(start);
+        if (candidates.empty()) {
+            if (Clock::now() >= m_deadline) m_timings.timedOut = UpstreamStage::Dns;
+            return false;
+        }
 
-        if (connect(m_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) != 0) {
-            close(m_socket);
+        start = Clock::now();
+        bool timedOut = false;
+        m_socket = connectFirst(candidates, m_deadline, timedOut);
+        m_timings[UpstreamStage::Connect] = since(start);
+        if (m_socket < 0) {
+            if (timedOut) m_timings.timedOut = UpstreamStage::Connect;
             return false;
         }
 
-        m_ssl = SSL_new(m_ctx);
+        // Comes back with SNI set and a cached session to resume, if there is one.
+        m_ssl = m_tls->newSsl(m_hostname);
         if (!m_ssl) {
-            std::cerr << "Failed to allocate SSL structure" << std::endl;
+            logEvent(LogLevel::Error, "upstream_ssl_alloc_failed", m_hostname);
             return false;
         }
 
         if (SSL_set_fd(m_ssl, m_socket) != 1) {
-            std::cerr << "Failed to attach socket to SSL context" << std::endl;
+            logEvent(LogLevel::Error, "upstream_ssl_attach_failed", m_hostname);
             return false;
         }
 
-        if (SSL_set_tlsext_host_name(m_ssl, m_hostname.c_str()) != 1) {
-            std::cerr << "Failed to set SNI host name" << std::endl;
-            return false;
-        }
-
-        if (SSL_connect(m_ssl) <= 0) {
-            ERR_print_errors_fp(stderr);
-            return false;
+        start = Clock::now();
+        int result;
+        while ((result = SSL_connect(m_ssl)) <= 0) {
+            if (!waitForSsl(result, UpstreamStage::Handshake)) {
+                m_timings[UpstreamStage::Handshake] = since(start);
+                if (m_timings.timedOut == UpstreamStage::None) {
+                    char reason[256] = "";
+                    ERR_error_string_n(ERR_peek_last_error(), reason, sizeof(reason));
+                    logEvent(LogLevel::Warn, "upstream_handshake_failed", reason);
+                }
+                return false;
+            }
         }
+        m_timings[UpstreamStage::Handshake] = since(start);
+        m_tls->recordHandshake(m_ssl);
 
         // Certificate verification
         if (SSL_get_verify_result(m_ssl) != X509_V_OK) {
-            std::cerr << "Certificate verification failed" << std::endl;
+            logEvent(LogLevel::Error, "upstream_certificate_rejected",
+                     X509_verify_cert_error_string(SSL_get_verify_result(m_ssl)));
             return false;
         }
 
@@ -81,20 +211,191 @@ namespace https {
     }
     bool HttpsClient::sendRequest(const std::string& request) {
         if (!m_ssl) return false;
-        return SSL_write(m_ssl, request.c_str(), request.length()) > 0;
+        const Clock::time_point start = Clock::now();
+        int result;
+        // Without partial writes, a retried SSL_write must repeat the same arguments.
+        while ((result = SSL_write(m_ssl, request.c_str(), request.length())) <= 0) {
+            if (!waitForSsl(result, UpstreamStage::Write)) break;
+        }
+        m_timings[UpstreamStage::Write] += since(start);
+        return result > 0;
     }
 
-    std::string HttpsClient::receiveResponse() {
-        if (!m_ssl) return "";
-
-        std::string response;
-        char buffer[4096];
+    bool HttpsClient::readMore() {
+        char chunk[kReadBytes];
         int bytes;
-        while ((bytes = SSL_read(m_ssl, buffer, sizeof(buffer) - 1)) > 0) {
-            buffer[bytes] = 0;
-            response += buffer;
+        // Nothing received yet means the server is still thinking; after that it is sending the body.
+        const UpstreamStage stage = m_firstByteAt == Clock::time_point() ? UpstreamStage::Ttfb : UpstreamStage::Body;
+        while ((bytes = SSL_read(m_ssl, chunk, sizeof(chunk))) <= 0) {
+            if (!waitForSsl(bytes, stage)) return false;
+        }
+        if (m_firstByteAt == Clock::time_point()) m_firstByteAt = Clock::now();
+        m_buffer.append(chunk, bytes);
+        return true;
+    }
+
+    bool HttpsClient::receiveResponse(HttpResponse& response) {
+        return receiveResponse(response, [&response](std::string_view chunk) {
+            response.body.append(chunk);
+            return true;
+        });
+    }
+
+    bool HttpsClient::receiveResponse(HttpResponse& response, const BodySink& onBody) {
+        response = HttpResponse();
+        m_buffer.clear();
+        if (!m_ssl) return false;
+
+        // Split at the first byte received: Ttfb is the server's think time, Body the transfer.
+        m_firstByteAt = Clock::time_point();
+        struct ReadTimer {
+            UpstreamTimings& timings;
+            const Clock::time_point& firstByteAt;
+            Clock::time_point start;
+            ~ReadTimer() {
+                const Clock::time_point end = Clock::now();
+                const Clock::time_point split = firstByteAt < start ? end : firstByteAt;
+                timings[UpstreamStage::Ttfb] += std::chrono::duration_cast<std::chrono::microseconds>(split - start);
+                timings[UpstreamStage::Body] += std::chrono::duration_cast<std::chrono::microseconds>(end - split);
+            }
+        } timer{m_timings, m_firstByteAt, Clock::now()};
+
+        std::size_t headerEnd;
+        while ((headerEnd = m_buffer.find("\r\n\r\n")) == std::string::npos) {
+            if (m_buffer.size() > kMaxHeaderBytes || !readMore()) return false;
+        }
+
+        std::string_view head(m_buffer.data(), headerEnd);
+        std::size_t lineEnd = head.find("\r\n");
+        std::string_view statusLine = head.substr(0, lineEnd);
+        head = lineEnd == std::string_view::npos ? std::string_view() : head.substr(lineEnd + 2);
+
+        // "HTTP/1.1 200 OK"
+        const std::size_t codeStart = statusLine.find(' ');
+        if (codeStart == std::string_view::npos || statusLine.substr(0, 5) != "HTTP/") return false;
+        const char* codeEnd = statusLine.data() + statusLine.size();
+        if (std::from_chars(statusLine.data() + codeStart + 1, codeEnd, response.statusCode).ec != std::errc()) return false;
+
+        response.keepAlive = statusLine.substr(0, codeStart) == "HTTP/1.1";
+        bool chunked = false;
+        bool hasLength = false;
+        std::size_t contentLength = 0;
+
+        while (!head.empty()) {
+            lineEnd = head.find("\r\n");
+            std::string_view line = head.substr(0, lineEnd);
+            head = lineEnd == std::string_view::npos ? std::string_view() : head.substr(lineEnd + 2);
+
+            const std::size_t colon = line.find(':');
+            if (colon == std::string_view::npos) continue;
+            std::string_view name = line.substr(0, colon);
+            std::string_view value = line.substr(colon + 1);
+            while (!value.empty() && value.front() == ' ') value.remove_prefix(1);
+
+            if (equalsIgnoreCase(name, "Content-Length")) {
+                while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) value.remove_suffix(1);
+                // Digits only: "12abc" would otherwise frame the body as 12 bytes.
+                const char* valueEnd = value.data() + value.size();
+                const std::from_chars_result parsed = std::from_chars(value.data(), valueEnd, contentLength);
+                if (parsed.ec != std::errc() || parsed.ptr != valueEnd) return false;
+                hasLength = true;
+            } else if (equalsIgnoreCase(name, "Transfer-Encoding")) {
+                chunked = containsToken(value, "chunked");
+            } else if (equalsIgnoreCase(name, "Connection")) {
+                if (containsToken(value, "close")) response.keepAlive = false;
+                if (containsToken(value, "keep-alive")) response.keepAlive = true;
+            }
+        }
+
+        std::size_t pos = headerEnd + 4;
+        const bool noBody = response.statusCode == 204 || response.statusCode == 304 ||
+                            (response.statusCode >= 100 && response.statusCode < 200);
+
+        // The buffer only holds what has not been handled yet: handled bytes are
+        // dropped before reading more, so it stays around one TLS record.
+        auto fill = [this, &pos]() {
+            m_buffer.erase(0, pos);
+            pos = 0;
+            return readMore();
+        };
+        // Body bytes go to onBody as they arrive, until it has seen enough; the
+        // rest is still read, so the connection can be reused, but not handed on.
+        bool wanted = true;
+        std::size_t bodyBytes = 0;
+        auto deliver = [&](std::size_t length) {
+            bodyBytes += length;
+            if (wanted && length > 0) wanted = onBody(std::string_view(m_buffer.data() + pos, length));
+            pos += length;
+            return bodyBytes <= kMaxBodyBytes;
+        };
+        auto deliverExactly = [&](std::size_t length) {
+            while (length > 0) {
+                if (pos == m_buffer.size() && !fill()) return false;
+                const std::size_t available = std::min(length, m_buffer.size() - pos);
+                if (!deliver(available)) return false;
+                length -= available;
+            }
+            return true;
+        };
+
+        if (noBody) {
+            // nothing follows the head
+        } else if (chunked) {
+            while (true) {
+                while ((lineEnd = findLineEnd(m_buffer, pos)) == std::string::npos) {
+                    if (!fill()) return false;
+                }
+
+                std::size_t chunkSize = 0;
+                if (std::from_chars(m_buffer.data() + pos, m_buffer.data() + lineEnd, chunkSize, 16).ec != std::errc()) return false;
+                pos = lineEnd + 2;
+
+                if (chunkSize == 0) {
+                    // Skip any trailers up to the blank line that ends the message.
+                    while (true) {
+                        while ((lineEnd = findLineEnd(m_buffer, pos)) == std::string::npos) {
+                            if (!fill()) return false;
+                        }
+                        const bool last = lineEnd == pos;
+                        pos = lineEnd + 2;
+                        if (last) break;
+                    }
+                    break;
+                }
+
+                if (chunkSize > kMaxBodyBytes || !deliverExactly(chunkSize)) return false;
+                while (m_buffer.size() - pos < 2) {
+                    if (!fill()) return false;
+                }
+                if (m_buffer.compare(pos, 2, "\r\n") != 0) return false;
+                pos += 2;
+            }
+        } else if (hasLength) {
+            if (contentLength > kMaxBodyBytes || !deliverExactly(contentLength)) return false;
+        } else {
+            // No framing: the body runs until the server closes the connection.
+            response.keepAlive = false;
+            do {
+                if (!deliver(m_buffer.size() - pos)) return false;
+            } while (fill());
+            // Only the close ends the body; a deadline that ran out first left it cut short.
+            if (m_timings.timedOut != UpstreamStage::None) return false;
         }
-        return response;
+
+        // Bytes beyond the response mean we lost track of the framing; don't reuse the connection.
+        if (pos != m_buffer.size()) response.keepAlive = false;
+        m_buffer.clear();
+        return true;
+    }
+
+    bool HttpsClient::isReusable() const {
+        if (!m_ssl || m_socket == -1) return false;
+        if (SSL_pending(m_ssl) > 0) return false;
+
+        // An idle keep-alive connection has nothing to read. Readable means the
+        // server closed it (FIN or close_notify) or sent something unexpected.
+        pollfd pfd{m_socket, POLLIN, 0};
+        return poll(&pfd, 1, 0) == 0;
     }
 
     void HttpsClient::cleanupSSL() {
@@ -107,10 +408,5 @@ namespace https {
             close(m_socket);
             m_socket = -1;
         }
-        if (m_ctx) {
-            SSL_CTX_free(m_ctx);
-            m_ctx = nullptr;
-        }
-        EVP_cleanup();
     }
 } // namespace https
@@ -1,35 +1,79 @@
 #ifndef HTTPS_CLIENT
 #define HTTPS_CLIENT
 
+#include <chrono>
+#include <functional>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <cstring>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <memory>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 
+#include "dns_cache.h"
+#include "tls_client_context.h"
+#include "upstream_timing.h"
+
 namespace https {
+    struct HttpResponse {
+        int statusCode = 0;
+        std::string body; // left empty by the streaming receiveResponse()
+        bool keepAlive = false; // the server will accept another request on this connection
+    };
+
+    // Receives a response body piece by piece; returns false once it needs no more.
+    using BodySink = std::function<bool(std::string_view chunk)>;
+
     class HttpsClient {
         public:
-            HttpsClient(const std::string& hostname, int port, const std::string& caCertPath);
+            // Addresses come from dns when given; otherwise each connect resolves the host itself.
+            HttpsClient(const std::string& hostname, int port, const std::string& caCertPath,
+                        std::shared_ptr<DnsCache> dns = nullptr);
             ~HttpsClient();
 
+            // Starts a new request: timings are cleared, and every call after this
+            // gives up once deadline passes, with timings().timedOut naming the stage.
+            void setDeadline(std::chrono::steady_clock::time_point deadline);
+            const UpstreamTimings& timings() const { return m_timings; }
+
             bool connectToServer();
             bool sendRequest(const std::string& request);
-            std::string receiveResponse();
+            // Reads exactly one response, framed by Content-Length or chunked
+            // encoding, so the connection can be reused afterwards.
+            bool receiveResponse(HttpResponse& response);
+            // Streaming form: the status and headers are in response before the
+            // first onBody call, and onBody gets the de-chunked body as it arrives,
+            // without it ever being assembled. Once onBody returns false the rest
+            // of the body is read and discarded, which keeps the connection usable.
+            bool receiveResponse(HttpResponse& response, const BodySink& onBody);
+            // True while the connection is open with nothing unread on it.
+            bool isReusable() const;
         private: 
             std::string m_hostname;
             int m_port;
             int m_socket;
             std::string m_caCertPath;
+            std::shared_ptr<DnsCache> m_dns;
 
-            SSL_CTX* m_ctx;
+            std::shared_ptr<ClientTlsContext> m_tls;
             SSL* m_ssl;
 
+            std::chrono::steady_clock::time_point m_deadline;
+            UpstreamTimings m_timings;
+            std::chrono::steady_clock::time_point m_firstByteAt; // of the response being received
+            std::string m_buffer; // unhandled bytes of the response being received; keeps its capacity
+
             bool initSSL();
-    void cleanupSSL();
+            void cleanupSSL();
+            // Appends one SSL_read to m_buffer.
+            bool readMore();
+            // After an SSL call returned result: waits until the socket is ready to retry it.
+            // False if the call failed outright or the deadline passed, charged to stage.
+            bool waitForSsl(int result, UpstreamStage stage);
     };
 } //namespace https
 
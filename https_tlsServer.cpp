@@ -1,327 +1,1685 @@
 #include "https_tlsServer.h"
+#include "compression.h"
+#include "http_request.h"
+#include "http_response.h"
+#include "logger.h"
+#include "metrics.h"
+#include "response_cache.h"
 
-#include <iostream>
-#include <map>
 #include <sstream>
+#include <cerrno>
 #include <cstdlib>
+#include <csignal>
+#include <cstring>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
 namespace {
-    const int BUFFER_SIZE = 30720;
+    const int READ_CHUNK_SIZE = 16384;
+    const int MAX_EVENTS = 256;
+    const int IDLE_SWEEP_INTERVAL_MS = 1000;
+    // How soon a worker tries accepting again after running out of descriptors or memory.
+    const int ACCEPT_RETRY_MS = 100;
 
-    void log(const std::string &message)
+    // epoll tokens below FIRST_CONNECTION_ID are reserved for a worker's own descriptors.
+    const std::uint64_t LISTENER_TOKEN = 0;
+    const std::uint64_t WAKEUP_TOKEN = 1;
+    const std::uint64_t FIRST_CONNECTION_ID = 2;
+
+    // Only for failures that leave nothing to serve with, such as startup errors.
+    [[noreturn]] void exitWithError(const std::string &errorMessage)
     {
-        std::cout << message << std::endl;
+        https::logEvent(https::LogLevel::Error, "fatal", errorMessage);
+        https::stopLogger();
+        exit(1);
     }
 
-    void exitWithError(const std::string &errorMessage)
+    // The most recent OpenSSL error as text, then clears the queue.
+    std::string takeSslError()
     {
-        log("ERROR: " + errorMessage);
-        exit(1);
+        char reason[256] = "";
+        if (unsigned long code = ERR_peek_last_error())
+        {
+            ERR_error_string_n(code, reason, sizeof(reason));
+        }
+        ERR_clear_error();
+        return reason;
     }
 
-    std::string urlDecode(const std::string &value)
+    // XXH64 with seed 0, written out so ETags depend on nothing but the body:
+    // std::hash may differ between standard libraries and builds, which would
+    // hand a client behind a balancer different validators for the same body.
+    std::uint64_t xxh64(std::string_view data)
     {
-        std::string output;
-        output.reserve(value.size());
+        constexpr std::uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+        constexpr std::uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+        constexpr std::uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+        constexpr std::uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+        constexpr std::uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+
+        auto rotl = [](std::uint64_t value, int bits) { return (value << bits) | (value >> (64 - bits)); };
+        auto read64 = [](const char *p) {
+            std::uint64_t value;
+            std::memcpy(&value, p, sizeof(value));
+            return value; // little-endian, like every target this server runs on
+        };
+        auto read32 = [](const char *p) {
+            std::uint32_t value;
+            std::memcpy(&value, p, sizeof(value));
+            return static_cast<std::uint64_t>(value);
+        };
+        auto round = [&](std::uint64_t acc, std::uint64_t input) { return rotl(acc + input * kPrime2, 31) * kPrime1; };
+        auto merge = [&](std::uint64_t acc, std::uint64_t lane) { return (acc ^ round(0, lane)) * kPrime1 + kPrime4; };
 
-        for (std::size_t i = 0; i < value.size(); ++i)
+        const char *p = data.data();
+        const char *const end = p + data.size();
+        std::uint64_t hash;
+        if (data.size() >= 32)
         {
-            char ch = value[i];
-            if (ch == '+')
+            std::uint64_t v1 = kPrime1 + kPrime2;
+            std::uint64_t v2 = kPrime2;
+            std::uint64_t v3 = 0;
+            std::uint64_t v4 = 0 - kPrime1;
+            for (; end - p >= 32; p += 32)
             {
-                output.push_back(' ');
+                v1 = round(v1, read64(p));
+                v2 = round(v2, read64(p + 8));
+                v3 = round(v3, read64(p + 16));
+                v4 = round(v4, read64(p + 24));
             }
-            else if (ch == '%' && i + 2 < value.size())
+            hash = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+            hash = merge(merge(merge(merge(hash, v1), v2), v3), v4);
+        }
+        else
+        {
+            hash = kPrime5;
+        }
+        hash += data.size();
+
+        for (; end - p >= 8; p += 8)
+        {
+            hash = rotl(hash ^ round(0, read64(p)), 27) * kPrime1 + kPrime4;
+        }
+        if (end - p >= 4)
+        {
+            hash = rotl(hash ^ (read32(p) * kPrime1), 23) * kPrime2 + kPrime3;
+            p += 4;
+        }
+        for (; p < end; ++p)
+        {
+            hash = rotl(hash ^ (static_cast<unsigned char>(*p) * kPrime5), 11) * kPrime1;
+        }
+
+        hash ^= hash >> 33;
+        hash *= kPrime2;
+        hash ^= hash >> 29;
+        hash *= kPrime3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+
+    const std::string_view METRICS_HEAD_PREFIX =
+        "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: ";
+
+    // Splits a comma-separated list of names, skipping empty entries.
+    void splitNames(const std::string &list, std::vector<std::string> &names)
+    {
+        std::size_t start = 0;
+        while (start <= list.size())
+        {
+            std::size_t comma = list.find(',', start);
+            if (comma == std::string::npos)
             {
-                std::string hex = value.substr(i + 1, 2);
-                char *end = nullptr;
-                int decoded = static_cast<int>(strtol(hex.c_str(), &end, 16));
-                if (end != nullptr && *end == '\0')
-                {
-                    output.push_back(static_cast<char>(decoded));
-                    i += 2;
-                }
-                else
-                {
-                    output.push_back(ch);
-                }
+                comma = list.size();
             }
-            else
+            if (comma > start)
             {
-                output.push_back(ch);
+                names.emplace_back(list, start, comma - start);
             }
+            start = comma + 1;
         }
-
-        return output;
     }
 
-    std::map<std::string, std::string> parseQuery(const std::string &queryString)
+    // Reads the names out of a JSON body of the form ["a","b"] or {"names":["a","b"]}.
+    bool parseJsonNames(std::string_view body, std::vector<std::string> &names)
     {
-        std::map<std::string, std::string> params;
-        std::size_t start = 0;
-        while (start < queryString.size())
+        std::size_t pos = body.find('[');
+        if (pos == std::string_view::npos)
         {
-            auto end = queryString.find('&', start);
-            if (end == std::string::npos)
+            return false;
+        }
+        ++pos;
+
+        auto skipSpace = [&body, &pos]() {
+            while (pos < body.size() && std::isspace(static_cast<unsigned char>(body[pos])))
             {
-                end = queryString.size();
+                ++pos;
             }
+        };
+
+        skipSpace();
+        if (pos < body.size() && body[pos] == ']')
+        {
+            return true;
+        }
 
-            auto separator = queryString.find('=', start);
-            std::string key;
-            std::string value;
-            if (separator != std::string::npos && separator < end)
+        while (pos < body.size())
+        {
+            if (body[pos] != '"')
             {
-                key = urlDecode(queryString.substr(start, separator - start));
-                value = urlDecode(queryString.substr(separator + 1, end - separator - 1));
+                return false;
             }
-            else
+            ++pos;
+
+            std::string name;
+            while (pos < body.size() && body[pos] != '"')
             {
-                key = urlDecode(queryString.substr(start, end - start));
+                char ch = body[pos++];
+                if (ch == '\\')
+                {
+                    if (pos >= body.size())
+                    {
+                        return false;
+                    }
+                    const char escaped = body[pos++];
+                    if (escaped == 'u')
+                    {
+                        // Display names are ASCII; anything wider is rejected rather than transcoded.
+                        unsigned int code = 0;
+                        auto result = std::from_chars(body.data() + pos, body.data() + std::min(pos + 4, body.size()), code, 16);
+                        if (result.ec != std::errc() || result.ptr != body.data() + pos + 4 || code > 0x7f)
+                        {
+                            return false;
+                        }
+                        pos += 4;
+                        ch = static_cast<char>(code);
+                    }
+                    else if (escaped == '"' || escaped == '\\' || escaped == '/')
+                    {
+                        ch = escaped;
+                    }
+                    else
+                    {
+                        return false;
+                    }
+                }
+                name.push_back(ch);
             }
-
-            if (!key.empty())
+            if (pos >= body.size())
             {
-                params[key] = value;
+                return false;
+            }
+            ++pos;
+            if (!name.empty())
+            {
+                names.push_back(std::move(name));
             }
 
-            start = end + 1;
+            skipSpace();
+            if (pos < body.size() && body[pos] == ']')
+            {
+                return true;
+            }
+            if (pos >= body.size() || body[pos] != ',')
+            {
+                return false;
+            }
+            ++pos;
+            skipSpace();
         }
-
-        return params;
+        return false;
     }
 
-    std::string reasonPhrase(int statusCode)
+    // Counters written only by their owning worker's thread, so a plain load and
+    // store is enough; scrapes on other workers read them through the atomic.
+    void increment(std::atomic<std::uint64_t> &counter)
     {
-        switch (statusCode)
-        {
-        case 200:
-            return "OK";
-        case 400:
-            return "Bad Request";
-        case 404:
-            return "Not Found";
-        case 405:
-            return "Method Not Allowed";
-        case 500:
-            return "Internal Server Error";
-        default:
-            return "";
-        }
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
     }
 
-    std::string buildHttpResponse(int statusCode, const std::string &body, const std::string &contentType)
+    bool parseUnixTime(const std::string &value, std::int64_t &time)
     {
-        std::ostringstream response;
-        response << "HTTP/1.1 " << statusCode << ' ' << reasonPhrase(statusCode) << "\r\n";
-        response << "Content-Type: " << contentType << "\r\n";
-        response << "Content-Length: " << body.size() << "\r\n";
-        response << "Connection: close\r\n\r\n";
-        response << body;
-        return response.str();
+        const char *end = value.data() + value.size();
+        auto result = std::from_chars(value.data(), end, time);
+        return result.ec == std::errc() && result.ptr == end;
     }
 }
 namespace https
 {
-    TcpServer::TcpServer(std::string ip_address, int port, std::string caCertPath) : m_ip_address(std::move(ip_address)),
-                                                                                    m_port(port),
-                                                                                    m_socket(),
-                                                                                    m_new_socket(),
-                                                                                    m_incomingMessage(),
-                                                                                    m_socketAddress(),
-                                                                                    m_socketAddress_len(sizeof(m_socketAddress)),
-                                                                                    m_ssl_ctx(nullptr),
-                                                                                    m_ssl(nullptr),
-                                                                                    m_caCertPath(std::move(caCertPath))
+    enum class ConnectionState
     {
-        SSL_library_init();
-        SSL_load_error_strings();
-        OpenSSL_add_all_algorithms();
+        Handshake,
+        Read,
+        Dispatch,
+        Write,
+        Shutdown
+    };
 
-        m_ssl_ctx = SSL_CTX_new(TLS_server_method());
-        if (!m_ssl_ctx)
+    // Per-connection state owned by a worker's event loop. Every transition
+    // happens on that worker's thread; upstream work refers back to a
+    // connection only by id.
+    struct Connection
+    {
+        Connection(std::size_t maxHeaderBytes, std::size_t maxBodyBytes) : parser(maxHeaderBytes, maxBodyBytes)
         {
-            exitWithError("Failed to create SSL context.");
         }
 
-        if (SSL_CTX_use_certificate_file(m_ssl_ctx, "server.crt", SSL_FILETYPE_PEM) <= 0 || SSL_CTX_use_PrivateKey_file(m_ssl_ctx, "server.key", SSL_FILETYPE_PEM) <= 0)
+        std::uint64_t id = 0;
+        int socket = -1;
+        SSL *ssl = nullptr;
+        ConnectionState state = ConnectionState::Handshake;
+        bool fatal = false; // the TLS session is unusable, skip close_notify
+        bool keepAlive = false; // keep the connection open after the current response
+        bool peerClosed = false; // the peer shut down its sending side (EPOLLRDHUP)
+        std::size_t requestsServed = 0;
+        int responseStatus = 0; // of the response being written
+        std::chrono::steady_clock::time_point lastActivity;
+        // When the connection was accepted, then when the current response was queued for writing.
+        std::chrono::steady_clock::time_point stageStart;
+        std::chrono::steady_clock::time_point requestStart; // the current request finished parsing
+        std::list<std::uint64_t>::iterator idlePosition; // entry in the worker's idle list
+        std::string readBuffer; // may hold several pipelined requests
+        std::size_t readOffset = 0; // start of the first unanswered request in readBuffer
+        HttpRequestParser parser;
+        std::string writeBuffer;
+        // When set, the response is written straight from these shared pre-rendered bytes instead of writeBuffer.
+        std::shared_ptr<const std::string> writeShared;
+        std::size_t writeOffset = 0;
+    };
+
+    // One event loop with its own SO_REUSEPORT listening socket. Workers share
+    // only the server's TLS context and upstream task pool, never connections.
+    class Worker
+    {
+        public:
+            Worker(TcpServer &server, std::size_t index);
+            ~Worker();
+
+            Worker(const Worker &) = delete;
+            Worker &operator=(const Worker &) = delete;
+
+            // Written only by this worker's loop; /metrics reads them from any worker.
+            struct Counters
+            {
+                std::atomic<std::uint64_t> accepted{0};
+                std::atomic<std::uint64_t> closed{0};
+                std::atomic<std::uint64_t> handshakeFailures{0};
+                std::atomic<std::uint64_t> requests{0};
+                // By status class: 1xx at index 0 through 5xx at index 4.
+                std::array<std::atomic<std::uint64_t>, 5> responses{};
+            };
+
+            void run();
+
+            const Counters &counters() const { return m_counters; }
+            ResponseCache::Stats responseCacheStats() const { return m_rendered.stats(); }
+
+        private:
+            // A response produced off the event loop, waiting to be handed
+            // back to the connection that asked for it.
+            struct Completion
+            {
+                std::uint64_t connectionId = 0;
+                int statusCode = 0;
+                std::string body;
+                // Coding body is already in, and its length before that.
+                ContentEncoding encoding = ContentEncoding::Identity;
+                std::size_t originalBytes = 0;
+                // Set instead of statusCode/body for player lookups: the fetched
+                // snapshot, which respondPlayer() has rendered off the loop, or that
+                // rendering, to keep in the response cache under playerKey.
+                std::shared_ptr<const osrs::PlayerSnapshot> player;
+                std::shared_ptr<const RenderedResponse> rendered;
+                std::string playerKey;
+                std::string ifNoneMatch;
+                ContentEncoding acceptedEncoding = ContentEncoding::Identity;
+            };
+
+            // A request for a cached player whose rendering is still on the pool.
+            struct RenderWaiter
+            {
+                std::uint64_t connectionId;
+                std::string ifNoneMatch;
+                ContentEncoding acceptedEncoding;
+            };
+
+            TcpServer &m_server;
+            std::size_t m_index;
+            int m_socket;
+            int m_epoll;
+            int m_wakeup;
+            // Held open so accepting can go on, to turn peers away, once descriptors run out.
+            int m_spareFd;
+            // The backlog was left undrained; an edge-triggered listener reports nothing
+            // more until a new connection arrives, so run() retries on a timer.
+            bool m_acceptPaused;
+
+            std::uint64_t m_nextConnectionId;
+            std::unordered_map<std::uint64_t, std::unique_ptr<Connection>> m_connections;
+            // Connection ids ordered from least to most recently active.
+            std::list<std::uint64_t> m_idle;
+            std::chrono::steady_clock::time_point m_lastSweep;
+
+            std::mutex m_completionMutex;
+            std::vector<Completion> m_completions;
+
+            // Decoded query values, reused across requests to avoid allocating per request.
+            std::string m_queryScratch;
+            ResponseCache m_rendered;
+            // Snapshots being rendered on the pool, with the requests waiting for them.
+            std::unordered_map<const osrs::PlayerSnapshot *, std::vector<RenderWaiter>> m_renderWaiters;
+            Counters m_counters;
+
+            void pinToCpu();
+            void acceptConnections();
+            // Out of descriptors: accepts each pending connection onto the spare
+            // one and closes it at once. False if the backlog could not be emptied.
+            bool shedBacklog();
+            void drainCompletions();
+            void touch(Connection &connection);
+            void closeIdleConnections();
+            void advance(Connection &connection);
+            bool doHandshake(Connection &connection);
+            bool doRead(Connection &connection);
+            bool dispatchBuffered(Connection &connection);
+            bool doWrite(Connection &connection);
+            void closeConnection(Connection &connection);
+            // Moves the connection to Write once its response is in place, counting it under statusCode.
+            void beginWrite(Connection &connection, int statusCode);
+            // body is already in encoding; originalBytes is its uncompressed length, for the byte counters.
+            void respond(Connection &connection, int statusCode, std::string_view body,
+                         ContentEncoding encoding = ContentEncoding::Identity, std::size_t originalBytes = 0);
+            // Answers with the rendered form of snapshot in the best coding the client
+            // accepts, or 304 if the client already has it. Unless this worker has it
+            // rendered already, the connection waits in Dispatch while the pool renders it.
+            void respondPlayer(Connection &connection, const std::string &key,
+                               const std::shared_ptr<const osrs::PlayerSnapshot> &snapshot, std::string_view ifNoneMatch,
+                               ContentEncoding encoding);
+            void respondRendered(Connection &connection, const std::shared_ptr<const RenderedResponse> &rendered,
+                                 std::string_view ifNoneMatch, ContentEncoding encoding);
+            // Keeps what the player cache keeps; failures are re-fetched anyway.
+            void cacheRendered(const std::string &key, const std::shared_ptr<const RenderedResponse> &rendered);
+            // Renders the server's metrics in Prometheus text format.
+            void respondMetrics(Connection &connection, ContentEncoding encoding);
+            // Compresses completion.body in place when it is large enough and the client takes encoding.
+            void compressCompletion(Completion &completion, ContentEncoding encoding) const;
+            // Serializes the snapshot and compresses every coding; called on pool threads, never the loop.
+            std::shared_ptr<const RenderedResponse> render(const std::shared_ptr<const osrs::PlayerSnapshot> &snapshot) const;
+            void postCompletion(Completion completion);
+            void handleRequest(Connection &connection, const HttpRequest &request);
+    };
+
+    TcpServer::TcpServer(std::string ip_address, int port, std::string caCertPath, ServerOptions options) : m_ip_address(std::move(ip_address)),
+                                                                                                          m_port(port),
+                                                                                                          m_socketAddress(),
+                                                                                                          m_options(options),
+                                                                                                          m_caCertPath(std::move(caCertPath))
+    {
+        // A peer that disconnects mid-write must surface as an SSL error, not kill the process.
+        signal(SIGPIPE, SIG_IGN);
+
+        m_tls = ServerTlsContext::create(m_options.tls);
+        if (!m_tls)
         {
-            exitWithError("Failed to load certificate or private key.");
+            exitWithError("Failed to set up TLS context (certificate, private key or cipher settings).");
         }
 
         m_socketAddress.sin_family = AF_INET;
         m_socketAddress.sin_port = htons(m_port);
         m_socketAddress.sin_addr.s_addr = inet_addr(m_ip_address.c_str());
 
-        if (startServer() != 0) 
+        if (m_options.workers == 0)
         {
-            std::ostringstream ss;
-            ss << "Failed to load start server with PORT: " << ntohs(m_socketAddress.sin_port);
-            log(ss.str());
+            m_options.workers = 1;
+        }
+
+        osrs::HiscoreClientOptions hiscoreOptions;
+        hiscoreOptions.host = m_options.upstreamHost;
+        hiscoreOptions.port = m_options.upstreamPort;
+        hiscoreOptions.pool.maxConnections = m_options.upstreamConnections;
+        hiscoreOptions.pool.dnsOptions = m_options.upstreamDns;
+        hiscoreOptions.deadlineBudget = std::chrono::milliseconds(m_options.upstreamDeadlineMs);
+        hiscoreOptions.guard = m_options.upstreamGuard;
+        // Permits beyond the pool's connections would only queue inside the pool.
+        hiscoreOptions.guard.maxLimit = m_options.upstreamConnections;
+        m_hiscore = std::make_unique<osrs::HiscoreClient>(m_caCertPath, hiscoreOptions);
+        m_playerCache = std::make_unique<osrs::PlayerCache>(m_options.playerCache);
+        m_upstream = std::make_unique<TaskPool>(m_options.upstreamThreads);
+        if (!m_options.history.path.empty())
+        {
+            m_history = osrs::HistoryStore::open(m_options.history);
+            if (!m_history)
+            {
+                exitWithError("Failed to open player history store");
+            }
+        }
+        m_players = std::make_unique<osrs::PlayerService>(*m_hiscore, *m_playerCache, *m_upstream, m_history.get());
+        if (m_options.watchlist.enabled())
+        {
+            m_watchlist = std::make_unique<osrs::Watchlist>(*m_players, *m_playerCache, m_options.watchlist);
+        }
+
+        m_workers.reserve(m_options.workers);
+        for (std::size_t i = 0; i < m_options.workers; ++i)
+        {
+            m_workers.push_back(std::make_unique<Worker>(*this, i));
         }
     }
     TcpServer::~TcpServer()
     {
-        SSL_free(m_ssl);
-        SSL_CTX_free(m_ssl_ctx);
-        EVP_cleanup();
-        closeServer();
+        // Stop scheduling refreshes, then join the upstream threads so none of
+        // them can post a completion to a worker that is being torn down.
+        m_watchlist.reset();
+        m_upstream.reset();
+        m_players.reset();
+        m_workers.clear();
+    }
+
+    void TcpServer::startListen()
+    {
+        logEvent(LogLevel::Info, "listening", inet_ntoa(m_socketAddress.sin_addr),
+                 {{"port", ntohs(m_socketAddress.sin_port)}, {"workers", static_cast<std::int64_t>(m_workers.size())}});
+
+        // Worker 0 runs on the calling thread; the rest get a thread each.
+        std::vector<std::thread> threads;
+        threads.reserve(m_workers.size() - 1);
+        for (std::size_t i = 1; i < m_workers.size(); ++i)
+        {
+            threads.emplace_back(&Worker::run, m_workers[i].get());
+        }
+
+        m_workers.front()->run();
+
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
     }
 
-    int TcpServer::startServer()
+    void TcpServer::appendMetrics(std::string &out) const
     {
-        m_socket = socket(AF_INET, SOCK_STREAM, 0);
+        MetricsWriter metrics(out);
+
+        // Each worker counts for itself; a scrape adds them up.
+        std::uint64_t accepted = 0;
+        std::uint64_t closed = 0;
+        std::uint64_t handshakeFailures = 0;
+        std::uint64_t requests = 0;
+        std::array<std::uint64_t, 5> responses{};
+        ResponseCache::Stats rendered{0, 0};
+        for (const auto &worker : m_workers)
+        {
+            const Worker::Counters &counters = worker->counters();
+            // closed first, so a connection that closes mid-scrape is already in
+            // accepted; the gauge below still clamps, as the loads are relaxed.
+            closed += counters.closed.load(std::memory_order_relaxed);
+            accepted += counters.accepted.load(std::memory_order_relaxed);
+            handshakeFailures += counters.handshakeFailures.load(std::memory_order_relaxed);
+            requests += counters.requests.load(std::memory_order_relaxed);
+            for (std::size_t i = 0; i < responses.size(); ++i)
+            {
+                responses[i] += counters.responses[i].load(std::memory_order_relaxed);
+            }
+            const ResponseCache::Stats cache = worker->responseCacheStats();
+            rendered.hits += cache.hits;
+            rendered.renders += cache.renders;
+        }
+
+        metrics.counter("osrs_connections_accepted_total", "Client connections accepted.", accepted);
+        metrics.gauge("osrs_connections_open", "Client connections currently open.",
+                      static_cast<double>(accepted > closed ? accepted - closed : 0));
+        metrics.counter("osrs_tls_handshake_failures_total", "Client TLS handshakes that failed.", handshakeFailures);
+        const ServerTlsContext::Stats tls = m_tls->stats();
+        metrics.family("osrs_tls_handshakes_total", "counter", "Client TLS handshakes completed, by whether the session was resumed.");
+        metrics.sample("osrs_tls_handshakes_total", "kind=\"full\"", tls.fullHandshakes);
+        metrics.sample("osrs_tls_handshakes_total", "kind=\"resumed\"", tls.resumedHandshakes);
+        metrics.counter("osrs_tls_ticket_key_rotations_total", "Session ticket keys rotated.", tls.ticketKeyRotations);
+        if (m_tls->ktls())
+        {
+            metrics.family("osrs_tls_ktls_connections_total", "counter", "Client connections whose records the kernel encrypts or decrypts, by direction.");
+            metrics.sample("osrs_tls_ktls_connections_total", "direction=\"send\"", tls.ktlsSend);
+            metrics.sample("osrs_tls_ktls_connections_total", "direction=\"receive\"", tls.ktlsReceive);
+            metrics.counter("osrs_tls_ktls_unavailable_total", "Client connections left in user-space TLS because kTLS could not take them.", tls.ktlsUnavailable);
+        }
+
+        metrics.counter("osrs_http_requests_total", "Requests parsed, malformed ones included.", requests);
+        metrics.family("osrs_http_responses_total", "counter", "Responses sent, by status class.");
+        std::string statusClass = "code=\"0xx\"";
+        for (std::size_t i = 0; i < responses.size(); ++i)
+        {
+            statusClass[6] = static_cast<char>('1' + i);
+            metrics.sample("osrs_http_responses_total", statusClass, responses[i]);
+        }
+        metrics.counter("osrs_response_cache_hits_total", "Player responses served pre-rendered.", rendered.hits);
+        metrics.counter("osrs_response_cache_renders_total", "Player responses rendered.", rendered.renders);
+
+        const CompressionStats compression = compressionStats();
+        metrics.family("osrs_response_body_bytes_total", "counter", "Response body bytes sent, by content coding.");
+        for (std::size_t i = 0; i < kContentEncodingCount; ++i)
+        {
+            const std::string labels = "encoding=\"" + std::string(encodingName(static_cast<ContentEncoding>(i))) + "\"";
+            metrics.sample("osrs_response_body_bytes_total", labels, compression.bytesSent[i]);
+        }
+        metrics.counter("osrs_response_body_uncompressed_bytes_total",
+                        "What the compressed response bodies would have cost uncompressed.", compression.bytesBeforeCompression);
+
+        const osrs::PlayerCache::Stats players = m_playerCache->stats();
+        metrics.counter("osrs_player_cache_hits_total", "Player cache lookups answered from memory.", players.hits);
+        metrics.counter("osrs_player_cache_misses_total", "Player cache lookups that missed.", players.misses);
+        metrics.counter("osrs_player_cache_evictions_total", "Player cache entries dropped to make room.", players.evictions);
+        metrics.counter("osrs_player_cache_expirations_total", "Player cache entries dropped after their TTL.", players.expirations);
+        metrics.counter("osrs_player_cache_grace_hits_total", "Hits on expired players served while they are refreshed.", players.graceHits);
+        metrics.gauge("osrs_player_cache_entries", "Players held in the player cache.", static_cast<double>(players.entries));
+
+        const osrs::PlayerService::Stats service = m_players->stats();
+        metrics.counter("osrs_upstream_fetches_total", "Hiscore fetches started.", service.fetches);
+        metrics.counter("osrs_upstream_coalesced_total", "Lookups that joined a fetch already in flight.", service.coalesced);
+        metrics.counter("osrs_upstream_stale_served_total", "Failed fetches answered with an expired cache entry.", service.staleServed);
+        metrics.counter("osrs_upstream_revalidations_total", "Background fetches for players served in their grace period.", service.revalidations);
+        metrics.gauge("osrs_upstream_fetches_in_flight", "Hiscore fetches running now.", static_cast<double>(service.inFlight));
+
+        metrics.family("osrs_upstream_timeouts_total", "counter", "Hiscore fetches that ran out of time, by the stage they were in.");
+        for (std::size_t i = 1; i < kUpstreamStageCount; ++i)
+        {
+            const UpstreamStage stage = static_cast<UpstreamStage>(i);
+            metrics.sample("osrs_upstream_timeouts_total", std::string("stage=\"") + stageName(stage) + "\"", m_hiscore->timeouts(stage));
+        }
+
+        const UpstreamGuard::Stats guard = m_hiscore->guardStats();
+        metrics.gauge("osrs_upstream_concurrency_limit", "Current adaptive limit on concurrent hiscore calls.", guard.limit);
+        metrics.gauge("osrs_upstream_calls_in_flight", "Hiscore calls holding a permit.", static_cast<double>(guard.inFlight));
+        metrics.family("osrs_upstream_breaker_state", "gauge", "1 for the circuit breaker's current state, 0 for the others.");
+        for (const auto state : {UpstreamGuard::BreakerState::Closed, UpstreamGuard::BreakerState::Open, UpstreamGuard::BreakerState::HalfOpen})
+        {
+            metrics.sample("osrs_upstream_breaker_state", std::string("state=\"") + breakerStateName(state) + "\"",
+                           std::uint64_t(guard.state == state ? 1 : 0));
+        }
+        metrics.counter("osrs_upstream_rejected_total", "Hiscore calls refused by the open circuit breaker.", guard.rejected);
+        metrics.counter("osrs_upstream_breaker_trips_total", "Times the circuit breaker opened.", guard.trips);
+
+        const ClientTlsContext::Stats upstreamTls = m_hiscore->pool().tlsStats();
+        metrics.family("osrs_upstream_tls_handshakes_total", "counter", "Hiscore TLS handshakes, by whether a cached session was resumed.");
+        metrics.sample("osrs_upstream_tls_handshakes_total", "kind=\"full\"", upstreamTls.resumptionMisses);
+        metrics.sample("osrs_upstream_tls_handshakes_total", "kind=\"resumed\"", upstreamTls.resumptionHits);
+        metrics.gauge("osrs_upstream_tls_cached_sessions", "Hiscore TLS sessions cached for resumption.", static_cast<double>(upstreamTls.cachedSessions));
+
+        const DnsCache::Stats dns = m_hiscore->pool().dnsStats();
+        metrics.counter("osrs_upstream_dns_lookups_total", "Address lookups for the hiscore host.", dns.lookups);
+        metrics.counter("osrs_upstream_dns_resolutions_total", "Successful background resolutions of the hiscore host.", dns.resolutions);
+        metrics.counter("osrs_upstream_dns_failures_total", "Failed background resolutions of the hiscore host.", dns.failures);
+        metrics.counter("osrs_upstream_dns_stale_served_total", "Lookups answered from an expired address.", dns.staleServed);
+
+        if (m_history)
+        {
+            const osrs::HistoryStore::Stats history = m_history->stats();
+            metrics.gauge("osrs_history_players", "Players with recorded history.", static_cast<double>(history.players));
+            metrics.gauge("osrs_history_samples", "History samples stored.", static_cast<double>(history.samples));
+            metrics.gauge("osrs_history_bytes", "Size of the history data file.", static_cast<double>(history.bytes));
+        }
+
+        if (m_watchlist)
+        {
+            const osrs::Watchlist::Stats watchlist = m_watchlist->stats();
+            metrics.gauge("osrs_watchlist_players", "Players kept fresh in the background.", static_cast<double>(watchlist.watched));
+            metrics.counter("osrs_watchlist_refreshes_total", "Background fetches scheduled for watched players.", watchlist.refreshes);
+        }
+
+        const LogStats logging = logStats();
+        metrics.counter("osrs_log_lines_total", "Log lines written.", logging.written);
+        metrics.counter("osrs_log_dropped_total", "Log events dropped because a thread's buffer was full.", logging.dropped);
+
+        metrics.latencyHistograms();
+    }
+
+    Worker::Worker(TcpServer &server, std::size_t index) : m_server(server),
+                                                           m_index(index),
+                                                           m_socket(-1),
+                                                           m_epoll(-1),
+                                                           m_wakeup(-1),
+                                                           m_spareFd(-1),
+                                                           m_acceptPaused(false),
+                                                           m_nextConnectionId(FIRST_CONNECTION_ID),
+                                                           m_rendered(server.m_options.responseCacheEntries)
+    {
+        m_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
         if (m_socket < 0)
         {
             exitWithError("Cannot create socket");
-            return 1;
         }
-        
-        if (bind(m_socket, (sockaddr *)&m_socketAddress, m_socketAddress_len) < 0)
+
+        // Every worker binds the same address; the kernel load-balances accepts between them.
+        const int enable = 1;
+        if (setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) < 0 ||
+            setsockopt(m_socket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0)
+        {
+            exitWithError("Cannot enable SO_REUSEPORT on socket");
+        }
+
+        if (bind(m_socket, (const sockaddr *)&m_server.m_socketAddress, sizeof(m_server.m_socketAddress)) < 0)
+        {
+            std::ostringstream ss;
+            ss << "Cannot connect socket to address with PORT: " << ntohs(m_server.m_socketAddress.sin_port);
+            exitWithError(ss.str());
+        }
+
+        m_epoll = epoll_create1(EPOLL_CLOEXEC);
+        if (m_epoll < 0)
+        {
+            exitWithError("Cannot create epoll instance");
+        }
+
+        m_wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (m_wakeup < 0)
         {
-            exitWithError("Cannot connect socket to address");
-            return 1;
+            exitWithError("Cannot create wakeup eventfd");
         }
 
-        return 0;
+        m_spareFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+        epoll_event listenerEvent{};
+        listenerEvent.events = EPOLLIN | EPOLLET;
+        listenerEvent.data.u64 = LISTENER_TOKEN;
+
+        epoll_event wakeupEvent{};
+        wakeupEvent.events = EPOLLIN | EPOLLET;
+        wakeupEvent.data.u64 = WAKEUP_TOKEN;
+
+        if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_socket, &listenerEvent) < 0 ||
+            epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeup, &wakeupEvent) < 0)
+        {
+            exitWithError("Cannot register worker descriptors with epoll");
+        }
     }
 
-    void TcpServer::closeServer()
+    Worker::~Worker()
     {
+        for (auto &entry : m_connections)
+        {
+            Connection &connection = *entry.second;
+            SSL_free(connection.ssl);
+            close(connection.socket);
+        }
+        m_connections.clear();
+
+        if (m_spareFd >= 0)
+        {
+            close(m_spareFd);
+        }
+        close(m_wakeup);
+        close(m_epoll);
         close(m_socket);
-        close(m_new_socket);
-        exit(0);
     }
 
-    void TcpServer::startListen()
+    void Worker::pinToCpu()
     {
-        if (listen(m_socket, 20) < 0)
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        {
+            return;
+        }
+
+        const int allowedCount = CPU_COUNT(&allowed);
+        if (allowedCount == 0)
+        {
+            return;
+        }
+
+        // Worker i takes the (i mod n)-th CPU of the process's affinity mask.
+        int target = static_cast<int>(m_index % static_cast<std::size_t>(allowedCount));
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (!CPU_ISSET(cpu, &allowed))
+            {
+                continue;
+            }
+            if (target-- > 0)
+            {
+                continue;
+            }
+
+            cpu_set_t pinned;
+            CPU_ZERO(&pinned);
+            CPU_SET(cpu, &pinned);
+            if (pthread_setaffinity_np(pthread_self(), sizeof(pinned), &pinned) != 0)
+            {
+                logEvent(LogLevel::Warn, "pin_failed", {}, {{"worker", static_cast<std::int64_t>(m_index)}, {"cpu", cpu}});
+            }
+            return;
+        }
+    }
+
+    void Worker::run()
+    {
+        if (m_server.m_options.pinWorkers)
+        {
+            pinToCpu();
+        }
+
+        if (listen(m_socket, SOMAXCONN) < 0)
         {
             exitWithError("Socket listen failed.");
         }
 
-        std::ostringstream ss;
-        ss << "\n*** Listening on ADDRESS: " << inet_ntoa(m_socketAddress.sin_addr) << " PORT : " << ntohs(m_socketAddress.sin_port) << " ***\n\n";
-        log(ss.str());
+        epoll_event events[MAX_EVENTS];
+
+        // With an idle timeout the loop wakes at least once per sweep interval.
+        const int waitTimeout = m_server.m_options.idleTimeoutSeconds > 0 ? IDLE_SWEEP_INTERVAL_MS : -1;
+        m_lastSweep = std::chrono::steady_clock::now();
+
+        while (true)
+        {
+            int ready = epoll_wait(m_epoll, events, MAX_EVENTS, m_acceptPaused ? ACCEPT_RETRY_MS : waitTimeout);
+            if (ready < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                exitWithError("epoll_wait failed.");
+            }
+
+            if (waitTimeout > 0)
+            {
+                closeIdleConnections();
+            }
+            if (m_acceptPaused)
+            {
+                acceptConnections();
+            }
+
+            for (int i = 0; i < ready; ++i)
+            {
+                const std::uint64_t token = events[i].data.u64;
+                if (token == LISTENER_TOKEN)
+                {
+                    acceptConnections();
+                    continue;
+                }
+                if (token == WAKEUP_TOKEN)
+                {
+                    drainCompletions();
+                    continue;
+                }
+
+                // The connection may already have been closed earlier in this batch.
+                auto it = m_connections.find(token);
+                if (it == m_connections.end())
+                {
+                    continue;
+                }
+
+                Connection &connection = *it->second;
+                const std::uint32_t flags = events[i].events;
+                if (flags & (EPOLLERR | EPOLLHUP))
+                {
+                    // Nobody is left to read the response; drop it when it arrives.
+                    connection.fatal = true;
+                    closeConnection(connection);
+                    continue;
+                }
+                if (flags & EPOLLRDHUP)
+                {
+                    // A half-close still reads what we send: answer what was asked, then close.
+                    connection.peerClosed = true;
+                }
 
-        int bytesReceived;
+                touch(connection);
+                advance(connection);
+            }
+        }
+    }
 
+    void Worker::acceptConnections()
+    {
+        m_acceptPaused = false;
+
+        // Edge-triggered: drain the whole backlog before waiting again.
         while (true)
         {
-            log("===== Waiting for a new connection =====\n\n\n");
-            acceptConnection(m_new_socket);
-            
-            m_ssl = SSL_new(m_ssl_ctx);
-            SSL_set_fd(m_ssl, m_new_socket);
+            const auto acceptStart = std::chrono::steady_clock::now();
+            sockaddr_in clientAddress{};
+            socklen_t clientAddress_len = sizeof(clientAddress);
+            int new_socket = accept4(m_socket, (sockaddr *)&clientAddress, &clientAddress_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (new_socket < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED)
+                {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    return;
+                }
 
-            if (SSL_accept(m_ssl) <= 0)
+                const int error = errno;
+                logSampled(LogLevel::Warn, "accept_failed", std::strerror(error), {{"errno", error}});
+                // ENOBUFS, ENOMEM, or no spare descriptor: whatever is still queued
+                // raises no new edge, so try again shortly.
+                m_acceptPaused = !((error == EMFILE || error == ENFILE) && shedBacklog());
+                return;
+            }
+
+            SSL *ssl = SSL_new(m_server.m_tls->ctx());
+            if (!ssl || SSL_set_fd(ssl, new_socket) != 1)
+            {
+                logEvent(LogLevel::Error, "ssl_alloc_failed", takeSslError());
+                SSL_free(ssl);
+                close(new_socket);
+                continue;
+            }
+
+            auto connection = std::make_unique<Connection>(m_server.m_options.maxRequestHeaderBytes, m_server.m_options.maxRequestBodyBytes);
+            connection->id = m_nextConnectionId++;
+            connection->socket = new_socket;
+            connection->ssl = ssl;
+            connection->lastActivity = std::chrono::steady_clock::now();
+            connection->stageStart = connection->lastActivity;
+            connection->idlePosition = m_idle.insert(m_idle.end(), connection->id);
+
+            epoll_event event{};
+            event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            event.data.u64 = connection->id;
+            if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, new_socket, &event) < 0)
             {
-                ERR_print_errors_fp(stderr);
+                logEvent(LogLevel::Error, "epoll_add_failed", std::strerror(errno));
+                m_idle.erase(connection->idlePosition);
+                SSL_free(ssl);
+                close(new_socket);
                 continue;
             }
 
-            char buffer[BUFFER_SIZE] = {0};
-            bytesReceived = SSL_read(m_ssl, buffer, BUFFER_SIZE);
-            if (bytesReceived < 0)
+            m_connections.emplace(connection->id, std::move(connection));
+            increment(m_counters.accepted);
+            recordLatency(LatencyStage::Accept, std::chrono::steady_clock::now() - acceptStart);
+        }
+    }
+
+    bool Worker::shedBacklog()
+    {
+        if (m_spareFd < 0)
+        {
+            return false;
+        }
+
+        // Peers see their connection closed rather than waiting in the backlog
+        // for a descriptor that may not come.
+        close(m_spareFd);
+        std::int64_t shed = 0;
+        int client;
+        while ((client = accept4(m_socket, nullptr, nullptr, SOCK_CLOEXEC)) >= 0 || errno == EINTR || errno == ECONNABORTED)
+        {
+            if (client >= 0)
+            {
+                close(client);
+                ++shed;
+            }
+        }
+        const bool drained = errno == EAGAIN || errno == EWOULDBLOCK;
+        m_spareFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (shed > 0)
+        {
+            logSampled(LogLevel::Warn, "accept_shed", {}, {{"connections", shed}});
+        }
+        return drained;
+    }
+
+    void Worker::drainCompletions()
+    {
+        std::uint64_t signalled = 0;
+        while (read(m_wakeup, &signalled, sizeof(signalled)) > 0)
+        {
+        }
+
+        std::vector<Completion> completions;
+        {
+            std::lock_guard<std::mutex> lock(m_completionMutex);
+            completions.swap(m_completions);
+        }
+
+        for (auto &completion : completions)
+        {
+            if (completion.rendered)
             {
-                exitWithError("Failed to read bytes from client socket connection.");
+                cacheRendered(completion.playerKey, completion.rendered);
             }
 
-            if (bytesReceived == 0)
+            std::vector<RenderWaiter> waiters;
+            if (completion.connectionId == 0)
             {
-                SSL_shutdown(m_ssl);
-                SSL_free(m_ssl);
-                m_ssl = nullptr;
-                close(m_new_socket);
+                // A render started for cache hits: answer everyone who asked meanwhile.
+                auto waiting = m_renderWaiters.find(completion.rendered->snapshot.get());
+                if (waiting != m_renderWaiters.end())
+                {
+                    waiters = std::move(waiting->second);
+                    m_renderWaiters.erase(waiting);
+                }
+            }
+            else
+            {
+                waiters.push_back(RenderWaiter{completion.connectionId, std::move(completion.ifNoneMatch), completion.acceptedEncoding});
+            }
+
+            for (const RenderWaiter &waiter : waiters)
+            {
+                auto it = m_connections.find(waiter.connectionId);
+                if (it == m_connections.end() || it->second->state != ConnectionState::Dispatch)
+                {
+                    continue; // client went away while the upstream fetch was running
+                }
+
+                Connection &connection = *it->second;
+                touch(connection);
+                if (completion.player)
+                {
+                    respondPlayer(connection, completion.playerKey, completion.player, waiter.ifNoneMatch, waiter.acceptedEncoding);
+                }
+                else if (completion.rendered)
+                {
+                    respondRendered(connection, completion.rendered, waiter.ifNoneMatch, waiter.acceptedEncoding);
+                }
+                else
+                {
+                    respond(connection, completion.statusCode, completion.body, completion.encoding, completion.originalBytes);
+                }
+                advance(connection);
+            }
+        }
+    }
+
+    void Worker::touch(Connection &connection)
+    {
+        connection.lastActivity = std::chrono::steady_clock::now();
+        m_idle.splice(m_idle.end(), m_idle, connection.idlePosition);
+    }
+
+    void Worker::closeIdleConnections()
+    {
+        const auto now = std::chrono::steady_clock::now();
+        if (now - m_lastSweep < std::chrono::milliseconds(IDLE_SWEEP_INTERVAL_MS))
+        {
+            return;
+        }
+        m_lastSweep = now;
+
+        // The list is ordered by last activity, so stop at the first connection that is still fresh.
+        const auto cutoff = now - std::chrono::seconds(m_server.m_options.idleTimeoutSeconds);
+        auto it = m_idle.begin();
+        while (it != m_idle.end())
+        {
+            Connection &connection = *m_connections.at(*it);
+            if (connection.lastActivity > cutoff)
+            {
+                break;
+            }
+            ++it;
+
+            // A connection waiting on its upstream fetch is not idle; the completion touches it.
+            if (connection.state != ConnectionState::Dispatch)
+            {
+                closeConnection(connection);
+            }
+        }
+    }
+
+    void Worker::advance(Connection &connection)
+    {
+        // Each step returns false when it would block (or has closed the connection).
+        while (true)
+        {
+            switch (connection.state)
+            {
+            case ConnectionState::Handshake:
+                if (!doHandshake(connection))
+                {
+                    return;
+                }
+                break;
+            case ConnectionState::Read:
+                if (!doRead(connection))
+                {
+                    return;
+                }
+                break;
+            case ConnectionState::Dispatch:
+                return;
+            case ConnectionState::Write:
+                if (!doWrite(connection))
+                {
+                    return;
+                }
+                break;
+            case ConnectionState::Shutdown:
+                closeConnection(connection);
+                return;
+            }
+        }
+    }
+
+    bool Worker::doHandshake(Connection &connection)
+    {
+        ERR_clear_error();
+        int result = SSL_accept(connection.ssl);
+        if (result == 1)
+        {
+            m_server.m_tls->recordHandshake(connection.ssl);
+            recordLatency(LatencyStage::Handshake, std::chrono::steady_clock::now() - connection.stageStart);
+            connection.state = ConnectionState::Read;
+            return true;
+        }
+
+        int error = SSL_get_error(connection.ssl, result);
+        if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE)
+        {
+            return false;
+        }
+
+        // Scanners and clients with no common cipher fail here; sampled so they cannot flood the log.
+        logSampled(LogLevel::Warn, "handshake_failed", takeSslError(), {{"conn", static_cast<std::int64_t>(connection.id)}});
+        increment(m_counters.handshakeFailures);
+        connection.fatal = true;
+        connection.state = ConnectionState::Shutdown;
+        return true;
+    }
+
+    bool Worker::doRead(Connection &connection)
+    {
+        // A pipelined request may already be waiting behind the one just answered.
+        if (dispatchBuffered(connection))
+        {
+            return true;
+        }
+
+        // Reclaim the space of answered requests before the buffer grows further.
+        if (connection.readOffset > 0 && connection.readOffset >= connection.readBuffer.size() / 2)
+        {
+            connection.readBuffer.erase(0, connection.readOffset);
+            connection.readOffset = 0;
+        }
+
+        char buffer[READ_CHUNK_SIZE];
+        while (true)
+        {
+            ERR_clear_error();
+            int bytesReceived = SSL_read(connection.ssl, buffer, READ_CHUNK_SIZE);
+            if (bytesReceived > 0)
+            {
+                connection.readBuffer.append(buffer, bytesReceived);
+                if (dispatchBuffered(connection))
+                {
+                    return true;
+                }
                 continue;
             }
 
-            std::ostringstream ss;
-            ss << "----- Received request from client -----\n\n";
-            log(ss.str());
+            int error = SSL_get_error(connection.ssl, bytesReceived);
+            if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE)
+            {
+                return false;
+            }
+
+            // Clean close_notify from the peer, or a broken connection.
+            connection.fatal = error != SSL_ERROR_ZERO_RETURN;
+            connection.state = ConnectionState::Shutdown;
+            return true;
+        }
+    }
+
+    bool Worker::dispatchBuffered(Connection &connection)
+    {
+        std::string_view pending(connection.readBuffer);
+        pending.remove_prefix(connection.readOffset);
+
+        HttpRequest request;
+        const auto parseStart = std::chrono::steady_clock::now();
+        const ParseStatus status = connection.parser.parse(pending, request);
+        if (status == ParseStatus::Incomplete)
+        {
+            return false;
+        }
+        connection.requestStart = std::chrono::steady_clock::now();
+        increment(m_counters.requests);
+
+        switch (status)
+        {
+        case ParseStatus::Invalid:
+            connection.keepAlive = false;
+            respond(connection, 400, "{\"error\":\"Malformed request\"}");
+            return true;
+        case ParseStatus::HeaderTooLarge:
+            connection.keepAlive = false;
+            respond(connection, 431, "{\"error\":\"Request headers too large\"}");
+            return true;
+        case ParseStatus::BodyTooLarge:
+            connection.keepAlive = false;
+            respond(connection, 413, "{\"error\":\"Request body too large\"}");
+            return true;
+        default: // Complete; Incomplete returned above
+            recordLatency(LatencyStage::Parse, connection.requestStart - parseStart);
+            break;
+        }
+
+        // Requests are answered strictly one at a time, so pipelined responses go out in order.
+        connection.state = ConnectionState::Dispatch;
+        handleRequest(connection, request);
+
+        // The request's views die here; anything behind it stays buffered for the next round.
+        connection.readOffset += request.length;
+        if (connection.readOffset == connection.readBuffer.size())
+        {
+            connection.readBuffer.clear();
+            connection.readOffset = 0;
+        }
+        return true;
+    }
+
+    bool Worker::doWrite(Connection &connection)
+    {
+        const std::string &output = connection.writeShared ? *connection.writeShared : connection.writeBuffer;
+        while (connection.writeOffset < output.size())
+        {
+            ERR_clear_error();
+            int bytesSent = SSL_write(connection.ssl,
+                                      output.data() + connection.writeOffset,
+                                      static_cast<int>(output.size() - connection.writeOffset));
+            if (bytesSent > 0)
+            {
+                connection.writeOffset += static_cast<std::size_t>(bytesSent);
+                continue;
+            }
+
+            int error = SSL_get_error(connection.ssl, bytesSent);
+            if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE)
+            {
+                return false;
+            }
+
+            logSampled(LogLevel::Warn, "write_failed", takeSslError(), {{"conn", static_cast<std::int64_t>(connection.id)}});
+            connection.fatal = true;
+            connection.state = ConnectionState::Shutdown;
+            return true;
+        }
+
+        const auto finished = std::chrono::steady_clock::now();
+        recordLatency(LatencyStage::Write, finished - connection.stageStart);
+        recordLatency(LatencyStage::Request, finished - connection.requestStart);
+
+        logSampled(LogLevel::Info, "request", {},
+                   {{"conn", static_cast<std::int64_t>(connection.id)},
+                    {"status", connection.responseStatus},
+                    {"bytes", static_cast<std::int64_t>(output.size())},
+                    {"us", std::chrono::duration_cast<std::chrono::microseconds>(finished - connection.requestStart).count()}});
+        ++connection.requestsServed;
+        connection.writeBuffer.clear();
+        connection.writeShared.reset();
+        connection.writeOffset = 0;
+        // A peer that has stopped sending still gets answers to requests it already sent, then a close.
+        const bool buffered = connection.readOffset < connection.readBuffer.size();
+        connection.state = connection.keepAlive && (!connection.peerClosed || buffered) ? ConnectionState::Read
+                                                                                         : ConnectionState::Shutdown;
+        return true;
+    }
+
+    void Worker::closeConnection(Connection &connection)
+    {
+        if (connection.ssl)
+        {
+            if (!connection.fatal)
+            {
+                // Best effort close_notify; never wait for the peer's reply.
+                ERR_clear_error();
+                SSL_shutdown(connection.ssl);
+            }
+            SSL_free(connection.ssl);
+            connection.ssl = nullptr;
+        }
+
+        // Closing the descriptor also removes it from the epoll set.
+        close(connection.socket);
+        m_idle.erase(connection.idlePosition);
+        m_connections.erase(connection.id);
+        increment(m_counters.closed);
+    }
+
+    void Worker::beginWrite(Connection &connection, int statusCode)
+    {
+        if (statusCode >= 100 && statusCode < 600)
+        {
+            increment(m_counters.responses[static_cast<std::size_t>(statusCode / 100 - 1)]);
+        }
+        connection.responseStatus = statusCode;
+        connection.stageStart = std::chrono::steady_clock::now();
+        connection.writeOffset = 0;
+        connection.state = ConnectionState::Write;
+    }
+
+    void Worker::respond(Connection &connection, int statusCode, std::string_view body,
+                         ContentEncoding encoding, std::size_t originalBytes)
+    {
+        if (encoding == ContentEncoding::Identity)
+        {
+            originalBytes = body.size();
+        }
+        recordResponseBytes(encoding, body.size(), originalBytes);
+
+        // SSL_write has no vectored form, so the head and body are laid out back to back in
+        // the connection's buffer (capacity kept across requests) and leave in one TLS record.
+        connection.writeBuffer.clear();
+        appendResponse(connection.writeBuffer, statusCode, body, connection.keepAlive, encodingHeaders(encoding));
+        beginWrite(connection, statusCode);
+    }
+
+    void Worker::respondMetrics(Connection &connection, ContentEncoding encoding)
+    {
+        // Scrapes are rare, so merging the histograms and compressing run right here on the loop.
+        std::string text;
+        m_server.appendMetrics(text);
+
+        std::string compressed;
+        const bool compressedBody = encoding != ContentEncoding::Identity && compress(encoding, text, compressed);
+        const std::string_view body = compressedBody ? compressed : text;
+        if (!compressedBody)
+        {
+            encoding = ContentEncoding::Identity;
+        }
+        recordResponseBytes(encoding, body.size(), text.size());
+
+        connection.writeBuffer.clear();
+        appendFramed(connection.writeBuffer, METRICS_HEAD_PREFIX, body, connection.keepAlive, encodingHeaders(encoding));
+        beginWrite(connection, 200);
+    }
+
+    void Worker::respondPlayer(Connection &connection, const std::string &key,
+                               const std::shared_ptr<const osrs::PlayerSnapshot> &snapshot, std::string_view ifNoneMatch,
+                               ContentEncoding encoding)
+    {
+        std::shared_ptr<const RenderedResponse> rendered;
+        {
+            LatencyTimer timer(LatencyStage::RenderLookup);
+            rendered = m_rendered.find(key, snapshot.get());
+        }
+        if (rendered)
+        {
+            respondRendered(connection, rendered, ifNoneMatch, encoding);
+            return;
+        }
+
+        // Compressing every coding would stall the loop; the pool does it once
+        // per snapshot, however many requests for it arrive meanwhile.
+        std::vector<RenderWaiter> &waiters = m_renderWaiters[snapshot.get()];
+        waiters.push_back(RenderWaiter{connection.id, std::string(ifNoneMatch), encoding});
+        if (waiters.size() > 1)
+        {
+            return;
+        }
+        m_server.m_upstream->submit([this, key, snapshot]() {
+            Completion completion;
+            completion.rendered = render(snapshot);
+            completion.playerKey = key;
+            postCompletion(std::move(completion));
+        });
+    }
+
+    void Worker::cacheRendered(const std::string &key, const std::shared_ptr<const RenderedResponse> &rendered)
+    {
+        const osrs::PlayerSnapshot &snapshot = *rendered->snapshot;
+        if (snapshot.success || snapshot.upstreamStatus == 404)
+        {
+            m_rendered.insert(key, rendered);
+        }
+    }
+
+    void Worker::respondRendered(Connection &connection, const std::shared_ptr<const RenderedResponse> &rendered,
+                                 std::string_view ifNoneMatch, ContentEncoding encoding)
+    {
+        // Falls back to identity when this coding was not worth producing for the body.
+        const RenderedResponse::Variant &variant = rendered->variantFor(encoding);
+        const ContentEncoding sent = &variant == &rendered->variantFor(ContentEncoding::Identity) ? ContentEncoding::Identity : encoding;
+        // Preconditions only apply to a response that would be a 2xx; errors carry no validator.
+        const bool notModified = rendered->statusCode == 200 && !ifNoneMatch.empty() && etagMatches(ifNoneMatch, variant.etag);
+        if (!notModified)
+        {
+            recordResponseBytes(sent, variant.body.size(), rendered->variantFor(ContentEncoding::Identity).body.size());
+        }
 
-            std::string request(buffer, bytesReceived);
-            std::string responsePayload = handleRequest(request);
+        beginWrite(connection, notModified ? 304 : rendered->statusCode);
+        if (connection.keepAlive)
+        {
+            // The common polling case: no serialization, no copy, just a reference to the shared bytes.
+            connection.writeShared = std::shared_ptr<const std::string>(rendered, notModified ? &variant.notModified : &variant.full);
+            return;
+        }
 
-            long bytesSent = SSL_write(m_ssl, responsePayload.c_str(), responsePayload.size());
+        connection.writeBuffer.clear();
+        if (notModified)
+        {
+            appendNotModified(connection.writeBuffer, false, variant.headers);
+        }
+        else
+        {
+            appendResponse(connection.writeBuffer, rendered->statusCode, variant.body, false, variant.headers);
+        }
+    }
 
-            if (bytesSent == static_cast<long>(responsePayload.size()))
+    std::shared_ptr<const RenderedResponse> Worker::render(const std::shared_ptr<const osrs::PlayerSnapshot> &snapshot) const
+    {
+        auto rendered = std::make_shared<RenderedResponse>();
+        rendered->snapshot = snapshot;
+        if (snapshot->success)
+        {
+            rendered->statusCode = 200;
+        }
+        else
+        {
+            if (snapshot->rejected)
             {
-                log("----- Server Response sent to client -----\n\n");
+                rendered->statusCode = 503;
             }
             else
             {
-                log("Error sending response to client");
+                rendered->statusCode = snapshot->timedOut != UpstreamStage::None ? 504 : 502;
+            }
+        }
+        RenderedResponse::Variant &identity = rendered->variants[static_cast<std::size_t>(ContentEncoding::Identity)];
+        {
+            LatencyTimer timer(LatencyStage::Serialize);
+            osrs::ToJson(*snapshot, identity.body);
+        }
+
+        // Same contents, same validator, so a re-fetch that changed nothing still earns a 304.
+        // Error answers get none: a 304 must never stand in for a 5xx.
+        const bool validated = rendered->statusCode == 200;
+        char hash[16];
+        std::string_view hashText;
+        if (validated)
+        {
+            const std::uint64_t digest = xxh64(identity.body);
+            char *hashEnd = std::to_chars(hash, hash + sizeof(hash), digest, 16).ptr;
+            hashText = std::string_view(hash, static_cast<std::size_t>(hashEnd - hash));
+        }
+
+        // Shared caches may keep a player as long as the player cache does.
+        const osrs::PlayerCacheOptions &cache = m_server.m_options.playerCache;
+        std::string cacheControl = "Cache-Control: ";
+        if (snapshot->success)
+        {
+            cacheControl += "public, max-age=" + std::to_string(cache.ttlSeconds);
+            if (cache.graceSeconds > 0)
+            {
+                cacheControl += ", stale-while-revalidate=" + std::to_string(cache.graceSeconds);
+            }
+        }
+        else if (snapshot->upstreamStatus == 404)
+        {
+            cacheControl += "public, max-age=" + std::to_string(cache.negativeTtlSeconds);
+        }
+        else
+        {
+            cacheControl += "no-store";
+        }
+        cacheControl += "\r\nVary: Accept-Encoding\r\n";
+
+        for (std::size_t i = 0; i < kContentEncodingCount; ++i)
+        {
+            const ContentEncoding encoding = static_cast<ContentEncoding>(i);
+            RenderedResponse::Variant &variant = rendered->variants[i];
+            if (encoding != ContentEncoding::Identity)
+            {
+                // Compressed once here and then served from memory for every later poll.
+                if (!encodingSupported(encoding) || identity.body.size() < m_server.m_options.compressMinBytes ||
+                    !compress(encoding, identity.body, variant.body))
+                {
+                    variant.body.clear();
+                    continue;
+                }
+            }
+
+            if (validated)
+            {
+                // Each coding is a different representation, so it gets its own validator.
+                variant.etag.reserve(hashText.size() + 8);
+                variant.etag += '"';
+                variant.etag += hashText;
+                if (encoding != ContentEncoding::Identity)
+                {
+                    variant.etag += '-';
+                    variant.etag += encodingName(encoding);
+                }
+                variant.etag += '"';
+                variant.headers = "ETag: " + variant.etag + "\r\n";
+            }
+            variant.headers += cacheControl;
+            if (encoding != ContentEncoding::Identity)
+            {
+                variant.headers += "Content-Encoding: ";
+                variant.headers += encodingName(encoding);
+                variant.headers += "\r\n";
+            }
+
+            appendResponse(variant.full, rendered->statusCode, variant.body, true, variant.headers);
+            if (validated)
+            {
+                appendNotModified(variant.notModified, true, variant.headers);
             }
-            
-            SSL_shutdown(m_ssl);
-            SSL_free(m_ssl);
-            m_ssl = nullptr;
-            close(m_new_socket);
         }
+        return rendered;
     }
 
-    void TcpServer::acceptConnection(int &new_socket)
+    void Worker::compressCompletion(Completion &completion, ContentEncoding encoding) const
     {
-        new_socket = accept(m_socket, (sockaddr *)&m_socketAddress, &m_socketAddress_len);
-        if (new_socket < 0)
+        if (encoding == ContentEncoding::Identity || completion.body.size() < m_server.m_options.compressMinBytes)
         {
-            std::ostringstream ss;
-            ss << "Server failed to accept incoming connection from ADDRESS: " << inet_ntoa(m_socketAddress.sin_addr) << "; PORT: " << ntohs(m_socketAddress.sin_port);
-            exitWithError(ss.str());
+            return;
+        }
+
+        // Called by the pool thread that built the body, so the event loop never spends time in deflate.
+        std::string compressed;
+        if (compress(encoding, completion.body, compressed))
+        {
+            completion.originalBytes = completion.body.size();
+            completion.body = std::move(compressed);
+            completion.encoding = encoding;
         }
     }
 
-    std::string TcpServer::handleRequest(const std::string &request)
+    void Worker::postCompletion(Completion completion)
     {
-        std::istringstream requestStream(request);
-        std::string method;
-        std::string target;
-        std::string version;
-        requestStream >> method >> target >> version;
+        // Runs on whichever thread produced the response; the loop picks it up in drainCompletions().
+        {
+            std::lock_guard<std::mutex> lock(m_completionMutex);
+            m_completions.push_back(std::move(completion));
+        }
 
-        if (method.empty())
+        const std::uint64_t one = 1;
+        if (write(m_wakeup, &one, sizeof(one)) < 0 && errno != EAGAIN)
         {
-            return buildHttpResponse(400, "{\"error\":\"Malformed request\"}", "application/json");
+            logEvent(LogLevel::Error, "wakeup_failed", std::strerror(errno));
         }
+    }
+
+    void Worker::handleRequest(Connection &connection, const HttpRequest &request)
+    {
+        // Stop honouring keep-alive once the connection has used up its request budget.
+        connection.keepAlive = request.keepAlive &&
+                               connection.requestsServed + 1 < m_server.m_options.maxRequestsPerConnection;
 
-        if (method != "GET")
+        const bool batchPost = request.method == "POST" && request.path == "/players";
+        if (request.method != "GET" && !batchPost)
         {
-            return buildHttpResponse(405, "{\"error\":\"Only GET supported\"}", "application/json");
+            respond(connection, 405, "{\"error\":\"Only GET supported\"}");
+            return;
         }
 
-        std::string path = target;
-        std::string queryString;
-        auto queryPos = target.find('?');
-        if (queryPos != std::string::npos)
+        if (request.path == "/" || request.path.empty())
         {
-            path = target.substr(0, queryPos);
-            queryString = target.substr(queryPos + 1);
+            respond(connection, 200, "{\"message\":\"OSRS Hiscore service. Use /player?name=Display%20Name\"}");
+            return;
+        }
+
+        if (request.path == "/metrics")
+        {
+            respondMetrics(connection, negotiateEncoding(request.acceptEncoding));
+            return;
+        }
+
+        if (request.path == "/player")
+        {
+            if (!findQueryParam(request.query, "name", m_queryScratch) || m_queryScratch.empty())
+            {
+                respond(connection, 400, "{\"error\":\"Query parameter 'name' is required\"}");
+                return;
+            }
+
+            // Cache hits already rendered by this worker are answered right here on the loop thread.
+            const std::string cacheKey = osrs::normalizeName(m_queryScratch);
+            if (m_server.m_watchlist)
+            {
+                m_server.m_watchlist->recordAccess(cacheKey);
+            }
+            std::shared_ptr<const osrs::PlayerSnapshot> cached;
+            {
+                LatencyTimer timer(LatencyStage::CacheLookup);
+                cached = m_server.m_players->cached(cacheKey);
+            }
+            if (cached)
+            {
+                respondPlayer(connection, cacheKey, cached, request.ifNoneMatch, negotiateEncoding(request.acceptEncoding));
+                return;
+            }
+
+            // The upstream fetch blocks, so it runs on the task pool (or is already
+            // running for another request) and the connection waits in Dispatch
+            // until its completion is drained.
+            // The request's views die with this call, so the key and validator travel with the completion.
+            Completion pending;
+            pending.connectionId = connection.id;
+            pending.playerKey = cacheKey;
+            pending.ifNoneMatch = std::string(request.ifNoneMatch);
+            pending.acceptedEncoding = negotiateEncoding(request.acceptEncoding);
+            m_server.m_players->fetchAsync(cacheKey, m_queryScratch, [this, pending = std::move(pending)](std::shared_ptr<const osrs::PlayerSnapshot> snapshot) mutable {
+                pending.player = std::move(snapshot);
+                postCompletion(std::move(pending));
+            });
+            return;
         }
 
-        if (path == "/" || path.empty())
+        if (request.path == "/players")
         {
-            std::string body = "{\"message\":\"OSRS Hiscore service. Use /player?name=Display%20Name\"}";
-            return buildHttpResponse(200, body, "application/json");
+            std::vector<std::string> names;
+            if (batchPost)
+            {
+                if (!parseJsonNames(request.body, names))
+                {
+                    respond(connection, 400, "{\"error\":\"Body must be a JSON array of names, or {\\\"names\\\":[...]}\"}");
+                    return;
+                }
+            }
+            else if (findQueryParam(request.query, "names", m_queryScratch))
+            {
+                splitNames(m_queryScratch, names);
+            }
+
+            if (names.empty())
+            {
+                respond(connection, 400, "{\"error\":\"At least one player name is required\"}");
+                return;
+            }
+            if (names.size() > m_server.m_options.maxBatchPlayers)
+            {
+                respond(connection, 400, "{\"error\":\"At most " + std::to_string(m_server.m_options.maxBatchPlayers) +
+                                             " players per request\"}");
+                return;
+            }
+
+            // Cached members need no fetch; the misses fan out across the upstream
+            // pool. The combined document is built off the loop, even when every
+            // member was cached, and posted back once the last lands.
+            const std::uint64_t connectionId = connection.id;
+            const ContentEncoding encoding = negotiateEncoding(request.acceptEncoding);
+            m_server.m_players->lookupManyAsync(std::move(names), m_server.m_options.batchParallelism,
+                                                [this, connectionId, encoding](std::vector<std::shared_ptr<const osrs::PlayerSnapshot>> players) {
+                                                    std::string json = "{\"players\":[";
+                                                    {
+                                                        LatencyTimer timer(LatencyStage::Serialize);
+                                                        for (std::size_t i = 0; i < players.size(); ++i)
+                                                        {
+                                                            if (i > 0)
+                                                            {
+                                                                json += ',';
+                                                            }
+                                                            osrs::ToJson(*players[i], json);
+                                                        }
+                                                    }
+                                                    json += "]}";
+                                                    Completion completion;
+                                                    completion.connectionId = connectionId;
+                                                    completion.statusCode = 200;
+                                                    completion.body = std::move(json);
+                                                    compressCompletion(completion, encoding);
+                                                    postCompletion(std::move(completion));
+                                                });
+            return;
         }
 
-        if (path == "/player")
+        if (request.path == "/player/history")
         {
-            auto params = parseQuery(queryString);
-            auto nameIt = params.find("name");
-            if (nameIt == params.end() || nameIt->second.empty())
+            std::int64_t from = std::numeric_limits<std::int64_t>::min();
+            std::int64_t to = std::numeric_limits<std::int64_t>::max();
+            if (!findQueryParam(request.query, "name", m_queryScratch) || m_queryScratch.empty())
+            {
+                respond(connection, 400, "{\"error\":\"Query parameter 'name' is required\"}");
+                return;
+            }
+            std::string bound;
+            if ((findQueryParam(request.query, "from", bound) && !parseUnixTime(bound, from)) ||
+                (findQueryParam(request.query, "to", bound) && !parseUnixTime(bound, to)))
             {
-                return buildHttpResponse(400, "{\"error\":\"Query parameter 'name' is required\"}", "application/json");
+                respond(connection, 400, "{\"error\":\"'from' and 'to' must be unix timestamps\"}");
+                return;
+            }
+            if (!m_server.m_history)
+            {
+                respond(connection, 404, "{\"error\":\"History is disabled\"}");
+                return;
             }
 
-            const std::string &playerName = nameIt->second;
-            osrs::HiscoreClient client(m_caCertPath);
-            osrs::PlayerSnapshot snapshot = client.fetchPlayer(playerName);
-            std::string body = osrs::ToJson(snapshot);
-            return buildHttpResponse(snapshot.success ? 200 : 502, body, "application/json");
+            // A long range can decode many samples, so keep it off the loop thread.
+            const std::uint64_t connectionId = connection.id;
+            const ContentEncoding encoding = negotiateEncoding(request.acceptEncoding);
+            m_server.m_upstream->submit([this, connectionId, encoding, name = m_queryScratch, from, to]() {
+                Completion completion;
+                completion.connectionId = connectionId;
+                if (osrs::HistoryToJson(*m_server.m_history, name, from, to, completion.body))
+                {
+                    completion.statusCode = 200;
+                    compressCompletion(completion, encoding);
+                }
+                else
+                {
+                    completion.statusCode = 404;
+                    completion.body = "{\"error\":\"No history recorded for player\"}";
+                }
+                postCompletion(std::move(completion));
+            });
+            return;
         }
 
-        return buildHttpResponse(404, "{\"error\":\"Not Found\"}", "application/json");
+        respond(connection, 404, "{\"error\":\"Not Found\"}");
     }
 } // namespace https
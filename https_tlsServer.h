@@ -5,40 +5,103 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <stdlib.h>
+#include <cstddef>
+#include <memory>
 #include <string>
+#include <vector>
 
+#include "dns_cache.h"
+#include "history_store.h"
 #include "osrs_hiscore.h"
+#include "player_cache.h"
+#include "player_service.h"
+#include "task_pool.h"
+#include "tls_server_context.h"
+#include "watchlist.h"
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 
 namespace https
 {
+    struct ServerOptions
+    {
+        // Each worker runs its own event loop on its own thread and listening
+        // socket; the kernel spreads new connections across them (SO_REUSEPORT).
+        std::size_t workers = 1;
+        // Pin worker i to the i-th CPU this process is allowed to run on.
+        bool pinWorkers = false;
+        // The hiscore service. The CA bundle passed to TcpServer must trust its certificate.
+        std::string upstreamHost = "secure.runescape.com";
+        int upstreamPort = 443;
+        // Threads available for blocking upstream hiscore fetches.
+        std::size_t upstreamThreads = 8;
+        // Keep-alive connections to the hiscore service, shared by those threads.
+        std::size_t upstreamConnections = 16;
+        // End-to-end budget for one upstream fetch, from the moment it is queued.
+        // Fetches that run out answer 504, so this caps upstream-bound latency.
+        int upstreamDeadlineMs = 3000;
+        // Adaptive concurrency limit and circuit breaker on hiscore calls. The
+        // limit never exceeds upstreamConnections.
+        UpstreamGuardOptions upstreamGuard;
+        // The hiscore host is resolved in the background and re-resolved as its answer ages.
+        DnsCacheOptions upstreamDns;
+        // Names accepted by one /players request, and how many of its cache
+        // misses are fetched at once (upstreamThreads caps this too).
+        std::size_t maxBatchPlayers = 500;
+        std::size_t batchParallelism = 16;
+        // Close connections with no traffic for this long (0 disables the sweep).
+        int idleTimeoutSeconds = 15;
+        // Requests served on one keep-alive connection before it is closed.
+        std::size_t maxRequestsPerConnection = 1000;
+        // Requests whose head or body exceed these are rejected with 431/413.
+        std::size_t maxRequestHeaderBytes = 16384;
+        std::size_t maxRequestBodyBytes = 65536;
+        // Pre-rendered player responses each worker keeps for repeat requests.
+        std::size_t responseCacheEntries = 4096;
+        // Bodies shorter than this are sent uncompressed even when the client accepts gzip or zstd.
+        std::size_t compressMinBytes = 1024;
+        // Certificates, cipher preferences, session cache and ticket key rotation.
+        ServerTlsOptions tls;
+        // Fetched players are served from memory until their TTL runs out.
+        osrs::PlayerCacheOptions playerCache;
+        // Players kept fresh in the background; disabled unless it names players or tracks the most requested.
+        osrs::WatchlistOptions watchlist;
+        // Successful fetches are appended to this store; an empty path disables history.
+        osrs::HistoryStoreOptions history;
+    };
+
+    class Worker;
+
     class TcpServer
     {
         public:
-            TcpServer(std::string ip_address, int port, std::string caCertPath = "");
+            TcpServer(std::string ip_address, int port, std::string caCertPath = "", ServerOptions options = ServerOptions());
             ~TcpServer();
             void startListen();
-            
+
         private:
+            friend class Worker;
+
+            // Appends every server, cache and upstream metric in Prometheus text format.
+            void appendMetrics(std::string &out) const;
+
             std::string m_ip_address;
             int m_port;
-            int m_socket;
-            int m_new_socket;
-            long m_incomingMessage;
             struct sockaddr_in m_socketAddress;
-            unsigned int m_socketAddress_len;
+            ServerOptions m_options;
 
-            SSL_CTX *m_ssl_ctx;
-            SSL *m_ssl;
+            // Shared by every worker; only SSL_new() is called on its SSL_CTX after construction.
+            std::unique_ptr<ServerTlsContext> m_tls;
 
             std::string m_caCertPath;
-            
-            int startServer();
-            void closeServer();
-            void acceptConnection(int &new_socket);
-            std::string handleRequest(const std::string &request);
 
+            std::unique_ptr<osrs::HiscoreClient> m_hiscore;
+            std::unique_ptr<osrs::PlayerCache> m_playerCache;
+            std::unique_ptr<osrs::HistoryStore> m_history;
+            std::unique_ptr<TaskPool> m_upstream;
+            std::unique_ptr<osrs::PlayerService> m_players;
+            std::unique_ptr<osrs::Watchlist> m_watchlist; // null when disabled
+            std::vector<std::unique_ptr<Worker>> m_workers;
     };
 } // namespace https
 
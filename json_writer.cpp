@@ -0,0 +1,52 @@
+#include "json_writer.h"
+
+namespace osrs {
+
+char *writeJsonStringEscaped(char *out, std::string_view value)
+{
+    static const char kHex[] = "0123456789abcdef";
+
+    *out++ = '"';
+    for (char ch : value)
+    {
+        switch (ch)
+        {
+        case '\\':
+            out = writeRaw(out, "\\\\");
+            break;
+        case '"':
+            out = writeRaw(out, "\\\"");
+            break;
+        case '\b':
+            out = writeRaw(out, "\\b");
+            break;
+        case '\f':
+            out = writeRaw(out, "\\f");
+            break;
+        case '\n':
+            out = writeRaw(out, "\\n");
+            break;
+        case '\r':
+            out = writeRaw(out, "\\r");
+            break;
+        case '\t':
+            out = writeRaw(out, "\\t");
+            break;
+        default:
+            if (static_cast<unsigned char>(ch) < 0x20)
+            {
+                out = writeRaw(out, "\\u00");
+                *out++ = kHex[(static_cast<unsigned char>(ch) >> 4) & 0xf];
+                *out++ = kHex[static_cast<unsigned char>(ch) & 0xf];
+            }
+            else
+            {
+                *out++ = ch;
+            }
+        }
+    }
+    *out++ = '"';
+    return out;
+}
+
+} // namespace osrs
@@ -0,0 +1,137 @@
+#ifndef OSRS_JSON_WRITER_H
+#define OSRS_JSON_WRITER_H
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+// Serialization primitives for building responses in place.
+//
+// The write* functions emit through a raw cursor into space the caller has
+// already reserved, so a serializer sizes its output once and then runs
+// without capacity checks. The append* wrappers do the reservation
+// themselves for one-off values. Callers reuse their output strings between
+// responses; clear() keeps the capacity, so steady-state output allocates nothing.
+namespace osrs {
+
+// Digits and sign of the longest std::int64_t.
+constexpr std::size_t kMaxIntChars = 20;
+// The same for an int.
+constexpr std::size_t kMaxInt32Chars = 11;
+
+// Space writeJsonString may need for value, quotes included.
+inline std::size_t maxJsonStringSize(std::string_view value)
+{
+    return value.size() * 6 + 2;
+}
+
+inline char *writeRaw(char *out, std::string_view text)
+{
+    // A default string_view has a null data(), and memcpy from null is undefined even for no bytes.
+    if (!text.empty())
+    {
+        std::memcpy(out, text.data(), text.size());
+    }
+    return out + text.size();
+}
+
+namespace detail {
+    // "00" to "99", so digits are written two at a time.
+    constexpr char kDigitPairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+
+    inline std::size_t digitCount(std::uint32_t value)
+    {
+        if (value < 10000)
+        {
+            return value < 100 ? (value < 10 ? 1 : 2) : (value < 1000 ? 3 : 4);
+        }
+        if (value < 100000000)
+        {
+            return value < 1000000 ? (value < 100000 ? 5 : 6) : (value < 10000000 ? 7 : 8);
+        }
+        return value < 1000000000 ? 9 : 10;
+    }
+
+    // Fills the digits of value from the back, so the length is known up front.
+    inline char *writeUnsigned(char *out, std::uint32_t value)
+    {
+        const std::size_t digits = digitCount(value);
+        char *end = out + digits;
+        char *p = end;
+        while (value >= 100)
+        {
+            const std::uint32_t pair = (value % 100) * 2;
+            value /= 100;
+            *--p = kDigitPairs[pair + 1];
+            *--p = kDigitPairs[pair];
+        }
+        if (value >= 10)
+        {
+            *--p = kDigitPairs[value * 2 + 1];
+            *--p = kDigitPairs[value * 2];
+        }
+        else
+        {
+            *--p = static_cast<char>('0' + value);
+        }
+        return end;
+    }
+}
+
+// Hiscore numbers (ranks, levels, scores, experience up to 200M) all take the
+// 32-bit path; anything wider falls back to std::to_chars.
+inline char *writeInt(char *out, std::int64_t value)
+{
+    if (value < 0 && value > -std::int64_t(UINT32_MAX))
+    {
+        *out++ = '-';
+        return detail::writeUnsigned(out, static_cast<std::uint32_t>(-value));
+    }
+    if (value >= 0 && value <= std::int64_t(UINT32_MAX))
+    {
+        return detail::writeUnsigned(out, static_cast<std::uint32_t>(value));
+    }
+    return std::to_chars(out, out + kMaxIntChars, value).ptr;
+}
+
+char *writeJsonStringEscaped(char *out, std::string_view value);
+
+// Writes value as a quoted JSON string. Plain names have nothing to escape and are copied as-is.
+inline char *writeJsonString(char *out, std::string_view value)
+{
+    for (char ch : value)
+    {
+        if (static_cast<unsigned char>(ch) < 0x20 || ch == '"' || ch == '\\')
+        {
+            return writeJsonStringEscaped(out, value);
+        }
+    }
+    *out++ = '"';
+    out = writeRaw(out, value);
+    *out++ = '"';
+    return out;
+}
+
+inline void appendInt(std::string &out, std::int64_t value)
+{
+    char digits[kMaxIntChars];
+    out.append(digits, writeInt(digits, value));
+}
+
+inline void appendJsonString(std::string &out, std::string_view value)
+{
+    const std::size_t start = out.size();
+    out.resize(start + maxJsonStringSize(value));
+    char *end = writeJsonString(&out[start], value);
+    out.resize(static_cast<std::size_t>(end - out.data()));
+}
+
+} // namespace osrs
+
+#endif // OSRS_JSON_WRITER_H
@@ -0,0 +1,410 @@
+#include "logger.h"
+#include "json_writer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+    using https::LogField;
+    using https::LogLevel;
+    using https::kMaxLogFields;
+
+    // One buffered event. Fixed size and trivially copyable, so logging is a
+    // copy into a preallocated slot.
+    struct LogRecord
+    {
+        std::int64_t unixMicros;
+        const char *event;
+        LogLevel level;
+        std::uint8_t fieldCount;
+        std::uint8_t messageLength;
+        LogField fields[kMaxLogFields];
+        char message[112];
+    };
+
+    // Single-producer, single-consumer ring owned by one logging thread. The
+    // writer is the only consumer, and it drains under the state's drain mutex.
+    struct LogRing
+    {
+        LogRing(std::size_t capacity, std::uint64_t thread) : slots(capacity), thread(thread)
+        {
+        }
+
+        std::vector<LogRecord> slots;
+        const std::uint64_t thread; // registration order, printed as tid
+        alignas(64) std::atomic<std::uint64_t> head{0}; // next slot the producer fills
+        alignas(64) std::atomic<std::uint64_t> tail{0}; // next slot the writer reads
+        std::atomic<std::uint64_t> dropped{0};
+        // Calls so far per event name, so a burst of one event never samples away
+        // another. Names are literals, so this stays as small as the set of
+        // sampled call sites. Producer only.
+        std::unordered_map<const char *, std::size_t> sampleCounters;
+    };
+
+    struct LoggerState
+    {
+        // Until startLogger() runs, the option defaults apply.
+        std::atomic<int> level{static_cast<int>(https::LoggerOptions().level)};
+        std::atomic<std::size_t> sampleEvery{https::LoggerOptions().sampleEvery};
+        std::atomic<std::size_t> bufferEvents{https::LoggerOptions().bufferEvents};
+
+        // Guards rings; taken only when a thread logs for the first time and by drains.
+        std::mutex ringsMutex;
+        std::vector<std::shared_ptr<LogRing>> rings;
+
+        // Serializes drains, so each ring has one consumer at a time.
+        std::mutex drainMutex;
+        int fd = STDOUT_FILENO;
+        std::string batch;
+        std::uint64_t droppedReported = 0;
+        std::atomic<std::uint64_t> written{0};
+
+        std::mutex writerMutex;
+        std::condition_variable wake;
+        bool stopping = false;
+        int flushIntervalMs = 100;
+        std::thread writer;
+    };
+
+    // Never destroyed: threads still logging while exit() runs static
+    // destructors must find their rings intact. Whoever exits calls
+    // stopLogger() first, and the writer thread, if still running, dies with
+    // the process.
+    LoggerState &state()
+    {
+        static LoggerState *instance = new LoggerState;
+        return *instance;
+    }
+
+    LogRing &localRing()
+    {
+        thread_local std::shared_ptr<LogRing> mine = [] {
+            LoggerState &logger = state();
+            std::lock_guard<std::mutex> lock(logger.ringsMutex);
+            // A power of two, so a slot index is a mask rather than a division.
+            std::size_t capacity = 1;
+            while (capacity < std::max<std::size_t>(logger.bufferEvents.load(std::memory_order_relaxed), 2))
+            {
+                capacity <<= 1;
+            }
+            auto ring = std::make_shared<LogRing>(capacity, logger.rings.size());
+            logger.rings.push_back(ring);
+            return ring;
+        }();
+        return *mine;
+    }
+
+    void push(LogRing &ring, LogLevel level, const char *event, std::string_view message, std::initializer_list<LogField> fields)
+    {
+        const std::uint64_t head = ring.head.load(std::memory_order_relaxed);
+        if (head - ring.tail.load(std::memory_order_acquire) >= ring.slots.size())
+        {
+            ring.dropped.store(ring.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+
+        LogRecord &record = ring.slots[head & (ring.slots.size() - 1)];
+        record.unixMicros = std::chrono::duration_cast<std::chrono::microseconds>(
+                                std::chrono::system_clock::now().time_since_epoch())
+                                .count();
+        record.event = event;
+        record.level = level;
+        record.fieldCount = 0;
+        for (const LogField &field : fields)
+        {
+            if (record.fieldCount == kMaxLogFields)
+            {
+                break;
+            }
+            record.fields[record.fieldCount++] = field;
+        }
+        const std::size_t length = std::min(message.size(), sizeof(record.message));
+        std::memcpy(record.message, message.data(), length);
+        record.messageLength = static_cast<std::uint8_t>(length);
+
+        ring.head.store(head + 1, std::memory_order_release);
+    }
+
+    // 2026-10-17T09:30:00.123456Z
+    void appendTimestamp(std::string &out, std::int64_t unixMicros)
+    {
+        const std::time_t seconds = static_cast<std::time_t>(unixMicros / 1000000);
+        std::tm utc{};
+        gmtime_r(&seconds, &utc);
+        char text[32];
+        const std::size_t length = std::strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%S", &utc);
+        out.append(text, length);
+        const std::int64_t micros = unixMicros % 1000000;
+        out += '.';
+        for (std::int64_t scale = 100000; scale > 0; scale /= 10)
+        {
+            out += static_cast<char>('0' + (micros / scale) % 10);
+        }
+        out += 'Z';
+    }
+
+    // One logfmt line: timestamp, level, thread, event, fields, then the quoted message.
+    void appendRecord(std::string &out, const LogRecord &record, std::uint64_t thread)
+    {
+        appendTimestamp(out, record.unixMicros);
+        out += " level=";
+        out += https::logLevelName(record.level);
+        out += " tid=";
+        osrs::appendInt(out, static_cast<std::int64_t>(thread));
+        out += " event=";
+        out += record.event;
+        for (std::uint8_t i = 0; i < record.fieldCount; ++i)
+        {
+            out += ' ';
+            out += record.fields[i].key;
+            out += '=';
+            osrs::appendInt(out, record.fields[i].value);
+        }
+        if (record.messageLength > 0)
+        {
+            out += " msg=\"";
+            for (std::uint8_t i = 0; i < record.messageLength; ++i)
+            {
+                const char ch = record.message[i];
+                if (ch == '"' || ch == '\\')
+                {
+                    out += '\\';
+                    out += ch;
+                }
+                else if (ch == '\n')
+                {
+                    out += "\\n";
+                }
+                else if (static_cast<unsigned char>(ch) >= 0x20)
+                {
+                    out += ch;
+                }
+            }
+            out += '"';
+        }
+        out += '\n';
+    }
+
+    void writeAll(int fd, const std::string &data)
+    {
+        std::size_t offset = 0;
+        while (offset < data.size())
+        {
+            const ssize_t written = write(fd, data.data() + offset, data.size() - offset);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return; // nowhere left to report it
+            }
+            offset += static_cast<std::size_t>(written);
+        }
+    }
+
+    // Moves every buffered event into one write. Caller holds drainMutex.
+    void drainLocked(LoggerState &logger)
+    {
+        std::vector<std::shared_ptr<LogRing>> rings;
+        {
+            std::lock_guard<std::mutex> lock(logger.ringsMutex);
+            rings = logger.rings;
+        }
+
+        std::string &batch = logger.batch;
+        batch.clear();
+        std::uint64_t lines = 0;
+        std::uint64_t dropped = 0;
+        for (const auto &ring : rings)
+        {
+            // Rings are drained one after another, so lines from different threads can
+            // interleave out of time order within a batch; the timestamps are exact.
+            const std::uint64_t head = ring->head.load(std::memory_order_acquire);
+            std::uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+            for (; tail != head; ++tail)
+            {
+                appendRecord(batch, ring->slots[tail & (ring->slots.size() - 1)], ring->thread);
+                ++lines;
+            }
+            ring->tail.store(tail, std::memory_order_release);
+            dropped += ring->dropped.load(std::memory_order_relaxed);
+        }
+
+        if (dropped > logger.droppedReported)
+        {
+            LogRecord notice{};
+            notice.unixMicros = std::chrono::duration_cast<std::chrono::microseconds>(
+                                    std::chrono::system_clock::now().time_since_epoch())
+                                    .count();
+            notice.event = "log_dropped";
+            notice.level = LogLevel::Warn;
+            notice.fieldCount = 1;
+            notice.fields[0] = LogField{"count", static_cast<std::int64_t>(dropped - logger.droppedReported)};
+            appendRecord(batch, notice, 0);
+            ++lines;
+            logger.droppedReported = dropped;
+        }
+
+        if (!batch.empty())
+        {
+            writeAll(logger.fd, batch);
+            logger.written.fetch_add(lines, std::memory_order_relaxed);
+        }
+    }
+
+    void writerLoop()
+    {
+        LoggerState &logger = state();
+        std::unique_lock<std::mutex> lock(logger.writerMutex);
+        while (!logger.stopping)
+        {
+            logger.wake.wait_for(lock, std::chrono::milliseconds(logger.flushIntervalMs));
+            lock.unlock();
+            https::flushLog();
+            lock.lock();
+        }
+    }
+}
+
+namespace https
+{
+    const char *logLevelName(LogLevel level)
+    {
+        switch (level)
+        {
+        case LogLevel::Debug:
+            return "debug";
+        case LogLevel::Info:
+            return "info";
+        case LogLevel::Warn:
+            return "warn";
+        case LogLevel::Error:
+            return "error";
+        default:
+            return "off";
+        }
+    }
+
+    bool parseLogLevel(std::string_view text, LogLevel &level)
+    {
+        for (LogLevel candidate : {LogLevel::Debug, LogLevel::Info, LogLevel::Warn, LogLevel::Error, LogLevel::Off})
+        {
+            if (text == logLevelName(candidate))
+            {
+                level = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool startLogger(const LoggerOptions &options)
+    {
+        LoggerState &logger = state();
+        stopLogger();
+
+        int fd = STDOUT_FILENO;
+        if (!options.path.empty())
+        {
+            fd = open(options.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (fd < 0)
+            {
+                return false;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(logger.drainMutex);
+            if (logger.fd != STDOUT_FILENO)
+            {
+                close(logger.fd);
+            }
+            logger.fd = fd;
+        }
+        logger.level.store(static_cast<int>(options.level), std::memory_order_relaxed);
+        logger.sampleEvery.store(std::max<std::size_t>(options.sampleEvery, 1), std::memory_order_relaxed);
+        logger.bufferEvents.store(options.bufferEvents, std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> lock(logger.writerMutex);
+        logger.stopping = false;
+        logger.flushIntervalMs = std::max(options.flushIntervalMs, 1);
+        logger.writer = std::thread(writerLoop);
+        return true;
+    }
+
+    void stopLogger()
+    {
+        LoggerState &logger = state();
+        bool running;
+        {
+            std::lock_guard<std::mutex> lock(logger.writerMutex);
+            running = logger.writer.joinable();
+            logger.stopping = true;
+        }
+        if (running)
+        {
+            logger.wake.notify_all();
+            logger.writer.join();
+        }
+        flushLog();
+    }
+
+    void flushLog()
+    {
+        LoggerState &logger = state();
+        std::lock_guard<std::mutex> lock(logger.drainMutex);
+        drainLocked(logger);
+    }
+
+    bool logEnabled(LogLevel level)
+    {
+        return level != LogLevel::Off &&
+               static_cast<int>(level) >= state().level.load(std::memory_order_relaxed);
+    }
+
+    void logEvent(LogLevel level, const char *event, std::string_view message, std::initializer_list<LogField> fields)
+    {
+        if (logEnabled(level))
+        {
+            push(localRing(), level, event, message, fields);
+        }
+    }
+
+    void logSampled(LogLevel level, const char *event, std::string_view message, std::initializer_list<LogField> fields)
+    {
+        if (!logEnabled(level))
+        {
+            return;
+        }
+        LogRing &ring = localRing();
+        if (ring.sampleCounters[event]++ % state().sampleEvery.load(std::memory_order_relaxed) == 0)
+        {
+            push(ring, level, event, message, fields);
+        }
+    }
+
+    LogStats logStats()
+    {
+        LoggerState &logger = state();
+        LogStats stats{logger.written.load(std::memory_order_relaxed), 0};
+        std::lock_guard<std::mutex> lock(logger.ringsMutex);
+        for (const auto &ring : logger.rings)
+        {
+            stats.dropped += ring->dropped.load(std::memory_order_relaxed);
+        }
+        return stats;
+    }
+} // namespace https
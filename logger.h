@@ -0,0 +1,84 @@
+#ifndef INCLUDED_LOGGER
+#define INCLUDED_LOGGER
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+
+namespace https
+{
+    enum class LogLevel
+    {
+        Debug,
+        Info,
+        Warn,
+        Error,
+        Off
+    };
+
+    // Lower-case name used in log lines and HTTPS_LOG_LEVEL, e.g. "warn".
+    const char *logLevelName(LogLevel level);
+    // Accepts the names logLevelName() produces. Returns false, leaving level alone, otherwise.
+    bool parseLogLevel(std::string_view text, LogLevel &level);
+
+    struct LoggerOptions
+    {
+        // Events below this level are discarded before they are buffered.
+        LogLevel level = LogLevel::Info;
+        // Lines are appended to this file; empty writes them to stdout.
+        std::string path;
+        // Events one thread can buffer before the writer catches up. Events that
+        // do not fit are dropped and counted, never waited for.
+        std::size_t bufferEvents = 1024;
+        // logSampled() keeps one in this many of each event per thread; 1 keeps them all.
+        // Per-request lines use it, so by default one request in 100 is logged.
+        std::size_t sampleEvery = 100;
+        // How often the writer thread drains the buffers.
+        int flushIntervalMs = 100;
+    };
+
+    // A named integer attached to an event, e.g. {"status", 200}. key must outlive
+    // the logger, so pass a string literal.
+    struct LogField
+    {
+        const char *key;
+        std::int64_t value;
+    };
+
+    constexpr std::size_t kMaxLogFields = 4;
+
+    struct LogStats
+    {
+        std::uint64_t written; // lines handed to the output
+        std::uint64_t dropped; // events lost to a full buffer
+    };
+
+    // Starts the writer thread. Events logged before this are kept (up to each
+    // thread's buffer) and written once it runs. Returns false if path cannot be opened.
+    bool startLogger(const LoggerOptions &options);
+    // Stops the writer thread, if running, and writes whatever is still buffered.
+    // Call before the process exits; nothing flushes the log at exit on its own.
+    void stopLogger();
+    // Writes everything buffered so far from the calling thread, e.g. before exiting.
+    void flushLog();
+
+    bool logEnabled(LogLevel level);
+
+    // Buffers one event in the calling thread's ring: a clock read and a copy,
+    // no locks and no system calls. event names what happened and, like field
+    // keys, must be a string literal; message is copied and truncated to fit.
+    // Fields beyond kMaxLogFields are ignored.
+    void logEvent(LogLevel level, const char *event, std::string_view message = {},
+                  std::initializer_list<LogField> fields = {});
+    // Like logEvent, but only every LoggerOptions::sampleEvery-th call with the
+    // same event name on a thread is kept, starting with the first. For
+    // per-request events and failures that can arrive in floods.
+    void logSampled(LogLevel level, const char *event, std::string_view message = {},
+                    std::initializer_list<LogField> fields = {});
+
+    LogStats logStats();
+} // namespace https
+
+#endif
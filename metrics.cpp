@@ -0,0 +1,311 @@
+#include "metrics.h"
+#include "json_writer.h"
+
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+
+namespace {
+    using https::LatencyHistogram;
+    using https::kLatencyStageCount;
+
+    // One thread's histograms. Only that thread writes them, so an increment is
+    // a relaxed load and store rather than a locked read-modify-write; scrapes
+    // read them concurrently through the same atomics.
+    struct ThreadHistograms
+    {
+        std::atomic<std::uint64_t> buckets[kLatencyStageCount][LatencyHistogram::kBucketCount];
+        std::atomic<std::uint64_t> sumNanos[kLatencyStageCount];
+    };
+
+    // Histograms of every thread that has recorded anything. Threads here are
+    // long-lived, and the histograms of one that exits are kept, so nothing is lost.
+    struct Registry
+    {
+        std::mutex mutex;
+        std::vector<std::shared_ptr<ThreadHistograms>> threads;
+    };
+
+    Registry &registry()
+    {
+        static Registry instance;
+        return instance;
+    }
+
+    ThreadHistograms &localHistograms()
+    {
+        thread_local std::shared_ptr<ThreadHistograms> mine = [] {
+            // Value-initialized, so every counter starts at zero.
+            auto histograms = std::make_shared<ThreadHistograms>();
+            Registry &all = registry();
+            std::lock_guard<std::mutex> lock(all.mutex);
+            all.threads.push_back(histograms);
+            return histograms;
+        }();
+        return *mine;
+    }
+
+    void bump(std::atomic<std::uint64_t> &counter, std::uint64_t amount)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    // Bucket bounds of the exported Prometheus histograms, in seconds.
+    constexpr std::array<double, 19> kExportBounds = {0.00001, 0.000025, 0.00005, 0.0001, 0.00025, 0.0005, 0.001,
+                                                      0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+    constexpr std::array<std::pair<double, std::string_view>, 4> kExportQuantiles = {
+        {{0.5, "0.5"}, {0.9, "0.9"}, {0.99, "0.99"}, {0.999, "0.999"}}};
+}
+
+namespace https
+{
+    const char *latencyStageName(LatencyStage stage)
+    {
+        switch (stage)
+        {
+        case LatencyStage::Accept:
+            return "accept";
+        case LatencyStage::Handshake:
+            return "handshake";
+        case LatencyStage::Parse:
+            return "parse";
+        case LatencyStage::CacheLookup:
+            return "cache_lookup";
+        case LatencyStage::RenderLookup:
+            return "render_lookup";
+        case LatencyStage::UpstreamQueue:
+            return "upstream_queue";
+        case LatencyStage::UpstreamAcquire:
+            return "upstream_acquire";
+        case LatencyStage::UpstreamDns:
+            return "upstream_dns";
+        case LatencyStage::UpstreamConnect:
+            return "upstream_connect";
+        case LatencyStage::UpstreamTls:
+            return "upstream_tls";
+        case LatencyStage::UpstreamWrite:
+            return "upstream_write";
+        case LatencyStage::UpstreamTtfb:
+            return "upstream_ttfb";
+        case LatencyStage::UpstreamBody:
+            return "upstream_body";
+        case LatencyStage::ParseBody:
+            return "parse_body";
+        case LatencyStage::Serialize:
+            return "serialize";
+        case LatencyStage::Write:
+            return "write";
+        case LatencyStage::Request:
+            return "request";
+        default:
+            return "unknown";
+        }
+    }
+
+    LatencyStage latencyStageFor(UpstreamStage stage)
+    {
+        switch (stage)
+        {
+        case UpstreamStage::Queue:
+            return LatencyStage::UpstreamQueue;
+        case UpstreamStage::Acquire:
+            return LatencyStage::UpstreamAcquire;
+        case UpstreamStage::Dns:
+            return LatencyStage::UpstreamDns;
+        case UpstreamStage::Connect:
+            return LatencyStage::UpstreamConnect;
+        case UpstreamStage::Handshake:
+            return LatencyStage::UpstreamTls;
+        case UpstreamStage::Write:
+            return LatencyStage::UpstreamWrite;
+        case UpstreamStage::Ttfb:
+            return LatencyStage::UpstreamTtfb;
+        default:
+            return LatencyStage::UpstreamBody;
+        }
+    }
+
+    void recordLatency(LatencyStage stage, std::chrono::nanoseconds elapsed)
+    {
+        const std::uint64_t nanos = elapsed.count() > 0 ? static_cast<std::uint64_t>(elapsed.count()) : 0;
+        ThreadHistograms &mine = localHistograms();
+        const std::size_t index = static_cast<std::size_t>(stage);
+        bump(mine.buckets[index][LatencyHistogram::bucketFor(nanos)], 1);
+        bump(mine.sumNanos[index], nanos);
+    }
+
+    std::size_t LatencyHistogram::bucketFor(std::uint64_t nanos)
+    {
+        if (nanos < kSubBuckets)
+        {
+            return static_cast<std::size_t>(nanos);
+        }
+        // The top kSubBucketBits + 1 significant bits pick the bucket.
+        const std::size_t magnitude = 63 - static_cast<std::size_t>(__builtin_clzll(nanos));
+        const std::size_t shift = magnitude - kSubBucketBits;
+        const std::size_t index = (shift + 1) * kSubBuckets + static_cast<std::size_t>((nanos >> shift) & (kSubBuckets - 1));
+        return index < kBucketCount ? index : kBucketCount - 1;
+    }
+
+    std::uint64_t LatencyHistogram::bucketUpperBound(std::size_t i)
+    {
+        if (i < kSubBuckets)
+        {
+            return i + 1;
+        }
+        const std::size_t shift = i / kSubBuckets - 1;
+        const std::uint64_t lower = static_cast<std::uint64_t>(kSubBuckets + i % kSubBuckets) << shift;
+        return lower + (std::uint64_t(1) << shift);
+    }
+
+    std::uint64_t LatencyHistogram::quantile(double q) const
+    {
+        if (count == 0)
+        {
+            return 0;
+        }
+        const std::uint64_t rank = static_cast<std::uint64_t>(std::ceil(q * static_cast<double>(count)));
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < buckets.size(); ++i)
+        {
+            seen += buckets[i];
+            if (seen >= rank && seen > 0)
+            {
+                return bucketUpperBound(i);
+            }
+        }
+        return bucketUpperBound(buckets.size() - 1);
+    }
+
+    LatencyHistogram latencySnapshot(LatencyStage stage)
+    {
+        const std::size_t index = static_cast<std::size_t>(stage);
+        LatencyHistogram merged;
+        merged.buckets.assign(LatencyHistogram::kBucketCount, 0);
+
+        Registry &all = registry();
+        std::lock_guard<std::mutex> lock(all.mutex);
+        for (const auto &thread : all.threads)
+        {
+            for (std::size_t i = 0; i < LatencyHistogram::kBucketCount; ++i)
+            {
+                const std::uint64_t n = thread->buckets[index][i].load(std::memory_order_relaxed);
+                merged.buckets[i] += n;
+                merged.count += n;
+            }
+            merged.sumNanos += thread->sumNanos[index].load(std::memory_order_relaxed);
+        }
+        return merged;
+    }
+
+    void MetricsWriter::family(std::string_view name, std::string_view type, std::string_view help)
+    {
+        m_out += "# HELP ";
+        m_out += name;
+        m_out += ' ';
+        m_out += help;
+        m_out += "\n# TYPE ";
+        m_out += name;
+        m_out += ' ';
+        m_out += type;
+        m_out += '\n';
+    }
+
+    void MetricsWriter::sample(std::string_view name, std::string_view labels, std::uint64_t value)
+    {
+        m_out += name;
+        if (!labels.empty())
+        {
+            m_out += '{';
+            m_out += labels;
+            m_out += '}';
+        }
+        m_out += ' ';
+        osrs::appendInt(m_out, static_cast<std::int64_t>(value));
+        m_out += '\n';
+    }
+
+    void MetricsWriter::sample(std::string_view name, std::string_view labels, double value)
+    {
+        char text[32];
+        const int length = std::snprintf(text, sizeof(text), "%.9g", value);
+        m_out += name;
+        if (!labels.empty())
+        {
+            m_out += '{';
+            m_out += labels;
+            m_out += '}';
+        }
+        m_out += ' ';
+        m_out.append(text, static_cast<std::size_t>(length));
+        m_out += '\n';
+    }
+
+    void MetricsWriter::counter(std::string_view name, std::string_view help, std::uint64_t value)
+    {
+        family(name, "counter", help);
+        sample(name, {}, value);
+    }
+
+    void MetricsWriter::gauge(std::string_view name, std::string_view help, double value)
+    {
+        family(name, "gauge", help);
+        sample(name, {}, value);
+    }
+
+    void MetricsWriter::latencyHistograms()
+    {
+        std::array<LatencyHistogram, kLatencyStageCount> histograms;
+        for (std::size_t s = 0; s < kLatencyStageCount; ++s)
+        {
+            histograms[s] = latencySnapshot(static_cast<LatencyStage>(s));
+        }
+
+        family("osrs_stage_duration_seconds", "histogram", "Time spent in each step of serving a request.");
+        std::string labels;
+        for (std::size_t s = 0; s < kLatencyStageCount; ++s)
+        {
+            const LatencyHistogram &histogram = histograms[s];
+            const std::string stage = std::string("stage=\"") + latencyStageName(static_cast<LatencyStage>(s)) + "\"";
+
+            // A fine bucket is counted under the first exported bound it fits below entirely.
+            std::uint64_t cumulative = 0;
+            std::size_t bucket = 0;
+            for (double bound : kExportBounds)
+            {
+                const std::uint64_t boundNanos = static_cast<std::uint64_t>(bound * 1e9);
+                while (bucket < histogram.buckets.size() && LatencyHistogram::bucketUpperBound(bucket) <= boundNanos)
+                {
+                    cumulative += histogram.buckets[bucket++];
+                }
+                char le[16];
+                std::snprintf(le, sizeof(le), "%g", bound);
+                labels = stage + ",le=\"" + le + "\"";
+                sample("osrs_stage_duration_seconds_bucket", labels, cumulative);
+            }
+            sample("osrs_stage_duration_seconds_bucket", stage + ",le=\"+Inf\"", histogram.count);
+            sample("osrs_stage_duration_seconds_sum", stage, static_cast<double>(histogram.sumNanos) / 1e9);
+            sample("osrs_stage_duration_seconds_count", stage, histogram.count);
+        }
+
+        family("osrs_stage_duration_quantile_seconds", "gauge",
+               "Latency quantiles per step since start, from the full-resolution histograms (within 1/16).");
+        for (std::size_t s = 0; s < kLatencyStageCount; ++s)
+        {
+            const LatencyHistogram &histogram = histograms[s];
+            if (histogram.count == 0)
+            {
+                continue;
+            }
+            const std::string stage = std::string("stage=\"") + latencyStageName(static_cast<LatencyStage>(s)) + "\"";
+            for (const auto &quantile : kExportQuantiles)
+            {
+                labels = stage + ",quantile=\"" + std::string(quantile.second) + "\"";
+                sample("osrs_stage_duration_quantile_seconds", labels, static_cast<double>(histogram.quantile(quantile.first)) / 1e9);
+            }
+        }
+    }
+} // namespace https
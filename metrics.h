@@ -0,0 +1,113 @@
+#ifndef INCLUDED_METRICS
+#define INCLUDED_METRICS
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "upstream_timing.h"
+
+namespace https
+{
+    // Steps of serving a request whose latency is tracked. The Upstream* ones
+    // break down one hiscore fetch.
+    enum class LatencyStage
+    {
+        Accept,      // accept4() to the connection being registered
+        Handshake,   // accept to TLS handshake complete
+        Parse,       // the parser call that completed a request
+        CacheLookup, // player cache lookup
+        RenderLookup, // rendered-response cache lookup for a cached player
+        UpstreamQueue,
+        UpstreamAcquire,
+        UpstreamDns,
+        UpstreamConnect,
+        UpstreamTls,
+        UpstreamWrite,
+        UpstreamTtfb,
+        UpstreamBody,
+        ParseBody,   // hiscore CSV to PlayerSnapshot
+        Serialize,   // ToJson of a response body, one sample per document
+        Write,       // response queued to last byte written
+        Request,     // request parsed to last byte written
+        Count
+    };
+
+    constexpr std::size_t kLatencyStageCount = static_cast<std::size_t>(LatencyStage::Count);
+
+    const char *latencyStageName(LatencyStage stage);
+    // The histogram an upstream fetch stage is recorded in.
+    LatencyStage latencyStageFor(UpstreamStage stage);
+
+    // Adds one observation to the calling thread's histogram for stage. No
+    // locks and no shared writes: each thread owns its histograms, and only
+    // the first call on a thread registers them.
+    void recordLatency(LatencyStage stage, std::chrono::nanoseconds elapsed);
+
+    // Times a scope into one stage.
+    class LatencyTimer
+    {
+        public:
+            explicit LatencyTimer(LatencyStage stage) : m_stage(stage), m_start(std::chrono::steady_clock::now()) {}
+            ~LatencyTimer() { recordLatency(m_stage, std::chrono::steady_clock::now() - m_start); }
+
+            LatencyTimer(const LatencyTimer &) = delete;
+            LatencyTimer &operator=(const LatencyTimer &) = delete;
+
+        private:
+            LatencyStage m_stage;
+            std::chrono::steady_clock::time_point m_start;
+    };
+
+    // Every thread's histogram for one stage, merged. Buckets are log-linear
+    // (HDR style): 16 per power of two, so any value is within 1/16 of its bucket.
+    struct LatencyHistogram
+    {
+        static constexpr std::size_t kSubBucketBits = 4;
+        static constexpr std::size_t kSubBuckets = std::size_t(1) << kSubBucketBits;
+        // Up to 2^36 ns (about 69 s); longer observations land in the last bucket.
+        static constexpr std::size_t kBucketCount = (36 - kSubBucketBits + 1) * kSubBuckets;
+
+        std::vector<std::uint64_t> buckets;
+        std::uint64_t count = 0;
+        std::uint64_t sumNanos = 0;
+
+        static std::size_t bucketFor(std::uint64_t nanos);
+        // Smallest value that falls past bucket i.
+        static std::uint64_t bucketUpperBound(std::size_t i);
+
+        // Upper bound, in nanoseconds, of the bucket holding quantile q (0..1).
+        std::uint64_t quantile(double q) const;
+    };
+
+    // Merges the per-thread histograms of stage. Only scrapes pay for this.
+    LatencyHistogram latencySnapshot(LatencyStage stage);
+
+    // Appends Prometheus text exposition format.
+    class MetricsWriter
+    {
+        public:
+            explicit MetricsWriter(std::string &out) : m_out(out) {}
+
+            // The # HELP and # TYPE lines that precede a metric's samples.
+            void family(std::string_view name, std::string_view type, std::string_view help);
+            // labels is the inside of the braces, e.g. stage="dns", or empty.
+            void sample(std::string_view name, std::string_view labels, std::uint64_t value);
+            void sample(std::string_view name, std::string_view labels, double value);
+
+            // One family in one call: # HELP, # TYPE and a single unlabelled sample.
+            void counter(std::string_view name, std::string_view help, std::uint64_t value);
+            void gauge(std::string_view name, std::string_view help, double value);
+
+            // Every latency stage, as one histogram family plus a gauge family of quantiles.
+            void latencyHistograms();
+
+        private:
+            std::string &m_out;
+    };
+} // namespace https
+
+#endif
@@ -1,74 +1,133 @@
 #include "osrs_hiscore.h"
 #include "https_client.h"
+#include "json_writer.h"
+#include "metrics.h"
 
+#include <algorithm>
 #include <array>
 #include <cctype>
+#include <charconv>
+#include <cstring>
 #include <iomanip>
 #include <sstream>
-#include <stdexcept>
 
 namespace {
-    constexpr const char *kHost = "secure.runescape.com";
-    constexpr int kPort = 443;
     constexpr const char *kEndpoint = "/m=hiscore_oldschool/index_lite.ws";
 
-    const std::array<const char *, 24> kSkillOrder = {
-        "Overall",     "Attack",      "Defence",    "Strength",   "Hitpoints",
-        "Ranged",      "Prayer",      "Magic",      "Cooking",    "Woodcutting",
-        "Fletching",   "Fishing",     "Firemaking", "Crafting",   "Smithing",
-        "Mining",      "Herblore",    "Agility",    "Thieving",   "Slayer",
-        "Farming",     "Runecraft",   "Hunter",     "Construction"};
+    // ,"Attack":{"rank": for each skill; the first one written drops its comma.
+    constexpr std::string_view kSkillKeys[] = {
+#define OSRS_SKILL_KEY(name) ",\"" #name "\":{\"rank\":",
+        OSRS_SKILL_LIST(OSRS_SKILL_KEY)
+#undef OSRS_SKILL_KEY
+    };
 
-    std::string escapeJson(const std::string &value)
+    constexpr std::size_t kMaxSkillKeySize = [] {
+        std::size_t size = 0;
+        for (std::string_view key : kSkillKeys)
+        {
+            size = std::max(size, key.size());
+        }
+        return size;
+    }();
+
+    // Parses one CSV line into the next skill or activity slot.
+    void parseLine(std::string_view line, osrs::PlayerSnapshot &snapshot, std::size_t &skillIndex, std::size_t &activityIndex)
     {
-        std::ostringstream oss;
-        for (char ch : value)
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.remove_suffix(1);
+        }
+        if (line.empty())
+        {
+            return; // skip blank lines without advancing either index
+        }
+
+        // Skills are "rank,level,xp"; the activity and boss lines after them are "rank,score".
+        std::int64_t fields[3];
+        std::size_t count = 0;
+        const char *p = line.data();
+        const char *const end = line.data() + line.size();
+        bool valid = true;
+        while (valid && count < 3)
         {
-            switch (ch)
+            auto result = std::from_chars(p, end, fields[count]);
+            valid = result.ec == std::errc() && (result.ptr == end || *result.ptr == ',');
+            if (valid)
             {
-            case '\\':
-                oss << "\\\\";
-                break;
-            case '"':
-                oss << "\\\"";
-                break;
-            case '\b':
-                oss << "\\b";
-                break;
-            case '\f':
-                oss << "\\f";
-                break;
-            case '\n':
-                oss << "\\n";
-                break;
-            case '\r':
-                oss << "\\r";
-                break;
-            case '\t':
-                oss << "\\t";
-                break;
-            default:
-                if (static_cast<unsigned char>(ch) < 0x20)
+                ++count;
+                p = result.ptr;
+                if (p == end)
                 {
-                    oss << "\\u" << std::hex << std::setw(4) << std::setfill('0')
-                        << static_cast<int>(static_cast<unsigned char>(ch))
-                        << std::dec << std::setfill(' ');
-                }
-                else
-                {
-                    oss << ch;
+                    break;
                 }
+                ++p;
+            }
+        }
+        if (!valid)
+        {
+            return; // malformed line, try the next one without advancing the index
+        }
+
+        if (skillIndex < osrs::kSkillCount)
+        {
+            if (count < 3)
+            {
+                return;
             }
+            osrs::SkillStats &stats = snapshot.skills[skillIndex];
+            stats.rank = static_cast<int>(fields[0]);
+            stats.level = static_cast<int>(fields[1]);
+            stats.experience = fields[2];
+            snapshot.skillMask |= std::uint32_t(1) << skillIndex;
+            ++skillIndex;
+        }
+        else if (activityIndex < osrs::kMaxActivities && count >= 2)
+        {
+            osrs::ActivityStats &stats = snapshot.activities[activityIndex];
+            stats.rank = static_cast<int>(fields[0]);
+            stats.score = static_cast<int>(fields[1]);
+            ++activityIndex;
         }
-        return oss.str();
     }
 }
 
 namespace osrs {
 
-HiscoreClient::HiscoreClient(std::string caCertPath) : m_caCertPath(std::move(caCertPath)) {}
+HiscoreClient::HiscoreClient(std::string caCertPath, HiscoreClientOptions options)
+    : m_caCertPath(std::move(caCertPath)),
+      m_hostHeader(options.port == 443 ? options.host : options.host + ":" + std::to_string(options.port)),
+      m_pool(options.host, options.port, m_caCertPath, options.pool),
+      m_deadlineBudget(options.deadlineBudget),
+      m_guard(options.guard)
+{
+    for (auto &count : m_timeouts)
+    {
+        count.store(0);
+    }
+}
+
+void HiscoreClient::recordTimings(const https::UpstreamTimings &timings) const
+{
+    for (std::size_t i = 1; i < https::kUpstreamStageCount; ++i)
+    {
+        // Zero means the stage did not happen, e.g. no connect on a pooled connection.
+        if (timings.elapsed[i].count() > 0)
+        {
+            https::recordLatency(https::latencyStageFor(static_cast<https::UpstreamStage>(i)), timings.elapsed[i]);
+        }
+    }
+    if (timings.timedOut != https::UpstreamStage::None)
+    {
+        m_timeouts[static_cast<std::size_t>(timings.timedOut)].fetch_add(1, std::memory_order_relaxed);
+    }
+}
 
 PlayerSnapshot HiscoreClient::fetchPlayer(const std::string &playerName) const
+{
+    return fetchPlayer(playerName, std::chrono::steady_clock::now());
+}
+
+PlayerSnapshot HiscoreClient::fetchPlayer(const std::string &playerName, std::chrono::steady_clock::time_point submitted) const
 {
     PlayerSnapshot snapshot;
     snapshot.name = playerName;
@@ -85,54 +144,138 @@ PlayerSnapshot HiscoreClient::fetchPlayer(const std::string &playerName) const
         return snapshot;
     }
 
-    https::HttpsClient client(kHost, kPort, m_caCertPath);
-    if (!client.connectToServer())
-    {
-        snapshot.error = "Unable to connect to hiscore service";
-        return snapshot;
-    }
-
     std::ostringstream request;
     request << "GET " << kEndpoint << "?player=" << urlEncode(playerName)
             << " HTTP/1.1\r\n";
-    request << "Host: " << kHost << "\r\n";
+    request << "Host: " << m_hostHeader << "\r\n";
     request << "User-Agent: OSRS-Hiscore-Client/0.1\r\n";
-    request << "Connection: close\r\n\r\n";
+    request << "Connection: keep-alive\r\n\r\n";
+    const std::string requestText = request.str();
 
-    if (!client.sendRequest(request.str()))
+    // Recorded however the fetch ends, so slow failures show up in the latency stats too.
+    const auto deadline = submitted + m_deadlineBudget;
+    https::UpstreamTimings timings;
+    struct Recorder
     {
-        snapshot.error = "Failed to issue hiscore request";
-        return snapshot;
+        const HiscoreClient &client;
+        const https::UpstreamTimings &timings;
+        ~Recorder() { client.recordTimings(timings); }
+    } recorder{*this, timings};
+
+    const auto started = std::chrono::steady_clock::now();
+    timings[https::UpstreamStage::Queue] = std::chrono::duration_cast<std::chrono::microseconds>(started - submitted);
+    if (started >= deadline)
+    {
+        timings.timedOut = https::UpstreamStage::Queue;
+        return timedOut(snapshot, timings.timedOut);
     }
 
-    std::string response = client.receiveResponse();
-    if (response.empty())
+    // Waiting for a permit is part of Acquire, like waiting for a pool slot.
+    bool probe = false;
+    const https::UpstreamGuard::Admission admission = m_guard.acquire(deadline, probe);
+    const auto admitted = std::chrono::steady_clock::now();
+    timings[https::UpstreamStage::Acquire] = std::chrono::duration_cast<std::chrono::microseconds>(admitted - started);
+    if (admission == https::UpstreamGuard::Admission::CircuitOpen)
     {
-        snapshot.error = "Empty response from hiscore service";
+        snapshot.rejected = true;
+        snapshot.error = "Hiscore service is unavailable, try again shortly";
         return snapshot;
     }
-
-    const std::string separator = "\r\n\r\n";
-    const auto headerEnd = response.find(separator);
-    if (headerEnd == std::string::npos)
+    if (admission == https::UpstreamGuard::Admission::TimedOut)
     {
-        snapshot.error = "Malformed HTTP response";
-        return snapshot;
+        timings.timedOut = https::UpstreamStage::Acquire;
+        return timedOut(snapshot, timings.timedOut);
     }
 
-    std::string header = response.substr(0, headerEnd);
-    std::string body = response.substr(headerEnd + separator.size());
-
-    std::istringstream headerStream(header);
-    std::string httpVersion;
-    int statusCode = 0;
-    headerStream >> httpVersion >> statusCode;
-    if (!headerStream || statusCode == 0)
+    // Reports the outcome on every return below. 404 is a healthy answer; 429,
+    // 5xx, timeouts and connection failures mean the service is struggling.
+    struct Permit
     {
-        snapshot.error = "Failed to parse hiscore status";
-        return snapshot;
+        https::UpstreamGuard &guard;
+        const PlayerSnapshot &snapshot;
+        std::chrono::steady_clock::time_point admitted;
+        bool probe;
+        ~Permit()
+        {
+            const int status = snapshot.upstreamStatus;
+            const bool failed = status == 0 || status == 429 || status >= 500 || snapshot.timedOut != https::UpstreamStage::None;
+            guard.release(probe, failed, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - admitted));
+        }
+    } permit{m_guard, snapshot, admitted, probe};
+
+    // The body is parsed as it arrives instead of being collected first. Error
+    // answers have nothing worth parsing, so their bodies are only drained.
+    https::HttpResponse response;
+    HiscoreBodyParser parser(snapshot);
+    std::chrono::nanoseconds parseTime(0);
+    const https::BodySink parseChunk = [&response, &parser, &parseTime](std::string_view chunk) {
+        if (response.statusCode != 200)
+        {
+            return false;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        const bool wanted = parser.feed(chunk);
+        parseTime += std::chrono::steady_clock::now() - start;
+        return wanted;
+    };
+
+    bool received = false;
+    while (!received)
+    {
+        https::UpstreamPool::Lease lease = m_pool.acquire(deadline, &timings);
+        if (!lease)
+        {
+            if (timings.timedOut != https::UpstreamStage::None)
+            {
+                return timedOut(snapshot, timings.timedOut);
+            }
+            snapshot.error = "Unable to connect to hiscore service";
+            return snapshot;
+        }
+
+        lease->setDeadline(deadline);
+        if (!lease->sendRequest(requestText))
+        {
+            timings.add(lease->timings());
+            if (timings.timedOut != https::UpstreamStage::None)
+            {
+                return timedOut(snapshot, timings.timedOut);
+            }
+            if (lease.reused())
+            {
+                continue; // the server closed this pooled connection; try another
+            }
+            snapshot.error = "Failed to issue hiscore request";
+            return snapshot;
+        }
+
+        parser.reset(); // a retry starts over on a new connection
+        parseTime = std::chrono::nanoseconds(0);
+        const bool ok = lease->receiveResponse(response, parseChunk);
+        timings.add(lease->timings());
+        if (!ok)
+        {
+            if (timings.timedOut != https::UpstreamStage::None)
+            {
+                return timedOut(snapshot, timings.timedOut);
+            }
+            if (lease.reused())
+            {
+                continue;
+            }
+            snapshot.error = "Malformed HTTP response";
+            return snapshot;
+        }
+
+        if (response.keepAlive)
+        {
+            lease.keepAlive();
+        }
+        received = true;
     }
 
+    const int statusCode = response.statusCode;
+    snapshot.upstreamStatus = statusCode;
     if (statusCode == 404)
     {
         snapshot.error = "Player not found";
@@ -145,12 +288,16 @@ PlayerSnapshot HiscoreClient::fetchPlayer(const std::string &playerName) const
         return snapshot;
     }
 
-    snapshot = parseBody(playerName, body);
-    if (!snapshot.success && snapshot.error.empty())
-    {
-        snapshot.error = "Unable to parse hiscore payload";
-    }
+    const auto start = std::chrono::steady_clock::now();
+    parser.finish();
+    https::recordLatency(https::LatencyStage::ParseBody, parseTime + (std::chrono::steady_clock::now() - start));
+    return snapshot;
+}
 
+PlayerSnapshot &HiscoreClient::timedOut(PlayerSnapshot &snapshot, https::UpstreamStage stage)
+{
+    snapshot.timedOut = stage;
+    snapshot.error = std::string("Hiscore service did not answer in time (") + https::stageName(stage) + ")";
     return snapshot;
 }
 
@@ -180,94 +327,181 @@ std::string HiscoreClient::urlEncode(const std::string &value)
     return encoded.str();
 }
 
-PlayerSnapshot HiscoreClient::parseBody(const std::string &playerName, const std::string &body)
+bool HiscoreClient::parseBody(std::string_view body, PlayerSnapshot &snapshot)
 {
-    PlayerSnapshot snapshot;
-    snapshot.name = playerName;
+    HiscoreBodyParser parser(snapshot);
+    parser.feed(body);
+    return parser.finish();
+}
 
-    std::istringstream stream(body);
-    std::string line;
-    bool parsedAny = false;
+HiscoreBodyParser::HiscoreBodyParser(PlayerSnapshot &snapshot) : m_snapshot(snapshot)
+{
+    reset();
+}
 
-    std::size_t skillIndex = 0;
-    while (skillIndex < kSkillOrder.size() && std::getline(stream, line))
-    {
-        if (line.empty())
-        {
-            continue; // skip blank lines without advancing the skill index
-        }
+void HiscoreBodyParser::reset()
+{
+    m_snapshot.skillMask = 0;
+    m_snapshot.activityCount = 0;
+    m_skillIndex = 0;
+    m_activityIndex = 0;
+    m_partialSize = 0;
+    m_partialTooLong = false;
+}
 
-        std::istringstream lineStream(line);
-        std::string rankToken;
-        std::string levelToken;
-        std::string xpToken;
+void HiscoreBodyParser::keepPartial(std::string_view part)
+{
+    if (m_partialTooLong || part.size() > m_partial.size() - m_partialSize)
+    {
+        m_partialTooLong = true;
+        return;
+    }
+    std::memcpy(m_partial.data() + m_partialSize, part.data(), part.size());
+    m_partialSize += part.size();
+}
 
-        if (!std::getline(lineStream, rankToken, ',') || !std::getline(lineStream, levelToken, ',') ||
-            !std::getline(lineStream, xpToken, ','))
+bool HiscoreBodyParser::feed(std::string_view chunk)
+{
+    PlayerSnapshot &snapshot = m_snapshot;
+    std::size_t skillIndex = m_skillIndex;
+    std::size_t activityIndex = m_activityIndex;
+
+    // The line the last piece ended inside comes first, once this piece completes it.
+    std::string_view line;
+    bool haveLine = false;
+    if (m_partialSize > 0 || m_partialTooLong)
+    {
+        const std::size_t lineEnd = chunk.find('\n');
+        keepPartial(chunk.substr(0, lineEnd));
+        if (lineEnd == std::string_view::npos)
         {
-            continue; // malformed line, try the next one without advancing the index
+            return true;
         }
+        chunk.remove_prefix(lineEnd + 1);
+        haveLine = !m_partialTooLong;
+        line = std::string_view(m_partial.data(), m_partialSize);
+        m_partialSize = 0; // m_partial is not written again before line is parsed
+        m_partialTooLong = false;
+    }
 
-        try
-        {
-            SkillStats stats;
-            stats.rank = std::stoi(rankToken);
-            stats.level = std::stoi(levelToken);
-            stats.experience = std::stoll(xpToken);
-            snapshot.skills.emplace(kSkillOrder[skillIndex], stats);
-            parsedAny = true;
-        }
-        catch (const std::exception &)
+    while (true)
+    {
+        if (!haveLine)
         {
-            // Parsing failed; ignore this line and look for the next valid one.
-            continue;
+            const std::size_t lineEnd = chunk.find('\n');
+            if (lineEnd == std::string_view::npos)
+            {
+                keepPartial(chunk);
+                break;
+            }
+            line = chunk.substr(0, lineEnd);
+            chunk.remove_prefix(lineEnd + 1);
         }
-
-        ++skillIndex;
+        haveLine = false;
+        parseLine(line, snapshot, skillIndex, activityIndex);
     }
 
-    snapshot.success = parsedAny;
-    if (!parsedAny)
+    m_skillIndex = skillIndex;
+    m_activityIndex = activityIndex;
+    return skillIndex < kSkillCount || activityIndex < kMaxActivities;
+}
+
+bool HiscoreBodyParser::finish()
+{
+    if (m_partialSize > 0 && !m_partialTooLong)
     {
-        snapshot.error = "No skill data available";
+        feed("\n");
     }
+    m_partialSize = 0;
+    m_partialTooLong = false;
 
-    return snapshot;
+    m_snapshot.activityCount = static_cast<std::uint16_t>(m_activityIndex);
+    m_snapshot.success = m_snapshot.skillMask != 0;
+    if (!m_snapshot.success)
+    {
+        m_snapshot.error = "No skill data available";
+    }
+    return m_snapshot.success;
 }
 
-std::string ToJson(const PlayerSnapshot &snapshot)
+void ToJson(const PlayerSnapshot &snapshot, std::string &out)
 {
-    std::ostringstream json;
-    json << "{";
-    json << "\"name\":\"" << escapeJson(snapshot.name) << "\",";
-    json << "\"success\":" << (snapshot.success ? "true" : "false");
+    // Reserve for the longest possible document, write through a cursor, then trim.
+    std::size_t capacity = 64 + maxJsonStringSize(snapshot.name) + maxJsonStringSize(snapshot.error);
+    if (snapshot.success)
+    {
+        capacity += kSkillCount * (kMaxSkillKeySize + 24 + 2 * kMaxInt32Chars + kMaxIntChars) +
+                    snapshot.activityCount * (24 + 2 * kMaxInt32Chars);
+    }
+
+    const std::size_t start = out.size();
+    out.resize(start + capacity);
+    char *p = &out[start];
+
+    p = writeRaw(p, "{\"name\":");
+    p = writeJsonString(p, snapshot.name);
+    p = writeRaw(p, snapshot.success ? ",\"success\":true" : ",\"success\":false");
 
     if (!snapshot.success && !snapshot.error.empty())
     {
-        json << ",\"error\":\"" << escapeJson(snapshot.error) << "\"";
+        p = writeRaw(p, ",\"error\":");
+        p = writeJsonString(p, snapshot.error);
+    }
+    if (snapshot.timedOut != https::UpstreamStage::None)
+    {
+        // Machine-readable form of the error above: the stage that used up the deadline.
+        p = writeRaw(p, ",\"timeout\":\"");
+        p = writeRaw(p, https::stageName(snapshot.timedOut));
+        p = writeRaw(p, "\"");
     }
 
     if (snapshot.success)
     {
-        json << ",\"skills\":{";
-        std::size_t index = 0;
-        for (const auto &entry : snapshot.skills)
+        p = writeRaw(p, ",\"skills\":{");
+        bool first = true;
+        for (std::size_t i = 0; i < kSkillCount; ++i)
+        {
+            if (!snapshot.has(static_cast<Skill>(i)))
+            {
+                continue;
+            }
+            const SkillStats &stats = snapshot.skills[i];
+            p = writeRaw(p, kSkillKeys[i].substr(first ? 1 : 0));
+            first = false;
+            p = writeInt(p, stats.rank);
+            p = writeRaw(p, ",\"level\":");
+            p = writeInt(p, stats.level);
+            p = writeRaw(p, ",\"experience\":");
+            p = writeInt(p, stats.experience);
+            *p++ = '}';
+        }
+        *p++ = '}';
+
+        // Positional, in the order the hiscore service lists activities and bosses.
+        if (snapshot.activityCount > 0)
         {
-            if (index++ > 0)
+            p = writeRaw(p, ",\"activities\":[");
+            for (std::size_t i = 0; i < snapshot.activityCount; ++i)
             {
-                json << ',';
+                p = writeRaw(p, i > 0 ? ",{\"rank\":" : "{\"rank\":");
+                p = writeInt(p, snapshot.activities[i].rank);
+                p = writeRaw(p, ",\"score\":");
+                p = writeInt(p, snapshot.activities[i].score);
+                *p++ = '}';
             }
-            json << "\"" << escapeJson(entry.first) << "\":{";
-            json << "\"rank\":" << entry.second.rank << ',';
-            json << "\"level\":" << entry.second.level << ',';
-            json << "\"experience\":" << entry.second.experience;
-            json << "}";
+            *p++ = ']';
         }
-        json << "}";
     }
 
-    json << "}";
-    return json.str();
+    *p++ = '}';
+    out.resize(static_cast<std::size_t>(p - out.data()));
+}
+
+std::string ToJson(const PlayerSnapshot &snapshot)
+{
+    std::string json;
+    ToJson(snapshot, json);
+    return json;
 }
 
 } // namespace osrs
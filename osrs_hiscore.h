@@ -1,38 +1,165 @@
 #ifndef OSRS_HISCORE_H
 #define OSRS_HISCORE_H
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
-#include <map>
 #include <string>
+#include <string_view>
+
+#include "upstream_guard.h"
+#include "upstream_pool.h"
+#include "upstream_timing.h"
 
 namespace osrs {
 
+// Skills in the order the hiscore service lists them; Skill and kSkillOrder are both generated from it.
+#define OSRS_SKILL_LIST(X)                                                                          \
+    X(Overall) X(Attack) X(Defence) X(Strength) X(Hitpoints) X(Ranged) X(Prayer) X(Magic)            \
+    X(Cooking) X(Woodcutting) X(Fletching) X(Fishing) X(Firemaking) X(Crafting) X(Smithing)          \
+    X(Mining) X(Herblore) X(Agility) X(Thieving) X(Slayer) X(Farming) X(Runecraft) X(Hunter)         \
+    X(Construction)
+
+enum class Skill : std::uint8_t {
+#define OSRS_SKILL_ENUM(name) name,
+    OSRS_SKILL_LIST(OSRS_SKILL_ENUM)
+#undef OSRS_SKILL_ENUM
+    Count
+};
+
+constexpr std::size_t kSkillCount = static_cast<std::size_t>(Skill::Count);
+
+constexpr std::array<const char *, kSkillCount> kSkillOrder = {
+#define OSRS_SKILL_NAME(name) #name,
+    OSRS_SKILL_LIST(OSRS_SKILL_NAME)
+#undef OSRS_SKILL_NAME
+};
+
+// Activity and boss lines the hiscore service lists after the skills.
+constexpr std::size_t kListedActivities = 95;
+// The service appends new ones over time; this many more are kept before
+// later entries are ignored, so an addition shows up without a rebuild.
+constexpr std::size_t kActivityHeadroom = 8;
+constexpr std::size_t kMaxActivities = kListedActivities + kActivityHeadroom;
+
 struct SkillStats {
     int rank = -1;
     int level = 0;
     std::int64_t experience = 0;
 };
 
+struct ActivityStats {
+    int rank = -1;
+    int score = -1;
+};
+
+// Fixed layout indexed by Skill. A successful fetch allocates nothing here:
+// display names are at most 12 characters, inside std::string's inline buffer.
 struct PlayerSnapshot {
     std::string name;
     bool success = false;
     std::string error;
-    std::map<std::string, SkillStats> skills;
+    int upstreamStatus = 0; // HTTP status from the hiscore service, 0 if none was received
+    // The stage the fetch was in when its deadline ran out, or None.
+    https::UpstreamStage timedOut = https::UpstreamStage::None;
+    // Not sent upstream at all because the circuit breaker was open.
+    bool rejected = false;
+
+    std::uint32_t skillMask = 0; // bit i set when skills[i] was present in the response
+    std::array<SkillStats, kSkillCount> skills;
+    // Activities and bosses in hiscore order; activityCount of them were listed.
+    std::uint16_t activityCount = 0;
+    std::array<ActivityStats, kMaxActivities> activities;
+
+    bool has(Skill skill) const { return skillMask & (std::uint32_t(1) << static_cast<std::size_t>(skill)); }
+    const SkillStats &operator[](Skill skill) const { return skills[static_cast<std::size_t>(skill)]; }
 };
 
+static_assert(kSkillCount <= 32, "skillMask holds one bit per skill");
+
+// Fills a snapshot from a hiscore CSV body fed in pieces of any size as they
+// arrive. Complete lines are parsed straight out of each piece; only a line
+// split between two pieces is copied.
+class HiscoreBodyParser {
+public:
+    explicit HiscoreBodyParser(PlayerSnapshot &snapshot);
+
+    // Forgets everything parsed so far, clearing the skills and activities of the snapshot.
+    void reset();
+    // Parses every complete line in chunk. Returns false once the snapshot is
+    // full, which only happens if the service lists more than kMaxActivities
+    // activities; a normal body is read to its end.
+    bool feed(std::string_view chunk);
+    // Parses a last line that had no newline, then sets success, or error if
+    // no skill was found. Call once the body has ended or feed() returned false.
+    bool finish();
+
+private:
+    // Keeps the start of a line the current piece ends inside.
+    void keepPartial(std::string_view part);
+
+    PlayerSnapshot &m_snapshot;
+    std::size_t m_skillIndex;
+    std::size_t m_activityIndex;
+    // Valid lines are at most three numbers; one that does not fit here is skipped.
+    std::array<char, 128> m_partial;
+    std::size_t m_partialSize;
+    bool m_partialTooLong;
+};
+
+struct HiscoreClientOptions {
+    // The hiscore service. Pointed at tools/stub_hiscore (with its certificate
+    // as the CA bundle), everything runs offline.
+    std::string host = "secure.runescape.com";
+    int port = 443;
+    https::UpstreamPoolOptions pool;
+    // Each fetch gets this long end to end: queueing, DNS, connect, handshake, write and read.
+    std::chrono::milliseconds deadlineBudget = std::chrono::milliseconds(3000);
+    // Adaptive concurrency limit and circuit breaker in front of the pool.
+    https::UpstreamGuardOptions guard;
+};
+
+// Fetches players over a pool of keep-alive connections to the hiscore
+// service. One instance is meant to be shared by every thread.
 class HiscoreClient {
 public:
-    explicit HiscoreClient(std::string caCertPath);
+    explicit HiscoreClient(std::string caCertPath, HiscoreClientOptions options = HiscoreClientOptions());
 
+    // submitted is when the lookup was accepted; the budget counts from there,
+    // so time spent queued for an upstream thread is part of it.
+    PlayerSnapshot fetchPlayer(const std::string &playerName, std::chrono::steady_clock::time_point submitted) const;
     PlayerSnapshot fetchPlayer(const std::string &playerName) const;
 
-private:
+    // Fetches whose deadline ran out in stage.
+    std::uint64_t timeouts(https::UpstreamStage stage) const { return m_timeouts[static_cast<std::size_t>(stage)].load(std::memory_order_relaxed); }
+    // DNS and TLS session counters of the connection pool.
+    const https::UpstreamPool &pool() const { return m_pool; }
+    // Current concurrency limit and breaker state.
+    https::UpstreamGuard::Stats guardStats() const { return m_guard.stats(); }
+
+    // Percent-encodes a display name for the hiscore query string.
     static std::string urlEncode(const std::string &value);
-    static PlayerSnapshot parseBody(const std::string &playerName, const std::string &body);
+    // Fills the skills and activities of snapshot from a whole hiscore CSV body.
+    static bool parseBody(std::string_view body, PlayerSnapshot &snapshot);
+
+private:
+    // Feeds one fetch's stage times into the latency histograms and its timeout, if any, into m_timeouts.
+    void recordTimings(const https::UpstreamTimings &timings) const;
+    // Marks snapshot as having run out of time in stage.
+    static PlayerSnapshot &timedOut(PlayerSnapshot &snapshot, https::UpstreamStage stage);
 
     std::string m_caCertPath;
+    std::string m_hostHeader; // host, plus the port when it is not 443
+    mutable https::UpstreamPool m_pool;
+    std::chrono::milliseconds m_deadlineBudget;
+    mutable std::array<std::atomic<std::uint64_t>, https::kUpstreamStageCount> m_timeouts;
+    mutable https::UpstreamGuard m_guard;
 };
 
+// Appends the JSON form of snapshot to out, which callers can clear and reuse.
+void ToJson(const PlayerSnapshot &snapshot, std::string &out);
 std::string ToJson(const PlayerSnapshot &snapshot);
 
 } // namespace osrs
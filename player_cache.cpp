@@ -0,0 +1,173 @@
+#include "player_cache.h"
+
+#include <algorithm>
+#include <functional>
+
+namespace osrs {
+
+std::string normalizeName(std::string_view name)
+{
+    while (!name.empty() && (name.front() == ' ' || name.front() == '_' || name.front() == '-'))
+    {
+        name.remove_prefix(1);
+    }
+    while (!name.empty() && (name.back() == ' ' || name.back() == '_' || name.back() == '-'))
+    {
+        name.remove_suffix(1);
+    }
+
+    std::string key(name);
+    for (char &ch : key)
+    {
+        if (ch >= 'A' && ch <= 'Z')
+        {
+            ch = static_cast<char>(ch - 'A' + 'a');
+        }
+        else if (ch == '_' || ch == '-')
+        {
+            ch = ' ';
+        }
+    }
+    return key;
+}
+
+PlayerCache::PlayerCache(PlayerCacheOptions options)
+    : m_options(options),
+      m_retention(std::max(std::max(options.staleSeconds, options.graceSeconds), 0)),
+      m_shardCapacity(0),
+      m_shards(options.shards > 0 ? options.shards : 1)
+{
+    m_shardCapacity = m_options.capacity / m_shards.size();
+    if (m_shardCapacity == 0)
+    {
+        m_shardCapacity = 1;
+    }
+}
+
+PlayerCache::Shard &PlayerCache::shardFor(const std::string &key)
+{
+    return m_shards[std::hash<std::string>()(key) % m_shards.size()];
+}
+
+std::shared_ptr<const PlayerSnapshot> PlayerCache::find(const std::string &key, bool *needsRefresh)
+{
+    Shard &shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.index.find(key);
+    if (it == shard.index.end())
+    {
+        ++shard.misses;
+        return nullptr;
+    }
+
+    const Clock::time_point now = Clock::now();
+    if (now >= it->second->expires)
+    {
+        if (needsRefresh && it->second->snapshot->success && now < it->second->expires + std::chrono::seconds(m_options.graceSeconds))
+        {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            ++shard.hits;
+            ++shard.graceHits;
+            *needsRefresh = true;
+            return it->second->snapshot;
+        }
+
+        ++shard.misses;
+        // Successes stay around for the grace period and findStale() until both windows close.
+        if (!it->second->snapshot->success || now >= it->second->expires + m_retention)
+        {
+            auto entry = it->second;
+            shard.index.erase(it);
+            shard.lru.erase(entry);
+            ++shard.expirations;
+        }
+        return nullptr;
+    }
+
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    ++shard.hits;
+    return it->second->snapshot;
+}
+
+std::shared_ptr<const PlayerSnapshot> PlayerCache::findStale(const std::string &key)
+{
+    Shard &shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.index.find(key);
+    if (it == shard.index.end() || !it->second->snapshot->success ||
+        Clock::now() >= it->second->expires + std::chrono::seconds(m_options.staleSeconds))
+    {
+        return nullptr;
+    }
+    return it->second->snapshot;
+}
+
+bool PlayerCache::expiresWithin(const std::string &key, std::chrono::steady_clock::duration horizon)
+{
+    Shard &shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.index.find(key);
+    return it == shard.index.end() || Clock::now() + horizon >= it->second->expires;
+}
+
+void PlayerCache::insert(const std::string &key, std::shared_ptr<const PlayerSnapshot> snapshot)
+{
+    int ttlSeconds = 0;
+    if (snapshot->success)
+    {
+        ttlSeconds = m_options.ttlSeconds;
+    }
+    else if (snapshot->upstreamStatus == 404)
+    {
+        ttlSeconds = m_options.negativeTtlSeconds;
+    }
+    if (ttlSeconds <= 0)
+    {
+        return; // connection errors and 5xx answers should be retried, not remembered
+    }
+
+    const Clock::time_point expires = Clock::now() + std::chrono::seconds(ttlSeconds);
+
+    Shard &shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.index.find(key);
+    if (it != shard.index.end())
+    {
+        it->second->snapshot = std::move(snapshot);
+        it->second->expires = expires;
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        return;
+    }
+
+    if (shard.lru.size() >= m_shardCapacity)
+    {
+        shard.index.erase(shard.lru.back().key);
+        shard.lru.pop_back();
+        ++shard.evictions;
+    }
+
+    shard.lru.push_front(Entry{key, std::move(snapshot), expires});
+    shard.index.emplace(shard.lru.front().key, shard.lru.begin());
+}
+
+PlayerCache::Stats PlayerCache::stats() const
+{
+    Stats stats{};
+    for (const Shard &shard : m_shards)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        stats.hits += shard.hits;
+        stats.misses += shard.misses;
+        stats.evictions += shard.evictions;
+        stats.expirations += shard.expirations;
+        stats.graceHits += shard.graceHits;
+        stats.entries += shard.lru.size();
+    }
+    return stats;
+}
+
+} // namespace osrs
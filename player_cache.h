@@ -0,0 +1,110 @@
+#ifndef OSRS_PLAYER_CACHE_H
+#define OSRS_PLAYER_CACHE_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "osrs_hiscore.h"
+
+namespace osrs {
+
+struct PlayerCacheOptions {
+    // Independent LRU shards; each has its own lock.
+    std::size_t shards = 16;
+    // Entries across all shards.
+    std::size_t capacity = 10000;
+    // Hiscores only change every few minutes.
+    int ttlSeconds = 60;
+    // "Player not found" answers are kept for less time, in case the name appears.
+    int negativeTtlSeconds = 10;
+    // Successful entries this far past their TTL are still served straight
+    // away while a background fetch refreshes them (0 disables).
+    int graceSeconds = 30;
+    // Expired players are kept this much longer, to be served if the hiscore
+    // service fails while they are being refreshed (0 disables).
+    int staleSeconds = 600;
+};
+
+// Canonical cache key for a display name: trimmed, ASCII-lowercased, with '_'
+// and '-' treated as spaces, the way the hiscores treat them.
+std::string normalizeName(std::string_view name);
+
+// Bounded, sharded LRU cache of fetched players with per-entry expiry.
+// Safe to use from any thread.
+class PlayerCache {
+public:
+    struct Stats {
+        std::uint64_t hits;
+        std::uint64_t misses;
+        std::uint64_t evictions; // dropped to make room
+        std::uint64_t expirations;
+        std::uint64_t graceHits; // hits on entries past their TTL, inside the grace period
+        std::size_t entries;
+    };
+
+    explicit PlayerCache(PlayerCacheOptions options = PlayerCacheOptions());
+
+    PlayerCache(const PlayerCache &) = delete;
+    PlayerCache &operator=(const PlayerCache &) = delete;
+
+    // The fresh entry for a normalized key, or nullptr. Given needsRefresh, a
+    // successful entry in its grace period is returned too, and *needsRefresh
+    // tells the caller to fetch a new one.
+    std::shared_ptr<const PlayerSnapshot> find(const std::string &key, bool *needsRefresh = nullptr);
+
+    // A successful entry, fresh or past its TTL but inside the stale window, or
+    // nullptr. For when a fresh fetch has failed, or to learn the display name
+    // an entry was fetched under; does not count as a hit or miss.
+    std::shared_ptr<const PlayerSnapshot> findStale(const std::string &key);
+
+    // True if key is missing or its entry expires within horizon. Does not count
+    // as a hit or miss, nor make the entry more recently used.
+    bool expiresWithin(const std::string &key, std::chrono::steady_clock::duration horizon);
+
+    // Stores a fetch result. Successes and "not found" answers are cached with
+    // their own TTLs; transient failures are not cached at all.
+    void insert(const std::string &key, std::shared_ptr<const PlayerSnapshot> snapshot);
+
+    Stats stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        std::string key;
+        std::shared_ptr<const PlayerSnapshot> snapshot;
+        Clock::time_point expires;
+    };
+
+    // Each shard sits on its own cache lines so locking one does not slow its neighbours.
+    struct alignas(64) Shard {
+        mutable std::mutex mutex;
+        std::list<Entry> lru; // most recently used first
+        std::unordered_map<std::string_view, std::list<Entry>::iterator> index; // keys view into lru entries
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        std::uint64_t evictions = 0;
+        std::uint64_t expirations = 0;
+        std::uint64_t graceHits = 0;
+    };
+
+    Shard &shardFor(const std::string &key);
+
+    PlayerCacheOptions m_options;
+    // Successes are kept this long past their TTL, for the grace and stale windows.
+    std::chrono::seconds m_retention;
+    std::size_t m_shardCapacity;
+    std::vector<Shard> m_shards;
+};
+
+} // namespace osrs
+
+#endif // OSRS_PLAYER_CACHE_H
@@ -0,0 +1,258 @@
+#include "player_service.h"
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+
+namespace osrs {
+
+struct PlayerService::Batch {
+    std::vector<std::string> names;
+    std::vector<std::string> keys;
+    std::vector<std::size_t> misses; // indexes into names that were not cached
+    BatchCallback done;
+
+    std::mutex mutex;
+    std::vector<std::shared_ptr<const PlayerSnapshot>> results;
+    std::size_t nextMiss = 0;
+    std::size_t outstanding = 0;
+};
+
+PlayerService::PlayerService(const HiscoreClient &client, PlayerCache &cache, https::TaskPool &pool, HistoryStore *history)
+    : m_client(client), m_cache(cache), m_pool(pool), m_history(history), m_fetches(0), m_coalesced(0), m_staleServed(0),
+      m_revalidations(0)
+{
+}
+
+std::shared_ptr<const PlayerSnapshot> PlayerService::cached(const std::string &key)
+{
+    bool needsRefresh = false;
+    std::shared_ptr<const PlayerSnapshot> hit = m_cache.find(key, &needsRefresh);
+    if (needsRefresh)
+    {
+        revalidate(key, hit->name);
+    }
+    return hit;
+}
+
+void PlayerService::revalidate(const std::string &key, const std::string &playerName)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_inFlight.emplace(key, Flight()).second)
+        {
+            return; // already being fetched; the entry is replaced when that finishes
+        }
+        ++m_fetches;
+        ++m_revalidations;
+    }
+
+    // The snapshot carries the name it was fetched under; refetching under the
+    // same one keeps the rendered body, and so its ETag, unchanged.
+    const auto submitted = std::chrono::steady_clock::now();
+    m_pool.submit([this, key, playerName, submitted]() { fetchAndComplete(key, playerName, submitted); });
+}
+
+void PlayerService::lookupAsync(const std::string &playerName, Callback done)
+{
+    const std::string key = normalizeName(playerName);
+    if (auto hit = cached(key))
+    {
+        done(std::move(hit));
+        return;
+    }
+
+    fetchAsync(key, playerName, std::move(done));
+}
+
+void PlayerService::fetchAsync(const std::string &key, const std::string &playerName, Callback done)
+{
+    if (!join(key, std::move(done)))
+    {
+        return;
+    }
+
+    // The deadline budget starts now, so a long pool queue eats into it rather than adding to it.
+    const auto submitted = std::chrono::steady_clock::now();
+    m_pool.submit([this, key, playerName, submitted]() { fetchAndComplete(key, playerName, submitted); });
+}
+
+void PlayerService::lookupManyAsync(std::vector<std::string> names, std::size_t parallelism, BatchCallback done)
+{
+    auto batch = std::make_shared<Batch>();
+    batch->keys.reserve(names.size());
+    batch->results.resize(names.size());
+    for (std::size_t i = 0; i < names.size(); ++i)
+    {
+        batch->keys.push_back(normalizeName(names[i]));
+        batch->results[i] = cached(batch->keys[i]);
+        if (!batch->results[i])
+        {
+            batch->misses.push_back(i);
+        }
+    }
+    batch->names = std::move(names);
+
+    if (batch->misses.empty())
+    {
+        // Still not inline: a large batch takes a while to serialize, and the caller may be an event loop.
+        m_pool.submit([batch, done = std::move(done)]() { done(std::move(batch->results)); });
+        return;
+    }
+
+    batch->done = std::move(done);
+    startBatch(batch, parallelism);
+}
+
+void PlayerService::refreshManyAsync(std::vector<std::string> names, std::size_t parallelism)
+{
+    if (names.empty())
+    {
+        return;
+    }
+
+    auto batch = std::make_shared<Batch>();
+    batch->keys.reserve(names.size());
+    batch->results.resize(names.size());
+    batch->misses.reserve(names.size());
+    for (std::size_t i = 0; i < names.size(); ++i)
+    {
+        batch->keys.push_back(normalizeName(names[i]));
+        if (auto current = m_cache.findStale(batch->keys[i]))
+        {
+            names[i] = current->name;
+        }
+        batch->misses.push_back(i);
+    }
+    batch->names = std::move(names);
+    batch->done = [](std::vector<std::shared_ptr<const PlayerSnapshot>>) {};
+    startBatch(batch, parallelism);
+}
+
+void PlayerService::startBatch(const std::shared_ptr<Batch> &batch, std::size_t parallelism)
+{
+    batch->outstanding = batch->misses.size();
+    const std::size_t window = std::min(std::max<std::size_t>(parallelism, 1), batch->misses.size());
+    {
+        // Claimed before the first fetch starts, since its completion may already pick the next miss.
+        std::lock_guard<std::mutex> lock(batch->mutex);
+        batch->nextMiss = window;
+    }
+    for (std::size_t i = 0; i < window; ++i)
+    {
+        fetchBatchMember(batch, batch->misses[i]);
+    }
+}
+
+void PlayerService::fetchBatchMember(const std::shared_ptr<Batch> &batch, std::size_t index)
+{
+    fetchAsync(batch->keys[index], batch->names[index], [this, batch, index](std::shared_ptr<const PlayerSnapshot> snapshot) {
+        bool finished = false;
+        bool launch = false;
+        std::size_t next = 0;
+        {
+            std::lock_guard<std::mutex> lock(batch->mutex);
+            batch->results[index] = std::move(snapshot);
+            finished = --batch->outstanding == 0;
+            if (batch->nextMiss < batch->misses.size())
+            {
+                next = batch->misses[batch->nextMiss++];
+                launch = true;
+            }
+        }
+
+        if (launch)
+        {
+            fetchBatchMember(batch, next);
+        }
+        if (finished)
+        {
+            batch->done(std::move(batch->results));
+        }
+    });
+}
+
+std::shared_ptr<const PlayerSnapshot> PlayerService::lookup(const std::string &playerName)
+{
+    const std::string key = normalizeName(playerName);
+    if (auto hit = cached(key))
+    {
+        return hit;
+    }
+
+    std::promise<std::shared_ptr<const PlayerSnapshot>> result;
+    auto future = result.get_future();
+    if (join(key, [&result](std::shared_ptr<const PlayerSnapshot> snapshot) { result.set_value(std::move(snapshot)); }))
+    {
+        // Leader: fetch right here rather than parking this thread behind the pool.
+        return fetchAndComplete(key, playerName, std::chrono::steady_clock::now());
+    }
+
+    return future.get();
+}
+
+PlayerService::Stats PlayerService::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return Stats{m_fetches, m_coalesced, m_staleServed, m_revalidations, m_inFlight.size()};
+}
+
+bool PlayerService::join(const std::string &key, Callback done)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_inFlight.find(key);
+    if (it != m_inFlight.end())
+    {
+        it->second.waiters.push_back(std::move(done));
+        ++m_coalesced;
+        return false;
+    }
+
+    m_inFlight[key].waiters.push_back(std::move(done));
+    ++m_fetches;
+    return true;
+}
+
+std::shared_ptr<const PlayerSnapshot> PlayerService::fetchAndComplete(const std::string &key, const std::string &playerName,
+                                                                    std::chrono::steady_clock::time_point submitted)
+{
+    std::shared_ptr<const PlayerSnapshot> snapshot = std::make_shared<const PlayerSnapshot>(m_client.fetchPlayer(playerName, submitted));
+
+    if (snapshot->success || snapshot->upstreamStatus == 404)
+    {
+        // Cache first, so a lookup that misses the flight below finds the result instead of fetching again.
+        m_cache.insert(key, snapshot);
+
+        if (m_history && snapshot->success)
+        {
+            const auto now = std::chrono::system_clock::now().time_since_epoch();
+            m_history->append(key, *snapshot, std::chrono::duration_cast<std::chrono::seconds>(now).count());
+        }
+    }
+    else if (auto stale = m_cache.findStale(key))
+    {
+        // The hiscore service is failing, slow or shed by the breaker: slightly old data beats an error.
+        snapshot = std::move(stale);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_staleServed;
+    }
+
+    std::vector<Callback> waiters;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_inFlight.find(key);
+        if (it != m_inFlight.end())
+        {
+            waiters.swap(it->second.waiters);
+            m_inFlight.erase(it);
+        }
+    }
+
+    for (auto &waiter : waiters)
+    {
+        waiter(snapshot);
+    }
+    return snapshot;
+}
+
+} // namespace osrs
@@ -0,0 +1,106 @@
+#ifndef OSRS_PLAYER_SERVICE_H
+#define OSRS_PLAYER_SERVICE_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "history_store.h"
+#include "osrs_hiscore.h"
+#include "player_cache.h"
+#include "task_pool.h"
+
+namespace osrs {
+
+// Player lookups through the cache with single-flight deduplication: while
+// one upstream fetch for a name is running, later requests for the same name
+// wait for its result instead of issuing their own.
+class PlayerService {
+public:
+    using Callback = std::function<void(std::shared_ptr<const PlayerSnapshot>)>;
+    using BatchCallback = std::function<void(std::vector<std::shared_ptr<const PlayerSnapshot>>)>;
+
+    struct Stats {
+        std::uint64_t fetches;   // upstream fetches started
+        std::uint64_t coalesced; // lookups that joined a fetch already in flight
+        std::uint64_t staleServed; // failed fetches answered with an expired cache entry instead
+        std::uint64_t revalidations; // background fetches started for entries served in their grace period
+        std::size_t inFlight;
+    };
+
+    // When history is set, every successful fetch is also recorded there.
+    PlayerService(const HiscoreClient &client, PlayerCache &cache, https::TaskPool &pool, HistoryStore *history = nullptr);
+
+    PlayerService(const PlayerService &) = delete;
+    PlayerService &operator=(const PlayerService &) = delete;
+
+    // The cache entry for a normalized key, or nullptr. Never blocks on
+    // upstream: an entry in its grace period is returned as is while a
+    // background fetch replaces it.
+    std::shared_ptr<const PlayerSnapshot> cached(const std::string &key);
+
+    // For event loops: done runs inline on a cache hit, otherwise on the pool
+    // thread that completes the fetch.
+    void lookupAsync(const std::string &playerName, Callback done);
+
+    // The second half of lookupAsync, for callers that already missed the
+    // cache under key: joins or starts the fetch without checking it again.
+    void fetchAsync(const std::string &key, const std::string &playerName, Callback done);
+
+    // Looks up every name, running at most `parallelism` upstream fetches for
+    // this batch at once. done receives the players in the order of names,
+    // never inline: on a pool thread if all of them were cached, otherwise on
+    // the thread that completes the last fetch.
+    void lookupManyAsync(std::vector<std::string> names, std::size_t parallelism, BatchCallback done);
+
+    // Fetches every player again, cached or not, at most `parallelism` at
+    // once. Players already being fetched join that fetch. A cached player
+    // keeps the display name it was cached under. For prefetching.
+    void refreshManyAsync(std::vector<std::string> names, std::size_t parallelism);
+
+    // For thread-per-request callers: blocks until the player is available,
+    // fetching on the calling thread if nobody else is already doing so.
+    std::shared_ptr<const PlayerSnapshot> lookup(const std::string &playerName);
+
+    Stats stats() const;
+
+private:
+    struct Flight {
+        std::vector<Callback> waiters;
+    };
+    struct Batch;
+
+    // Registers done against the flight for key. Returns true if the caller
+    // became the leader and must run the fetch.
+    bool join(const std::string &key, Callback done);
+    std::shared_ptr<const PlayerSnapshot> fetchAndComplete(const std::string &key, const std::string &playerName,
+                                                           std::chrono::steady_clock::time_point submitted);
+    // Starts fetching a batch's misses, a window of `parallelism` at a time.
+    void startBatch(const std::shared_ptr<Batch> &batch, std::size_t parallelism);
+    // Fetches one cache miss of a batch; its completion starts the next one.
+    void fetchBatchMember(const std::shared_ptr<Batch> &batch, std::size_t index);
+    // Starts a background fetch for key, under the display name of the entry
+    // being replaced, unless one is already running.
+    void revalidate(const std::string &key, const std::string &playerName);
+
+    const HiscoreClient &m_client;
+    PlayerCache &m_cache;
+    https::TaskPool &m_pool;
+    HistoryStore *m_history;
+
+    mutable std::mutex m_mutex;
+    std::unordered_map<std::string, Flight> m_inFlight;
+    std::uint64_t m_fetches;
+    std::uint64_t m_coalesced;
+    std::uint64_t m_staleServed;
+    std::uint64_t m_revalidations;
+};
+
+} // namespace osrs
+
+#endif // OSRS_PLAYER_SERVICE_H
@@ -0,0 +1,45 @@
+#include "response_cache.h"
+
+namespace https
+{
+    ResponseCache::ResponseCache(std::size_t capacity) : m_capacity(capacity > 0 ? capacity : 1),
+                                                         m_hits(0),
+                                                         m_renders(0)
+    {
+    }
+
+    std::shared_ptr<const RenderedResponse> ResponseCache::find(const std::string &key, const osrs::PlayerSnapshot *snapshot)
+    {
+        auto it = m_index.find(key);
+        if (it == m_index.end() || it->second->response->snapshot.get() != snapshot)
+        {
+            return nullptr;
+        }
+
+        m_lru.splice(m_lru.begin(), m_lru, it->second);
+        m_hits.store(m_hits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return it->second->response;
+    }
+
+    void ResponseCache::insert(const std::string &key, std::shared_ptr<const RenderedResponse> response)
+    {
+        m_renders.store(m_renders.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+        auto it = m_index.find(key);
+        if (it != m_index.end())
+        {
+            it->second->response = std::move(response);
+            m_lru.splice(m_lru.begin(), m_lru, it->second);
+            return;
+        }
+
+        if (m_lru.size() >= m_capacity)
+        {
+            m_index.erase(m_lru.back().key);
+            m_lru.pop_back();
+        }
+
+        m_lru.push_front(Entry{key, std::move(response)});
+        m_index.emplace(m_lru.front().key, m_lru.begin());
+    }
+} // namespace https
@@ -0,0 +1,90 @@
+#ifndef INCLUDED_RESPONSE_CACHE
+#define INCLUDED_RESPONSE_CACHE
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "compression.h"
+#include "osrs_hiscore.h"
+
+namespace https
+{
+    // A player response rendered once and then served as-is until the
+    // snapshot it came from is replaced.
+    struct RenderedResponse
+    {
+        // The body in one content coding, with its own validator and framing.
+        struct Variant
+        {
+            std::string etag;    // quoted strong validator; differs per coding, empty unless the status is 200
+            std::string headers; // ETag, Cache-Control, Vary and Content-Encoding lines, each ending in CRLF
+            std::string body;    // empty when this coding was not produced
+            // Complete keep-alive responses, written straight from here without copying.
+            std::string full;
+            std::string notModified; // only for a 200
+        };
+
+        // The snapshot these bytes were rendered from. A cache returning a different one means they are stale.
+        std::shared_ptr<const osrs::PlayerSnapshot> snapshot;
+        int statusCode = 200;
+        // Indexed by ContentEncoding. Identity is always there; the others only
+        // when the build supports them and the body was worth compressing.
+        std::array<Variant, kContentEncodingCount> variants;
+
+        const Variant &variantFor(ContentEncoding encoding) const
+        {
+            const Variant &variant = variants[static_cast<std::size_t>(encoding)];
+            return variant.body.empty() ? variants[static_cast<std::size_t>(ContentEncoding::Identity)] : variant;
+        }
+    };
+
+    // Rendered responses keyed by normalized player name, least recently used
+    // evicted first. Not thread-safe: each worker owns one. Only stats() may be
+    // called from other threads.
+    class ResponseCache
+    {
+        public:
+            struct Stats
+            {
+                std::uint64_t hits;
+                std::uint64_t renders;
+            };
+
+            explicit ResponseCache(std::size_t capacity);
+
+            ResponseCache(const ResponseCache &) = delete;
+            ResponseCache &operator=(const ResponseCache &) = delete;
+
+            // The entry for key if it was rendered from exactly this snapshot, or nullptr.
+            std::shared_ptr<const RenderedResponse> find(const std::string &key, const osrs::PlayerSnapshot *snapshot);
+            void insert(const std::string &key, std::shared_ptr<const RenderedResponse> response);
+
+            Stats stats() const
+            {
+                return Stats{m_hits.load(std::memory_order_relaxed), m_renders.load(std::memory_order_relaxed)};
+            }
+
+        private:
+            struct Entry
+            {
+                std::string key;
+                std::shared_ptr<const RenderedResponse> response;
+            };
+
+            std::size_t m_capacity;
+            std::list<Entry> m_lru; // most recently used first
+            std::unordered_map<std::string_view, std::list<Entry>::iterator> m_index; // keys view into m_lru entries
+            // Written only by the owning worker, read by metrics scrapes on any worker.
+            std::atomic<std::uint64_t> m_hits;
+            std::atomic<std::uint64_t> m_renders;
+    };
+} // namespace https
+
+#endif
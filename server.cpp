@@ -1,18 +1,153 @@
 #include "https_tlsServer.h"
+#include "logger.h"
 
 #include <cstdlib>
 #include <iostream>
 #include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+    // Reads a non-negative count from the environment; "auto" means one per hardware thread.
+    std::size_t envCount(const char *name, std::size_t fallback)
+    {
+        const char *value = std::getenv(name);
+        if (!value || *value == '\0')
+        {
+            return fallback;
+        }
+
+        if (std::string(value) == "auto")
+        {
+            unsigned int cores = std::thread::hardware_concurrency();
+            return cores > 0 ? cores : fallback;
+        }
+
+        char *end = nullptr;
+        long parsed = std::strtol(value, &end, 10);
+        return (*end == '\0' && parsed >= 0) ? static_cast<std::size_t>(parsed) : fallback;
+    }
+
+    std::string envString(const char *name, const std::string &fallback)
+    {
+        const char *value = std::getenv(name);
+        return value && *value != '\0' ? value : fallback;
+    }
+
+    // Splits a comma-separated variable, e.g. "Zezima,Lynx Titan", skipping empty items.
+    std::vector<std::string> envList(const char *name)
+    {
+        std::vector<std::string> items;
+        const char *value = std::getenv(name);
+        if (!value)
+        {
+            return items;
+        }
+
+        std::string item;
+        for (const char *ch = value;; ++ch)
+        {
+            if (*ch == ',' || *ch == '\0')
+            {
+                if (!item.empty())
+                {
+                    items.push_back(item);
+                }
+                item.clear();
+                if (*ch == '\0')
+                {
+                    break;
+                }
+            }
+            else
+            {
+                item += *ch;
+            }
+        }
+        return items;
+    }
+
+    bool envFlag(const char *name)
+    {
+        const char *value = std::getenv(name);
+        return value && (std::string(value) == "1" || std::string(value) == "true");
+    }
+}
 
 int main()
 {
+    https::LoggerOptions logging;
+    const std::string level = envString("HTTPS_LOG_LEVEL", https::logLevelName(logging.level));
+    if (!https::parseLogLevel(level, logging.level))
+    {
+        std::cerr << "Unknown HTTPS_LOG_LEVEL " << level << std::endl;
+        return 1;
+    }
+    logging.path = envString("HTTPS_LOG_FILE", logging.path);
+    logging.sampleEvery = envCount("HTTPS_LOG_SAMPLE", logging.sampleEvery);
+    logging.bufferEvents = envCount("HTTPS_LOG_BUFFER", logging.bufferEvents);
+    if (!https::startLogger(logging))
+    {
+        std::cerr << "Unable to open log file " << logging.path << std::endl;
+        return 1;
+    }
+
     const char *caEnv = std::getenv("OSRS_CA_BUNDLE");
     std::string caPath = caEnv ? caEnv : "cacert.pem"; // Replace with path to your CA bundle
 
-    https::TcpServer server("0.0.0.0", 443, caPath);
+    https::ServerOptions options;
+    options.workers = envCount("HTTPS_WORKERS", options.workers);
+    options.pinWorkers = envFlag("HTTPS_PIN_WORKERS");
+    options.upstreamHost = envString("HTTPS_UPSTREAM_HOST", options.upstreamHost);
+    options.upstreamPort = static_cast<int>(envCount("HTTPS_UPSTREAM_PORT", static_cast<std::size_t>(options.upstreamPort)));
+    options.upstreamThreads = envCount("HTTPS_UPSTREAM_THREADS", options.upstreamThreads);
+    options.upstreamConnections = envCount("HTTPS_UPSTREAM_CONNECTIONS", options.upstreamConnections);
+    options.upstreamDeadlineMs = static_cast<int>(envCount("HTTPS_UPSTREAM_DEADLINE_MS", options.upstreamDeadlineMs));
+    options.upstreamGuard.latencyTargetMs = static_cast<int>(envCount("HTTPS_UPSTREAM_LATENCY_TARGET_MS", options.upstreamGuard.latencyTargetMs));
+    options.upstreamGuard.failureThreshold = static_cast<int>(envCount("HTTPS_BREAKER_FAILURES", options.upstreamGuard.failureThreshold));
+    options.upstreamGuard.openSeconds = static_cast<int>(envCount("HTTPS_BREAKER_OPEN_SECONDS", options.upstreamGuard.openSeconds));
+    options.upstreamDns.ttlSeconds = static_cast<int>(envCount("HTTPS_DNS_TTL", options.upstreamDns.ttlSeconds));
+    options.maxBatchPlayers = envCount("HTTPS_BATCH_MAX_PLAYERS", options.maxBatchPlayers);
+    options.batchParallelism = envCount("HTTPS_BATCH_PARALLELISM", options.batchParallelism);
+    options.responseCacheEntries = envCount("HTTPS_RESPONSE_CACHE", options.responseCacheEntries);
+    options.compressMinBytes = envCount("HTTPS_COMPRESS_MIN_BYTES", options.compressMinBytes);
+    options.idleTimeoutSeconds = static_cast<int>(envCount("HTTPS_IDLE_TIMEOUT", options.idleTimeoutSeconds));
+    options.maxRequestsPerConnection = envCount("HTTPS_MAX_REQUESTS", options.maxRequestsPerConnection);
+
+    osrs::PlayerCacheOptions &cache = options.playerCache;
+    cache.capacity = envCount("HTTPS_CACHE_CAPACITY", cache.capacity);
+    cache.ttlSeconds = static_cast<int>(envCount("HTTPS_CACHE_TTL", cache.ttlSeconds));
+    cache.negativeTtlSeconds = static_cast<int>(envCount("HTTPS_CACHE_NEGATIVE_TTL", cache.negativeTtlSeconds));
+    cache.staleSeconds = static_cast<int>(envCount("HTTPS_CACHE_STALE", cache.staleSeconds));
+    cache.graceSeconds = static_cast<int>(envCount("HTTPS_CACHE_GRACE", cache.graceSeconds));
+
+    osrs::WatchlistOptions &watchlist = options.watchlist;
+    watchlist.names = envList("HTTPS_WATCHLIST");
+    watchlist.topPlayers = envCount("HTTPS_WATCHLIST_TOP", watchlist.topPlayers);
+    watchlist.refreshesPerSecond = static_cast<int>(envCount("HTTPS_WATCHLIST_RATE", watchlist.refreshesPerSecond));
+
+    // Unset, or "off", leaves history recording and /player/history off.
+    const std::string historyPath = envString("HTTPS_HISTORY_FILE", options.history.path);
+    options.history.path = historyPath == "off" ? "" : historyPath;
+
+    https::ServerTlsOptions &tls = options.tls;
+    tls.certificateFile = envString("HTTPS_CERT", tls.certificateFile);
+    tls.privateKeyFile = envString("HTTPS_KEY", tls.privateKeyFile);
+    tls.ecdsaCertificateFile = envString("HTTPS_ECDSA_CERT", tls.ecdsaCertificateFile);
+    tls.ecdsaPrivateKeyFile = envString("HTTPS_ECDSA_KEY", tls.ecdsaPrivateKeyFile);
+    tls.cipherList = envString("HTTPS_TLS_CIPHERS", tls.cipherList);
+    tls.cipherSuites = envString("HTTPS_TLS_CIPHERSUITES", tls.cipherSuites);
+    tls.groups = envString("HTTPS_TLS_GROUPS", tls.groups);
+    tls.sessionCacheSize = envCount("HTTPS_SESSION_CACHE_SIZE", tls.sessionCacheSize);
+    tls.ticketKeyRotationSeconds = static_cast<int>(envCount("HTTPS_TICKET_ROTATION", tls.ticketKeyRotationSeconds));
+    tls.ktls = envFlag("HTTPS_KTLS");
+
+    const int port = static_cast<int>(envCount("HTTPS_PORT", 443));
+    https::TcpServer server("0.0.0.0", port, caPath, options);
 
-    std::cout << "Starting HTTPS server for OSRS hiscore proxy..." << std::endl;
+    https::logEvent(https::LogLevel::Info, "starting", "HTTPS server for OSRS hiscore proxy");
     server.startListen();
 
+    https::stopLogger();
     return 0;
 }
@@ -0,0 +1,61 @@
+#include "task_pool.h"
+
+namespace https
+{
+    TaskPool::TaskPool(std::size_t threadCount) : m_stopping(false)
+    {
+        if (threadCount == 0)
+        {
+            threadCount = 1;
+        }
+
+        m_threads.reserve(threadCount);
+        for (std::size_t i = 0; i < threadCount; ++i)
+        {
+            m_threads.emplace_back(&TaskPool::run, this);
+        }
+    }
+
+    TaskPool::~TaskPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_ready.notify_all();
+
+        for (auto &thread : m_threads)
+        {
+            thread.join();
+        }
+    }
+
+    void TaskPool::submit(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_tasks.push_back(std::move(task));
+        }
+        m_ready.notify_one();
+    }
+
+    void TaskPool::run()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_ready.wait(lock, [this] { return m_stopping || !m_tasks.empty(); });
+                if (m_tasks.empty())
+                {
+                    return; // stopping and drained
+                }
+                task = std::move(m_tasks.front());
+                m_tasks.pop_front();
+            }
+
+            task();
+        }
+    }
+} // namespace https
@@ -0,0 +1,38 @@
+#ifndef INCLUDED_TASK_POOL
+#define INCLUDED_TASK_POOL
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace https
+{
+    // Fixed-size pool of threads for blocking work (upstream hiscore fetches)
+    // that must not run on an event loop thread.
+    class TaskPool
+    {
+        public:
+            explicit TaskPool(std::size_t threadCount);
+            ~TaskPool();
+
+            TaskPool(const TaskPool &) = delete;
+            TaskPool &operator=(const TaskPool &) = delete;
+
+            void submit(std::function<void()> task);
+
+        private:
+            std::mutex m_mutex;
+            std::condition_variable m_ready;
+            std::deque<std::function<void()>> m_tasks;
+            bool m_stopping;
+            std::vector<std::thread> m_threads;
+
+            void run();
+    };
+} // namespace https
+
+#endif
@@ -0,0 +1,220 @@
+// DnsCache against a scripted resolver: answers are served from memory and
+// refreshed ahead of expiry, a failed refresh keeps the last good answer, and
+// candidates come back in happy-eyeballs order.
+//
+// Built by the dns_cache_test target and run by ctest (see CMakeLists.txt):
+//   cmake --build build --target dns_cache_test
+//   build/dns_cache_test
+
+#include "dns_cache.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+namespace {
+    int g_failures = 0;
+
+    void check(bool condition, const char *what)
+    {
+        if (!condition)
+        {
+            std::printf("FAIL: %s\n", what);
+            ++g_failures;
+        }
+    }
+
+    https::ResolvedAddress address(const char *text)
+    {
+        https::ResolvedAddress resolved;
+        std::memset(&resolved.address, 0, sizeof(resolved.address));
+        if (std::strchr(text, ':'))
+        {
+            sockaddr_in6 &v6 = reinterpret_cast<sockaddr_in6 &>(resolved.address);
+            v6.sin6_family = AF_INET6;
+            inet_pton(AF_INET6, text, &v6.sin6_addr);
+            resolved.length = sizeof(v6);
+        }
+        else
+        {
+            sockaddr_in &v4 = reinterpret_cast<sockaddr_in &>(resolved.address);
+            v4.sin_family = AF_INET;
+            inet_pton(AF_INET, text, &v4.sin_addr);
+            resolved.length = sizeof(v4);
+        }
+        return resolved;
+    }
+
+    std::string text(const https::ResolvedAddress &resolved)
+    {
+        char buffer[INET6_ADDRSTRLEN] = "";
+        if (resolved.family() == AF_INET6)
+        {
+            inet_ntop(AF_INET6, &reinterpret_cast<const sockaddr_in6 &>(resolved.address).sin6_addr, buffer, sizeof(buffer));
+        }
+        else
+        {
+            inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in &>(resolved.address).sin_addr, buffer, sizeof(buffer));
+        }
+        return buffer;
+    }
+
+    std::string joined(const std::vector<https::ResolvedAddress> &addresses)
+    {
+        std::string out;
+        for (const https::ResolvedAddress &resolved : addresses)
+        {
+            out += (out.empty() ? "" : " ") + text(resolved);
+        }
+        return out;
+    }
+
+    // Answers with whatever the test last set, or fails while failing is set.
+    class FakeResolver {
+    public:
+        void answer(std::vector<const char *> addresses)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_addresses = std::move(addresses);
+            m_failing = false;
+        }
+
+        void fail()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_failing = true;
+        }
+
+        int calls() const
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_calls;
+        }
+
+        https::Resolver resolver()
+        {
+            return [this](const std::string &, int, https::DnsAnswer &answer) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                ++m_calls;
+                if (m_failing)
+                {
+                    return false;
+                }
+                answer.addresses.clear();
+                for (const char *entry : m_addresses)
+                {
+                    answer.addresses.push_back(address(entry));
+                }
+                return true;
+            };
+        }
+
+    private:
+        mutable std::mutex m_mutex;
+        std::vector<const char *> m_addresses;
+        bool m_failing = false;
+        int m_calls = 0;
+    };
+
+    // Polls until the resolver has been called at least calls times, or a few seconds pass.
+    bool waitForCalls(const FakeResolver &fake, int calls)
+    {
+        const auto giveUp = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (fake.calls() < calls)
+        {
+            if (std::chrono::steady_clock::now() >= giveUp)
+            {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return true;
+    }
+
+    void testRefreshAndFallback()
+    {
+        // Answers live 2s and are refreshed 1s ahead, so the second resolution
+        // lands a second in, before the first answer expires.
+        https::DnsCacheOptions options;
+        options.ttlSeconds = 2;
+        options.refreshAheadSeconds = 1;
+        options.retrySeconds = 1;
+
+        FakeResolver fake;
+        fake.answer({"192.0.2.1"});
+        https::DnsCache cache(options, fake.resolver());
+
+        check(joined(cache.candidates("upstream", 443)) == "192.0.2.1", "first lookup waits for the first answer");
+        fake.answer({"192.0.2.2"});
+        check(joined(cache.candidates("upstream", 443)) == "192.0.2.1", "lookups are served from memory until the refresh");
+        check(fake.calls() == 1, "lookups do not call the resolver themselves");
+
+        check(waitForCalls(fake, 2), "the answer is refreshed once it nears its TTL");
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        check(joined(cache.candidates("upstream", 443)) == "192.0.2.2", "the refreshed answer replaces the old one");
+        check(cache.stats().staleServed == 0, "a refresh ahead of expiry never serves a stale answer");
+
+        // Every refresh from now on fails; wait until the last good answer has expired too.
+        fake.fail();
+        check(waitForCalls(fake, 3), "a refresh is attempted after the answer ages again");
+        std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+        check(joined(cache.candidates("upstream", 443)) == "192.0.2.2", "a failed refresh keeps the last good answer");
+
+        const https::DnsCache::Stats stats = cache.stats();
+        check(stats.resolutions == 2, "resolutions counts successful resolver calls");
+        check(stats.failures >= 1, "failures counts failed resolver calls");
+        check(stats.staleServed >= 1, "serving the expired answer is counted");
+    }
+
+    void testFirstLookupFailure()
+    {
+        FakeResolver fake;
+        fake.fail();
+        https::DnsCache cache(https::DnsCacheOptions(), fake.resolver());
+
+        // Nothing good to fall back on, so the caller is told at once rather than at the timeout.
+        const auto start = std::chrono::steady_clock::now();
+        check(cache.candidates("upstream", 443).empty(), "a host that never resolved has no candidates");
+        check(std::chrono::steady_clock::now() - start < std::chrono::seconds(1), "a failed first resolution wakes the waiting lookup");
+    }
+
+    void testHappyEyeballsOrder()
+    {
+        FakeResolver fake;
+        fake.answer({"192.0.2.1", "2001:db8::1", "192.0.2.2", "192.0.2.3", "2001:db8::2"});
+        https::DnsCache cache(https::DnsCacheOptions(), fake.resolver());
+
+        // IPv6 first, then alternating families, the leftover IPv4 addresses last.
+        check(joined(cache.candidates("upstream", 443)) == "2001:db8::1 192.0.2.1 2001:db8::2 192.0.2.2 192.0.2.3",
+              "candidates alternate IPv6 and IPv4, IPv6 first");
+        // The next lookup starts one record further along in each family.
+        check(joined(cache.candidates("upstream", 443)) == "2001:db8::2 192.0.2.2 2001:db8::1 192.0.2.3 192.0.2.1",
+              "candidates rotate within each family across lookups");
+
+        fake.answer({"192.0.2.1", "192.0.2.2"});
+        https::DnsCache v4only(https::DnsCacheOptions(), fake.resolver());
+        check(joined(v4only.candidates("upstream", 443)) == "192.0.2.1 192.0.2.2", "a single family keeps its order");
+    }
+}
+
+int main()
+{
+    testHappyEyeballsOrder();
+    testFirstLookupFailure();
+    testRefreshAndFallback();
+
+    if (g_failures > 0)
+    {
+        std::printf("%d check(s) failed\n", g_failures);
+        return 1;
+    }
+    std::printf("all DnsCache checks passed\n");
+    return 0;
+}
@@ -0,0 +1,108 @@
+// UpstreamGuard's circuit breaker: consecutive failures open it, one probe
+// decides a half-open breaker, and calls admitted before it opened cannot.
+//
+// Built by the upstream_guard_test target and run by ctest (see CMakeLists.txt):
+//   cmake --build build --target upstream_guard_test
+//   build/upstream_guard_test
+
+#include "upstream_guard.h"
+
+#include <chrono>
+#include <cstdio>
+
+namespace {
+    using https::UpstreamGuard;
+    using State = UpstreamGuard::BreakerState;
+
+    int g_failures = 0;
+
+    void check(bool condition, const char *what)
+    {
+        if (!condition)
+        {
+            std::printf("FAIL: %s\n", what);
+            ++g_failures;
+        }
+    }
+
+    const std::chrono::microseconds kFast(1000);
+
+    std::chrono::steady_clock::time_point soon()
+    {
+        return std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+    }
+
+    // Two failures open the breaker, and it is half-open again at the next call.
+    https::UpstreamGuardOptions options()
+    {
+        https::UpstreamGuardOptions options;
+        options.failureThreshold = 2;
+        options.openSeconds = 0;
+        return options;
+    }
+
+    // Admits a call that was running before the breaker opened, then trips it.
+    void admitThenTrip(UpstreamGuard &guard, bool &lateProbe)
+    {
+        check(guard.acquire(soon(), lateProbe) == UpstreamGuard::Admission::Admitted, "a closed breaker admits calls");
+        check(!lateProbe, "calls through a closed breaker are not probes");
+        for (int i = 0; i < 2; ++i)
+        {
+            bool probe = false;
+            guard.acquire(soon(), probe);
+            guard.release(probe, true, kFast);
+        }
+        check(guard.stats().state == State::Open, "consecutive failures open the breaker");
+    }
+
+    void testOnlyProbeCloses()
+    {
+        UpstreamGuard guard(options());
+        bool late = false;
+        admitThenTrip(guard, late);
+
+        bool probe = false;
+        check(guard.acquire(soon(), probe) == UpstreamGuard::Admission::Admitted && probe, "the first call after openSeconds is the probe");
+        bool other = false;
+        check(guard.acquire(soon(), other) == UpstreamGuard::Admission::CircuitOpen, "other calls fail fast while the probe runs");
+
+        guard.release(late, false, kFast);
+        check(guard.stats().state == State::HalfOpen, "an older call succeeding does not close a half-open breaker");
+
+        guard.release(probe, false, kFast);
+        check(guard.stats().state == State::Closed, "the probe succeeding closes the breaker");
+        check(guard.stats().trips == 1, "the breaker tripped once");
+    }
+
+    void testOnlyProbeReopens()
+    {
+        UpstreamGuard guard(options());
+        bool late = false;
+        admitThenTrip(guard, late);
+
+        bool probe = false;
+        guard.acquire(soon(), probe);
+        guard.release(late, true, kFast);
+        check(guard.stats().state == State::HalfOpen, "an older call failing does not reopen a half-open breaker");
+        check(guard.stats().trips == 1, "an older call failing is not a trip");
+
+        guard.release(probe, true, kFast);
+        check(guard.stats().state == State::Open, "the probe failing reopens the breaker");
+        check(guard.stats().trips == 2, "the probe failing counts as a trip");
+        check(guard.stats().inFlight == 0, "every permit was returned");
+    }
+}
+
+int main()
+{
+    testOnlyProbeCloses();
+    testOnlyProbeReopens();
+
+    if (g_failures > 0)
+    {
+        std::printf("%d check(s) failed\n", g_failures);
+        return 1;
+    }
+    std::printf("all UpstreamGuard checks passed\n");
+    return 0;
+}
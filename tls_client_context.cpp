@@ -0,0 +1,177 @@
+#include "tls_client_context.h"
+#include "logger.h"
+
+
+#include <openssl/err.h>
+
+namespace {
+    // Sessions kept per host; enough for a burst of parallel connects to resume.
+    const std::size_t kSessionsPerHost = 8;
+
+    std::mutex registryMutex;
+    // Contexts live for the rest of the process once built.
+    std::unordered_map<std::string, std::shared_ptr<https::ClientTlsContext>> registry;
+}
+
+namespace https
+{
+    std::shared_ptr<ClientTlsContext> ClientTlsContext::forCaBundle(const std::string &caCertPath)
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        auto existing = registry.find(caCertPath);
+        if (existing != registry.end())
+        {
+            return existing->second;
+        }
+
+        OPENSSL_init_ssl(OPENSSL_INIT_LOAD_SSL_STRINGS | OPENSSL_INIT_LOAD_CRYPTO_STRINGS, nullptr);
+
+        SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+        if (!ctx)
+        {
+            return nullptr;
+        }
+
+        // The CA bundle is parsed here, once, rather than on every connection.
+        if (SSL_CTX_load_verify_locations(ctx, caCertPath.c_str(), nullptr) != 1)
+        {
+            logEvent(LogLevel::Error, "ca_bundle_load_failed", caCertPath);
+            SSL_CTX_free(ctx);
+            return nullptr;
+        }
+
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+
+        // Sessions live in our per-host cache, not OpenSSL's internal one, which
+        // clients cannot look up by host.
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx, &ClientTlsContext::onNewSession);
+
+        std::shared_ptr<ClientTlsContext> context(new ClientTlsContext(ctx));
+        registry[caCertPath] = context;
+        return context;
+    }
+
+    ClientTlsContext::ClientTlsContext(SSL_CTX *ctx) : m_ctx(ctx),
+                                                       m_resumptionHits(0),
+                                                       m_resumptionMisses(0)
+    {
+        SSL_CTX_set_app_data(m_ctx, this);
+    }
+
+    ClientTlsContext::~ClientTlsContext()
+    {
+        for (auto &entry : m_sessions)
+        {
+            for (SSL_SESSION *session : entry.second)
+            {
+                SSL_SESSION_free(session);
+            }
+        }
+        SSL_CTX_free(m_ctx);
+    }
+
+    SSL *ClientTlsContext::newSsl(const std::string &hostname)
+    {
+        SSL *ssl = SSL_new(m_ctx);
+        if (!ssl)
+        {
+            return nullptr;
+        }
+
+        if (SSL_set_tlsext_host_name(ssl, hostname.c_str()) != 1)
+        {
+            SSL_free(ssl);
+            return nullptr;
+        }
+
+        SSL_SESSION *session = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_sessions.find(hostname);
+            while (it != m_sessions.end() && !it->second.empty() && !session)
+            {
+                SSL_SESSION *candidate = it->second.back();
+                if (!SSL_SESSION_is_resumable(candidate))
+                {
+                    it->second.pop_back();
+                    SSL_SESSION_free(candidate);
+                    continue;
+                }
+
+                // TLS 1.3 tickets are meant to be used once; a resumed connection
+                // receives fresh ones. TLS 1.2 sessions can be shared.
+                if (SSL_SESSION_get_protocol_version(candidate) >= TLS1_3_VERSION)
+                {
+                    it->second.pop_back();
+                    session = candidate;
+                }
+                else
+                {
+                    SSL_SESSION_up_ref(candidate);
+                    session = candidate;
+                }
+            }
+        }
+
+        if (session)
+        {
+            SSL_set_session(ssl, session);
+            SSL_SESSION_free(session); // SSL_set_session took its own reference
+        }
+
+        return ssl;
+    }
+
+    void ClientTlsContext::recordHandshake(SSL *ssl)
+    {
+        if (SSL_session_reused(ssl))
+        {
+            m_resumptionHits.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            m_resumptionMisses.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    ClientTlsContext::Stats ClientTlsContext::stats() const
+    {
+        Stats stats{};
+        stats.resumptionHits = m_resumptionHits.load(std::memory_order_relaxed);
+        stats.resumptionMisses = m_resumptionMisses.load(std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto &entry : m_sessions)
+        {
+            stats.cachedSessions += entry.second.size();
+        }
+        return stats;
+    }
+
+    int ClientTlsContext::onNewSession(SSL *ssl, SSL_SESSION *session)
+    {
+        // Called during the handshake (TLS 1.2) or when a ticket arrives after it (TLS 1.3).
+        auto *context = static_cast<ClientTlsContext *>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+        const char *hostname = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+        if (!context || !hostname)
+        {
+            return 0;
+        }
+
+        SSL_SESSION *evicted = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(context->m_mutex);
+            auto &sessions = context->m_sessions[hostname];
+            sessions.push_back(session);
+            if (sessions.size() > kSessionsPerHost)
+            {
+                evicted = sessions.front();
+                sessions.pop_front();
+            }
+        }
+
+        SSL_SESSION_free(evicted);
+        return 1; // we keep the reference OpenSSL handed us
+    }
+} // namespace https
@@ -0,0 +1,63 @@
+#ifndef INCLUDED_TLS_CLIENT_CONTEXT
+#define INCLUDED_TLS_CLIENT_CONTEXT
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <openssl/ssl.h>
+
+namespace https
+{
+    // Client SSL_CTX shared by every upstream connection in the process. It is
+    // built once per CA bundle and caches TLS sessions per host so that new
+    // connections resume instead of doing a full handshake.
+    class ClientTlsContext
+    {
+        public:
+            struct Stats
+            {
+                std::uint64_t resumptionHits;   // handshakes that resumed a cached session
+                std::uint64_t resumptionMisses; // full handshakes
+                std::uint64_t cachedSessions;
+            };
+
+            // Returns the process-wide context for caCertPath, creating it on
+            // first use. Returns nullptr if the CA bundle cannot be loaded.
+            static std::shared_ptr<ClientTlsContext> forCaBundle(const std::string &caCertPath);
+
+            ~ClientTlsContext();
+
+            ClientTlsContext(const ClientTlsContext &) = delete;
+            ClientTlsContext &operator=(const ClientTlsContext &) = delete;
+
+            // New SSL object for hostname with SNI set and, when one is cached,
+            // a session to resume.
+            SSL *newSsl(const std::string &hostname);
+
+            // Call once SSL_connect has succeeded to count the handshake.
+            void recordHandshake(SSL *ssl);
+
+            Stats stats() const;
+
+        private:
+            explicit ClientTlsContext(SSL_CTX *ctx);
+
+            static int onNewSession(SSL *ssl, SSL_SESSION *session);
+
+            SSL_CTX *m_ctx;
+
+            mutable std::mutex m_mutex;
+            // Most recent sessions last; TLS 1.3 tickets are removed once offered.
+            std::unordered_map<std::string, std::deque<SSL_SESSION *>> m_sessions;
+
+            std::atomic<std::uint64_t> m_resumptionHits;
+            std::atomic<std::uint64_t> m_resumptionMisses;
+    };
+} // namespace https
+
+#endif
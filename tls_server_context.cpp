@@ -0,0 +1,269 @@
+#include "tls_server_context.h"
+#include "logger.h"
+
+#include <cstring>
+
+#include <openssl/core_names.h>
+#include <openssl/err.h>
+#include <openssl/rand.h>
+
+namespace {
+    // Keys kept after rotation, so a ticket stays valid for up to this many intervals.
+    const std::size_t kRetainedTicketKeys = 2;
+
+    const unsigned char kSessionIdContext[] = "osrs-hiscore-proxy";
+
+    // Logs and clears every queued OpenSSL error, oldest first: a bad key file
+    // queues both the file error and what the PEM parser made of it.
+    void logSslErrors(const char *event)
+    {
+        while (unsigned long code = ERR_get_error())
+        {
+            char reason[256];
+            ERR_error_string_n(code, reason, sizeof(reason));
+            https::logEvent(https::LogLevel::Error, event, reason);
+        }
+    }
+
+    bool loadKeyPair(SSL_CTX *ctx, const std::string &certificateFile, const std::string &privateKeyFile)
+    {
+        // Each call fills the slot for the key's type, so RSA and ECDSA pairs coexist.
+        return SSL_CTX_use_certificate_chain_file(ctx, certificateFile.c_str()) == 1 &&
+               SSL_CTX_use_PrivateKey_file(ctx, privateKeyFile.c_str(), SSL_FILETYPE_PEM) == 1 &&
+               SSL_CTX_check_private_key(ctx) == 1;
+    }
+}
+
+namespace https
+{
+    std::unique_ptr<ServerTlsContext> ServerTlsContext::create(const ServerTlsOptions &options)
+    {
+        OPENSSL_init_ssl(OPENSSL_INIT_LOAD_SSL_STRINGS | OPENSSL_INIT_LOAD_CRYPTO_STRINGS, nullptr);
+
+        SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+        if (!ctx)
+        {
+            logSslErrors("tls_context_failed");
+            return nullptr;
+        }
+
+        bool ok = loadKeyPair(ctx, options.certificateFile, options.privateKeyFile);
+        if (ok && !options.ecdsaCertificateFile.empty())
+        {
+            ok = loadKeyPair(ctx, options.ecdsaCertificateFile, options.ecdsaPrivateKeyFile);
+        }
+
+        ok = ok && SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION) == 1 &&
+             SSL_CTX_set_cipher_list(ctx, options.cipherList.c_str()) == 1 &&
+             SSL_CTX_set_ciphersuites(ctx, options.cipherSuites.c_str()) == 1 &&
+             SSL_CTX_set1_groups_list(ctx, options.groups.c_str()) == 1 &&
+             SSL_CTX_set_session_id_context(ctx, kSessionIdContext, sizeof(kSessionIdContext) - 1) == 1;
+
+        if (!ok)
+        {
+            logSslErrors("tls_context_failed");
+            SSL_CTX_free(ctx);
+            return nullptr;
+        }
+
+        return std::unique_ptr<ServerTlsContext>(new ServerTlsContext(ctx, options));
+    }
+
+    ServerTlsContext::ServerTlsContext(SSL_CTX *ctx, const ServerTlsOptions &options) : m_ctx(ctx),
+                                                                                        m_rotationInterval(options.ticketKeyRotationSeconds),
+                                                                                        m_ktls(false),
+                                                                                        m_fullHandshakes(0),
+                                                                                        m_resumedHandshakes(0),
+                                                                                        m_ticketKeyRotations(0),
+                                                                                        m_ktlsSend(0),
+                                                                                        m_ktlsReceive(0),
+                                                                                        m_ktlsUnavailable(0)
+    {
+        // Our cipher and group order wins over the client's.
+        SSL_CTX_set_options(m_ctx, SSL_OP_CIPHER_SERVER_PREFERENCE);
+
+        // Non-blocking writes may be resumed with the remainder of a response.
+        SSL_CTX_set_mode(m_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+        // Requests frame themselves, so a client that half-closes without
+        // close_notify has sent everything it meant to: read that as a clean
+        // close rather than answering it with a decode_error alert.
+        SSL_CTX_set_options(m_ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+
+#ifdef SSL_OP_ENABLE_KTLS
+        // OpenSSL tries to install the kernel's TLS ULP on each socket once the
+        // keys are known, and keeps doing the crypto itself wherever that fails.
+        if (options.ktls)
+        {
+            SSL_CTX_set_options(m_ctx, SSL_OP_ENABLE_KTLS);
+            m_ktls = true;
+        }
+#else
+        if (options.ktls)
+        {
+            https::logEvent(https::LogLevel::Warn, "ktls_unsupported",
+                            "kTLS was requested, but OpenSSL was built without it; all TLS stays in user space");
+        }
+#endif
+
+        SSL_CTX_set_session_cache_mode(m_ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(m_ctx, static_cast<long>(options.sessionCacheSize));
+        SSL_CTX_set_timeout(m_ctx, options.sessionTimeoutSeconds);
+
+        if (options.ticketKeyRotationSeconds > 0)
+        {
+            SSL_CTX_set_app_data(m_ctx, this);
+            SSL_CTX_set_tlsext_ticket_key_evp_cb(m_ctx, &ServerTlsContext::onTicketKey);
+        }
+        else
+        {
+            // Without tickets TLS 1.3 falls back to stateful sessions in the cache above.
+            SSL_CTX_set_options(m_ctx, SSL_OP_NO_TICKET);
+        }
+    }
+
+    ServerTlsContext::~ServerTlsContext()
+    {
+        for (auto &key : m_ticketKeys)
+        {
+            OPENSSL_cleanse(&key, sizeof(key));
+        }
+        SSL_CTX_free(m_ctx);
+    }
+
+    void ServerTlsContext::recordHandshake(SSL *ssl)
+    {
+        if (SSL_session_reused(ssl))
+        {
+            m_resumedHandshakes.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            m_fullHandshakes.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        if (!m_ktls)
+        {
+            return;
+        }
+        const bool send = BIO_get_ktls_send(SSL_get_wbio(ssl));
+        const bool receive = BIO_get_ktls_recv(SSL_get_rbio(ssl));
+        if (send)
+        {
+            m_ktlsSend.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (receive)
+        {
+            m_ktlsReceive.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (!send && !receive)
+        {
+            m_ktlsUnavailable.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    ServerTlsContext::Stats ServerTlsContext::stats() const
+    {
+        Stats stats{};
+        stats.fullHandshakes = m_fullHandshakes.load(std::memory_order_relaxed);
+        stats.resumedHandshakes = m_resumedHandshakes.load(std::memory_order_relaxed);
+        stats.ticketKeyRotations = m_ticketKeyRotations.load(std::memory_order_relaxed);
+        stats.ktlsSend = m_ktlsSend.load(std::memory_order_relaxed);
+        stats.ktlsReceive = m_ktlsReceive.load(std::memory_order_relaxed);
+        stats.ktlsUnavailable = m_ktlsUnavailable.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    bool ServerTlsContext::rotateTicketKeyIfDue()
+    {
+        const auto now = std::chrono::steady_clock::now();
+        if (!m_ticketKeys.empty() && now - m_ticketKeys.front().created < m_rotationInterval)
+        {
+            return true;
+        }
+
+        TicketKey key;
+        if (RAND_bytes(key.name, sizeof(key.name)) != 1 ||
+            RAND_bytes(key.aesKey, sizeof(key.aesKey)) != 1 ||
+            RAND_bytes(key.hmacKey, sizeof(key.hmacKey)) != 1)
+        {
+            return !m_ticketKeys.empty(); // keep issuing with the old key rather than failing handshakes
+        }
+        key.created = now;
+
+        m_ticketKeys.insert(m_ticketKeys.begin(), key);
+        OPENSSL_cleanse(&key, sizeof(key));
+        while (m_ticketKeys.size() > kRetainedTicketKeys)
+        {
+            OPENSSL_cleanse(&m_ticketKeys.back(), sizeof(TicketKey));
+            m_ticketKeys.pop_back();
+        }
+
+        m_ticketKeyRotations.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    int ServerTlsContext::onTicketKey(SSL *ssl, unsigned char *keyName, unsigned char *iv,
+                                      EVP_CIPHER_CTX *cipherCtx, EVP_MAC_CTX *macCtx, int encrypt)
+    {
+        auto *context = static_cast<ServerTlsContext *>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+        if (!context)
+        {
+            return -1;
+        }
+
+        std::lock_guard<std::mutex> lock(context->m_keyMutex);
+
+        const TicketKey *key = nullptr;
+        bool renew = false;
+        if (encrypt)
+        {
+            if (!context->rotateTicketKeyIfDue())
+            {
+                return -1;
+            }
+            key = &context->m_ticketKeys.front();
+            std::memcpy(keyName, key->name, sizeof(key->name));
+            if (RAND_bytes(iv, EVP_CIPHER_get_iv_length(EVP_aes_256_cbc())) != 1)
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            for (std::size_t i = 0; i < context->m_ticketKeys.size(); ++i)
+            {
+                if (std::memcmp(keyName, context->m_ticketKeys[i].name, sizeof(TicketKey::name)) == 0)
+                {
+                    key = &context->m_ticketKeys[i];
+                    renew = i > 0; // decrypts, but issue a ticket under the current key
+                    break;
+                }
+            }
+            if (!key)
+            {
+                return 0; // unknown or retired key: fall back to a full handshake
+            }
+        }
+
+        OSSL_PARAM params[3];
+        params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, const_cast<unsigned char *>(key->hmacKey), sizeof(key->hmacKey));
+        params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, const_cast<char *>("SHA256"), 0);
+        params[2] = OSSL_PARAM_construct_end();
+        if (EVP_MAC_CTX_set_params(macCtx, params) != 1)
+        {
+            return -1;
+        }
+
+        const int initialised = encrypt ? EVP_EncryptInit_ex(cipherCtx, EVP_aes_256_cbc(), nullptr, key->aesKey, iv)
+                                        : EVP_DecryptInit_ex(cipherCtx, EVP_aes_256_cbc(), nullptr, key->aesKey, iv);
+        if (initialised != 1)
+        {
+            return -1;
+        }
+
+        return renew ? 2 : 1;
+    }
+} // namespace https
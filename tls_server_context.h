@@ -0,0 +1,115 @@
+#ifndef INCLUDED_TLS_SERVER_CONTEXT
+#define INCLUDED_TLS_SERVER_CONTEXT
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+
+namespace https
+{
+    struct ServerTlsOptions
+    {
+        std::string certificateFile = "server.crt";
+        std::string privateKeyFile = "server.key";
+        // Optional ECDSA pair served alongside the RSA one to clients that prefer it.
+        std::string ecdsaCertificateFile;
+        std::string ecdsaPrivateKeyFile;
+
+        // Server preference order. cipherList covers TLS 1.2, cipherSuites TLS 1.3.
+        std::string cipherList = "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:"
+                                 "ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305:"
+                                 "ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384";
+        std::string cipherSuites = "TLS_AES_128_GCM_SHA256:TLS_CHACHA20_POLY1305_SHA256:TLS_AES_256_GCM_SHA384";
+        std::string groups = "X25519:P-256:P-384";
+
+        // Sessions kept in the server-side cache, shared by every worker.
+        std::size_t sessionCacheSize = 20480;
+        int sessionTimeoutSeconds = 7200;
+        // How often a new session-ticket key is generated; 0 disables tickets and
+        // leaves resumption to the session cache.
+        int ticketKeyRotationSeconds = 3600;
+
+        // Linux kernel TLS: after the handshake, OpenSSL hands the session keys
+        // to the kernel, which then encrypts (and, for TLS 1.2, decrypts)
+        // records itself. Connections whose kernel, cipher or protocol version
+        // cannot be offloaded silently stay in user space.
+        bool ktls = false;
+    };
+
+    // Server SSL_CTX with session caching, rotating session-ticket keys and
+    // counters for full versus resumed handshakes.
+    class ServerTlsContext
+    {
+        public:
+            struct Stats
+            {
+                std::uint64_t fullHandshakes;
+                std::uint64_t resumedHandshakes;
+                std::uint64_t ticketKeyRotations;
+                // Handshakes after which the kernel took over sending and receiving
+                // records, and those where kTLS was enabled but could not be used.
+                std::uint64_t ktlsSend;
+                std::uint64_t ktlsReceive;
+                std::uint64_t ktlsUnavailable;
+            };
+
+            // Returns nullptr (after logging the OpenSSL errors) if the context
+            // or its certificates cannot be set up.
+            static std::unique_ptr<ServerTlsContext> create(const ServerTlsOptions &options);
+
+            ~ServerTlsContext();
+
+            ServerTlsContext(const ServerTlsContext &) = delete;
+            ServerTlsContext &operator=(const ServerTlsContext &) = delete;
+
+            SSL_CTX *ctx() const { return m_ctx; }
+            // Whether kTLS was requested and this OpenSSL build can do it.
+            bool ktls() const { return m_ktls; }
+
+            // Call once SSL_accept has succeeded to count the handshake and whether kTLS took it over.
+            void recordHandshake(SSL *ssl);
+
+            Stats stats() const;
+
+        private:
+            struct TicketKey
+            {
+                unsigned char name[16];
+                unsigned char aesKey[32];
+                unsigned char hmacKey[32];
+                std::chrono::steady_clock::time_point created;
+            };
+
+            ServerTlsContext(SSL_CTX *ctx, const ServerTlsOptions &options);
+
+            static int onTicketKey(SSL *ssl, unsigned char *keyName, unsigned char *iv,
+                                   EVP_CIPHER_CTX *cipherCtx, EVP_MAC_CTX *macCtx, int encrypt);
+
+            bool rotateTicketKeyIfDue();
+
+            SSL_CTX *m_ctx;
+            std::chrono::seconds m_rotationInterval;
+            bool m_ktls;
+
+            std::mutex m_keyMutex;
+            // Newest key first. Older keys still decrypt tickets issued before a rotation.
+            std::vector<TicketKey> m_ticketKeys;
+
+            std::atomic<std::uint64_t> m_fullHandshakes;
+            std::atomic<std::uint64_t> m_resumedHandshakes;
+            std::atomic<std::uint64_t> m_ticketKeyRotations;
+            std::atomic<std::uint64_t> m_ktlsSend;
+            std::atomic<std::uint64_t> m_ktlsReceive;
+            std::atomic<std::uint64_t> m_ktlsUnavailable;
+    };
+} // namespace https
+
+#endif
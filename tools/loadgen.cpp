@@ -0,0 +1,493 @@
+// Closed-loop TLS load generator for the proxy. Each connection runs on its own
+// thread and sends its next request as soon as the previous answer arrives.
+//
+//   build/loadgen --port 443 --connections 64 --duration 20 --players 10000 --distribution zipf
+//
+// Reports throughput, status classes and p50/p90/p99/p999 latency. Latency
+// runs from sending a request to the last byte of its answer; when a request
+// has to open a new connection first (no keep-alive, or the server closed it),
+// the TCP and TLS setup count too, as they would for a real client.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    enum class Distribution
+    {
+        Uniform,
+        Zipf,
+        Single
+    };
+
+    struct LoadOptions
+    {
+        std::string host = "127.0.0.1";
+        int port = 443;
+        std::size_t connections = 32;
+        double durationSeconds = 10;
+        // Samples from the first seconds are dropped while caches and pools fill.
+        double warmupSeconds = 1;
+        bool keepAlive = true;
+        bool gzip = false;
+        std::string path = "/player";
+        // Requests ask for one of players names, "Player 0" to "Player N-1".
+        std::size_t players = 10000;
+        Distribution distribution = Distribution::Zipf;
+        // Zipf exponent: player k is asked for in proportion to 1 / (k + 1)^s.
+        double zipfExponent = 1.0;
+    };
+
+    struct ThreadResult
+    {
+        std::vector<std::uint32_t> latencyMicros;
+        std::uint64_t statusClasses[6] = {}; // index 0 counts connection failures
+        std::uint64_t connects = 0;
+        std::uint64_t bytes = 0;
+    };
+
+    LoadOptions g_options;
+    std::atomic<bool> g_measuring(false);
+    std::atomic<bool> g_stop(false);
+
+    // Draws player indexes from the configured distribution.
+    class NamePicker
+    {
+        public:
+            explicit NamePicker(const LoadOptions &options) : m_distribution(options.distribution), m_players(std::max<std::size_t>(options.players, 1))
+            {
+                if (m_distribution == Distribution::Zipf)
+                {
+                    m_cdf.resize(m_players);
+                    double total = 0;
+                    for (std::size_t k = 0; k < m_players; ++k)
+                    {
+                        total += 1.0 / std::pow(static_cast<double>(k + 1), options.zipfExponent);
+                        m_cdf[k] = total;
+                    }
+                    for (double &value : m_cdf)
+                    {
+                        value /= total;
+                    }
+                }
+            }
+
+            std::size_t pick(std::mt19937_64 &random) const
+            {
+                switch (m_distribution)
+                {
+                case Distribution::Single:
+                    return 0;
+                case Distribution::Uniform:
+                    return std::uniform_int_distribution<std::size_t>(0, m_players - 1)(random);
+                default:
+                {
+                    const double u = std::uniform_real_distribution<double>(0, 1)(random);
+                    const auto it = std::lower_bound(m_cdf.begin(), m_cdf.end(), u);
+                    return std::min(static_cast<std::size_t>(it - m_cdf.begin()), m_players - 1);
+                }
+                }
+            }
+
+        private:
+            Distribution m_distribution;
+            std::size_t m_players;
+            std::vector<double> m_cdf;
+    };
+
+    // One client connection, reopened (resuming its TLS session) whenever it closes.
+    class Client
+    {
+        public:
+            Client(SSL_CTX *ctx, const sockaddr_storage &address, socklen_t addressLength)
+                : m_ctx(ctx), m_address(address), m_addressLength(addressLength)
+            {
+            }
+
+            ~Client()
+            {
+                disconnect();
+                SSL_SESSION_free(m_session);
+            }
+
+            // Sends request and reads the whole answer. Returns its status code, or 0 on failure.
+            int exchange(const std::string &request, ThreadResult &result)
+            {
+                if (!m_ssl && !connect(result))
+                {
+                    return 0;
+                }
+                if (!writeAll(request))
+                {
+                    // A keep-alive connection the server closed in the meantime; retry once on a fresh one.
+                    disconnect();
+                    if (!connect(result) || !writeAll(request))
+                    {
+                        disconnect();
+                        return 0;
+                    }
+                }
+
+                bool closeAfter = false;
+                const int status = readResponse(closeAfter, result);
+                if (status == 0 || closeAfter)
+                {
+                    disconnect();
+                }
+                return status;
+            }
+
+        private:
+            SSL_CTX *m_ctx;
+            sockaddr_storage m_address;
+            socklen_t m_addressLength;
+            int m_socket = -1;
+            SSL *m_ssl = nullptr;
+            SSL_SESSION *m_session = nullptr;
+            std::string m_buffer;
+
+            bool connect(ThreadResult &result)
+            {
+                m_socket = socket(m_address.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+                if (m_socket < 0 || ::connect(m_socket, reinterpret_cast<const sockaddr *>(&m_address), m_addressLength) != 0)
+                {
+                    disconnect();
+                    return false;
+                }
+                const int enable = 1;
+                setsockopt(m_socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+                m_ssl = SSL_new(m_ctx);
+                SSL_set_fd(m_ssl, m_socket);
+                SSL_set_tlsext_host_name(m_ssl, g_options.host.c_str());
+                if (m_session)
+                {
+                    SSL_set_session(m_ssl, m_session);
+                }
+                if (SSL_connect(m_ssl) != 1)
+                {
+                    ERR_clear_error();
+                    disconnect();
+                    return false;
+                }
+                ++result.connects;
+                m_buffer.clear();
+                return true;
+            }
+
+            void disconnect()
+            {
+                if (m_ssl)
+                {
+                    // Kept for resumption; with TLS 1.3 the ticket arrives after the handshake, so take it last.
+                    if (SSL_SESSION *session = SSL_get1_session(m_ssl))
+                    {
+                        SSL_SESSION_free(m_session);
+                        m_session = session;
+                    }
+                    SSL_free(m_ssl);
+                    m_ssl = nullptr;
+                }
+                if (m_socket >= 0)
+                {
+                    close(m_socket);
+                    m_socket = -1;
+                }
+            }
+
+            bool writeAll(const std::string &data)
+            {
+                std::size_t offset = 0;
+                while (offset < data.size())
+                {
+                    const int written = SSL_write(m_ssl, data.data() + offset, static_cast<int>(data.size() - offset));
+                    if (written <= 0)
+                    {
+                        ERR_clear_error();
+                        return false;
+                    }
+                    offset += static_cast<std::size_t>(written);
+                }
+                return true;
+            }
+
+            bool fill()
+            {
+                char chunk[16384];
+                const int received = SSL_read(m_ssl, chunk, sizeof(chunk));
+                if (received <= 0)
+                {
+                    ERR_clear_error();
+                    return false;
+                }
+                m_buffer.append(chunk, static_cast<std::size_t>(received));
+                return true;
+            }
+
+            static bool headerHas(const std::string &head, const char *name, const char *value)
+            {
+                const std::size_t at = head.find(name);
+                return at != std::string::npos && head.compare(at + std::strlen(name), std::strlen(value), value) == 0;
+            }
+
+            int readResponse(bool &closeAfter, ThreadResult &result)
+            {
+                std::size_t headEnd;
+                while ((headEnd = m_buffer.find("\r\n\r\n")) == std::string::npos)
+                {
+                    if (!fill())
+                    {
+                        return 0;
+                    }
+                }
+                const std::string head = m_buffer.substr(0, headEnd);
+                const int status = head.size() > 12 ? std::atoi(head.c_str() + 9) : 0;
+
+                std::size_t contentLength = 0;
+                const std::size_t lengthAt = head.find("Content-Length: ");
+                if (lengthAt != std::string::npos)
+                {
+                    contentLength = std::strtoul(head.c_str() + lengthAt + 16, nullptr, 10);
+                }
+                closeAfter = headerHas(head, "Connection: ", "close");
+
+                const std::size_t total = headEnd + 4 + contentLength;
+                while (m_buffer.size() < total)
+                {
+                    if (!fill())
+                    {
+                        return 0;
+                    }
+                }
+                result.bytes += total;
+                m_buffer.erase(0, total);
+                return status;
+            }
+    };
+
+    std::string requestFor(std::size_t player)
+    {
+        std::string request = "GET " + g_options.path + "?name=Player%20" + std::to_string(player) + " HTTP/1.1\r\nHost: " +
+                              g_options.host + "\r\n";
+        if (g_options.gzip)
+        {
+            request += "Accept-Encoding: gzip\r\n";
+        }
+        request += g_options.keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+        return request;
+    }
+
+    void runConnection(SSL_CTX *ctx, const sockaddr_storage &address, socklen_t addressLength, const NamePicker &names,
+                       ThreadResult &result)
+    {
+        std::mt19937_64 random(std::random_device{}());
+        Client client(ctx, address, addressLength);
+        while (!g_stop.load(std::memory_order_relaxed))
+        {
+            const std::string request = requestFor(names.pick(random));
+            const Clock::time_point start = Clock::now();
+            const int status = client.exchange(request, result);
+            const Clock::time_point end = Clock::now();
+            if (status == 0)
+            {
+                // Keep a refused or broken server from turning this into a busy loop.
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            if (!g_measuring.load(std::memory_order_relaxed))
+            {
+                continue;
+            }
+
+            ++result.statusClasses[status >= 100 && status < 600 ? status / 100 : 0];
+            if (status != 0)
+            {
+                const auto micros = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+                result.latencyMicros.push_back(static_cast<std::uint32_t>(std::min<std::int64_t>(micros, UINT32_MAX)));
+            }
+        }
+    }
+
+    bool resolve(sockaddr_storage &address, socklen_t &length)
+    {
+        addrinfo hints{};
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo *found = nullptr;
+        if (getaddrinfo(g_options.host.c_str(), std::to_string(g_options.port).c_str(), &hints, &found) != 0 || !found)
+        {
+            return false;
+        }
+        std::memcpy(&address, found->ai_addr, found->ai_addrlen);
+        length = found->ai_addrlen;
+        freeaddrinfo(found);
+        return true;
+    }
+
+    double percentileMs(const std::vector<std::uint32_t> &sorted, double q)
+    {
+        if (sorted.empty())
+        {
+            return 0;
+        }
+        const std::size_t rank = static_cast<std::size_t>(std::ceil(q * static_cast<double>(sorted.size())));
+        return sorted[std::min(std::max<std::size_t>(rank, 1), sorted.size()) - 1] / 1000.0;
+    }
+
+    void usage()
+    {
+        std::fprintf(stderr,
+                     "usage: loadgen [--host H] [--port N] [--connections N] [--duration S] [--warmup S]\n"
+                     "               [--keepalive 0|1] [--gzip] [--path /player] [--players N]\n"
+                     "               [--distribution zipf|uniform|single] [--zipf-s S]\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--gzip")
+        {
+            g_options.gzip = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            usage();
+            return 2;
+        }
+        const std::string value = argv[++i];
+        if (arg == "--host")
+        {
+            g_options.host = value;
+        }
+        else if (arg == "--port")
+        {
+            g_options.port = std::atoi(value.c_str());
+        }
+        else if (arg == "--connections")
+        {
+            g_options.connections = std::max(1, std::atoi(value.c_str()));
+        }
+        else if (arg == "--duration")
+        {
+            g_options.durationSeconds = std::atof(value.c_str());
+        }
+        else if (arg == "--warmup")
+        {
+            g_options.warmupSeconds = std::atof(value.c_str());
+        }
+        else if (arg == "--keepalive")
+        {
+            g_options.keepAlive = value != "0";
+        }
+        else if (arg == "--path")
+        {
+            g_options.path = value;
+        }
+        else if (arg == "--players")
+        {
+            g_options.players = std::strtoul(value.c_str(), nullptr, 10);
+        }
+        else if (arg == "--distribution" && (value == "zipf" || value == "uniform" || value == "single"))
+        {
+            g_options.distribution = value == "zipf" ? Distribution::Zipf : value == "uniform" ? Distribution::Uniform : Distribution::Single;
+        }
+        else if (arg == "--zipf-s")
+        {
+            g_options.zipfExponent = std::atof(value.c_str());
+        }
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+
+    sockaddr_storage address{};
+    socklen_t addressLength = 0;
+    if (!resolve(address, addressLength))
+    {
+        std::fprintf(stderr, "Cannot resolve %s\n", g_options.host.c_str());
+        return 1;
+    }
+
+    // Measures the server, not certificate checks; the proxy's certificate is usually self-signed here.
+    SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, nullptr);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT);
+
+    const NamePicker names(g_options);
+    std::vector<ThreadResult> results(g_options.connections);
+    std::vector<std::thread> threads;
+    threads.reserve(g_options.connections);
+    for (std::size_t i = 0; i < g_options.connections; ++i)
+    {
+        threads.emplace_back(runConnection, ctx, std::cref(address), addressLength, std::cref(names), std::ref(results[i]));
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(g_options.warmupSeconds));
+    g_measuring.store(true);
+    const Clock::time_point start = Clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(g_options.durationSeconds));
+    g_measuring.store(false);
+    const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    g_stop.store(true);
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    std::vector<std::uint32_t> latencies;
+    std::uint64_t statusClasses[6] = {};
+    std::uint64_t connects = 0;
+    std::uint64_t bytes = 0;
+    for (const ThreadResult &result : results)
+    {
+        latencies.insert(latencies.end(), result.latencyMicros.begin(), result.latencyMicros.end());
+        for (int c = 0; c < 6; ++c)
+        {
+            statusClasses[c] += result.statusClasses[c];
+        }
+        connects += result.connects;
+        bytes += result.bytes;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    const char *distribution = g_options.distribution == Distribution::Zipf ? "zipf" : g_options.distribution == Distribution::Uniform ? "uniform" : "single";
+    std::printf("%zu connections, keep-alive %s, %zu players (%s), %.1f s\n", g_options.connections,
+                g_options.keepAlive ? "on" : "off", g_options.players, distribution, elapsed);
+    std::printf("requests   %zu (%.1f req/s, %.2f MB/s), %llu connects\n", latencies.size(), latencies.size() / elapsed,
+                bytes / elapsed / 1e6, static_cast<unsigned long long>(connects));
+    std::printf("status     2xx %llu  3xx %llu  4xx %llu  5xx %llu  failed %llu\n",
+                static_cast<unsigned long long>(statusClasses[2]), static_cast<unsigned long long>(statusClasses[3]),
+                static_cast<unsigned long long>(statusClasses[4]), static_cast<unsigned long long>(statusClasses[5]),
+                static_cast<unsigned long long>(statusClasses[0] + statusClasses[1]));
+    std::printf("latency ms p50 %.3f  p90 %.3f  p99 %.3f  p999 %.3f  max %.3f\n", percentileMs(latencies, 0.5),
+                percentileMs(latencies, 0.9), percentileMs(latencies, 0.99), percentileMs(latencies, 0.999),
+                latencies.empty() ? 0.0 : latencies.back() / 1000.0);
+
+    SSL_CTX_free(ctx);
+    return statusClasses[0] > 0 && latencies.empty() ? 1 : 0;
+}
@@ -0,0 +1,317 @@
+// Local stand-in for the hiscore service, so the proxy can be load-tested
+// offline. Answers every GET with an index_lite.ws body from bench/data after
+// a configurable delay, and fails a configurable share of requests.
+//
+//   build/stub_hiscore --port 8443 --cert server.crt --key server.key --latency-ms 40 --jitter-ms 20 --error-rate 0.01
+//
+// Players whose name starts with "missing" always get 404 and "fail" always
+// gets 503, so both paths can be hit on purpose. The proxy reaches the stub
+// with HTTPS_UPSTREAM_HOST=localhost HTTPS_UPSTREAM_PORT=8443 OSRS_CA_BUNDLE=server.crt.
+
+#include "http_request.h"
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+namespace {
+    struct StubOptions
+    {
+        int port = 8443;
+        std::string certificateFile = "server.crt";
+        std::string privateKeyFile = "server.key";
+        std::string dataDir = "bench/data";
+        // Every answer waits latencyMs plus an exponentially distributed extra
+        // with mean jitterMs, which gives the long tail a real service has.
+        double latencyMs = 0;
+        double jitterMs = 0;
+        // Shares of requests answered 503 and 404.
+        double errorRate = 0;
+        double notFoundRate = 0;
+    };
+
+    struct Counters
+    {
+        std::atomic<std::uint64_t> connections{0};
+        std::atomic<std::uint64_t> requests{0};
+        std::atomic<std::uint64_t> errors{0};
+        std::atomic<std::uint64_t> notFound{0};
+    };
+
+    StubOptions g_options;
+    std::vector<std::string> g_bodies;
+    Counters g_counters;
+
+    std::string readFile(const std::string &path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        std::ostringstream contents;
+        contents << file.rdbuf();
+        return contents.str();
+    }
+
+    std::mt19937_64 &random()
+    {
+        thread_local std::mt19937_64 engine(std::random_device{}() ^ std::hash<std::thread::id>()(std::this_thread::get_id()));
+        return engine;
+    }
+
+    bool chance(double probability)
+    {
+        return probability > 0 && std::uniform_real_distribution<double>(0, 1)(random()) < probability;
+    }
+
+    std::chrono::microseconds answerDelay()
+    {
+        double ms = g_options.latencyMs;
+        if (g_options.jitterMs > 0)
+        {
+            ms += std::exponential_distribution<double>(1.0 / g_options.jitterMs)(random());
+        }
+        return std::chrono::microseconds(static_cast<std::int64_t>(ms * 1000));
+    }
+
+    bool writeAll(SSL *ssl, const std::string &data)
+    {
+        std::size_t offset = 0;
+        while (offset < data.size())
+        {
+            const int written = SSL_write(ssl, data.data() + offset, static_cast<int>(data.size() - offset));
+            if (written <= 0)
+            {
+                return false;
+            }
+            offset += static_cast<std::size_t>(written);
+        }
+        return true;
+    }
+
+    // Answers requests on one connection until the client closes it.
+    void serve(SSL_CTX *ctx, int socket)
+    {
+        SSL *ssl = SSL_new(ctx);
+        SSL_set_fd(ssl, socket);
+        if (SSL_accept(ssl) != 1)
+        {
+            SSL_free(ssl);
+            close(socket);
+            return;
+        }
+        g_counters.connections.fetch_add(1, std::memory_order_relaxed);
+
+        std::string buffer;
+        std::string name;
+        char chunk[4096];
+        bool open = true;
+        while (open)
+        {
+            std::size_t headEnd;
+            while ((headEnd = buffer.find("\r\n\r\n")) == std::string::npos)
+            {
+                const int received = SSL_read(ssl, chunk, sizeof(chunk));
+                if (received <= 0)
+                {
+                    open = false;
+                    break;
+                }
+                buffer.append(chunk, static_cast<std::size_t>(received));
+            }
+            if (!open)
+            {
+                break;
+            }
+
+            // GET /m=hiscore_oldschool/index_lite.ws?player=NAME HTTP/1.1
+            const std::string head = buffer.substr(0, headEnd);
+            buffer.erase(0, headEnd + 4);
+            const std::size_t targetStart = head.find(' ') + 1;
+            const std::string target = head.substr(targetStart, head.find(' ', targetStart) - targetStart);
+            const std::size_t queryStart = target.find('?');
+            name.clear();
+            if (queryStart != std::string::npos)
+            {
+                https::findQueryParam(std::string_view(target).substr(queryStart + 1), "player", name);
+            }
+            const bool closeAfter = head.find("Connection: close") != std::string::npos;
+            g_counters.requests.fetch_add(1, std::memory_order_relaxed);
+
+            std::this_thread::sleep_for(answerDelay());
+
+            std::string response;
+            const std::string connection = closeAfter ? "Connection: close\r\n" : "Connection: keep-alive\r\n";
+            if (name.rfind("fail", 0) == 0 || chance(g_options.errorRate))
+            {
+                g_counters.errors.fetch_add(1, std::memory_order_relaxed);
+                response = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n" + connection + "\r\n";
+            }
+            else if (name.rfind("missing", 0) == 0 || chance(g_options.notFoundRate))
+            {
+                g_counters.notFound.fetch_add(1, std::memory_order_relaxed);
+                response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n" + connection + "\r\n";
+            }
+            else
+            {
+                // The same player always gets the same body.
+                const std::string &body = g_bodies[std::hash<std::string>()(name) % g_bodies.size()];
+                response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: " + std::to_string(body.size()) +
+                           "\r\n" + connection + "\r\n" + body;
+            }
+
+            open = writeAll(ssl, response) && !closeAfter;
+        }
+
+        SSL_shutdown(ssl);
+        SSL_free(ssl);
+        close(socket);
+    }
+
+    void reportLoop()
+    {
+        std::uint64_t last = 0;
+        while (true)
+        {
+            std::this_thread::sleep_for(std::chrono::seconds(5));
+            const std::uint64_t requests = g_counters.requests.load(std::memory_order_relaxed);
+            if (requests != last)
+            {
+                std::printf("stub: %llu requests (%.0f/s), %llu connections, %llu 503, %llu 404\n",
+                            static_cast<unsigned long long>(requests), (requests - last) / 5.0,
+                            static_cast<unsigned long long>(g_counters.connections.load(std::memory_order_relaxed)),
+                            static_cast<unsigned long long>(g_counters.errors.load(std::memory_order_relaxed)),
+                            static_cast<unsigned long long>(g_counters.notFound.load(std::memory_order_relaxed)));
+                std::fflush(stdout);
+                last = requests;
+            }
+        }
+    }
+
+    void usage()
+    {
+        std::fprintf(stderr,
+                     "usage: stub_hiscore [--port N] [--cert FILE] [--key FILE] [--data DIR]\n"
+                     "                    [--latency-ms MS] [--jitter-ms MS] [--error-rate P] [--not-found-rate P]\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            usage();
+            return 2;
+        }
+        const char *value = argv[++i];
+        if (arg == "--port")
+        {
+            g_options.port = std::atoi(value);
+        }
+        else if (arg == "--cert")
+        {
+            g_options.certificateFile = value;
+        }
+        else if (arg == "--key")
+        {
+            g_options.privateKeyFile = value;
+        }
+        else if (arg == "--data")
+        {
+            g_options.dataDir = value;
+        }
+        else if (arg == "--latency-ms")
+        {
+            g_options.latencyMs = std::atof(value);
+        }
+        else if (arg == "--jitter-ms")
+        {
+            g_options.jitterMs = std::atof(value);
+        }
+        else if (arg == "--error-rate")
+        {
+            g_options.errorRate = std::atof(value);
+        }
+        else if (arg == "--not-found-rate")
+        {
+            g_options.notFoundRate = std::atof(value);
+        }
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+
+    for (const char *file : {"index_lite_maxed.txt", "index_lite_mid.txt"})
+    {
+        std::string body = readFile(g_options.dataDir + "/" + file);
+        if (!body.empty())
+        {
+            g_bodies.push_back(std::move(body));
+        }
+    }
+    if (g_bodies.empty())
+    {
+        std::fprintf(stderr, "No index_lite bodies found in %s\n", g_options.dataDir.c_str());
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    if (!ctx || SSL_CTX_use_certificate_chain_file(ctx, g_options.certificateFile.c_str()) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx, g_options.privateKeyFile.c_str(), SSL_FILETYPE_PEM) != 1)
+    {
+        ERR_print_errors_fp(stderr);
+        return 1;
+    }
+
+    const int listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    const int enable = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<std::uint16_t>(g_options.port));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 || listen(listener, SOMAXCONN) < 0)
+    {
+        std::perror("stub_hiscore: bind/listen");
+        return 1;
+    }
+
+    std::printf("stub: listening on 127.0.0.1:%d, latency %.1f ms + exp(%.1f ms), 503 rate %.3f, 404 rate %.3f\n",
+                g_options.port, g_options.latencyMs, g_options.jitterMs, g_options.errorRate, g_options.notFoundRate);
+    std::fflush(stdout);
+    std::thread(reportLoop).detach();
+
+    // The proxy keeps a small pool of keep-alive connections, so a thread per connection is plenty.
+    while (true)
+    {
+        const int client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0)
+        {
+            continue;
+        }
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        std::thread(serve, ctx, client).detach();
+    }
+}
@@ -0,0 +1,146 @@
+#include "upstream_guard.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace https
+{
+    const char *breakerStateName(UpstreamGuard::BreakerState state)
+    {
+        switch (state)
+        {
+        case UpstreamGuard::BreakerState::Open:
+            return "open";
+        case UpstreamGuard::BreakerState::HalfOpen:
+            return "half_open";
+        default:
+            return "closed";
+        }
+    }
+
+    UpstreamGuard::UpstreamGuard(UpstreamGuardOptions options) : m_options(options),
+                                                                 m_limit(0),
+                                                                 m_inFlight(0),
+                                                                 m_lastBackoff(),
+                                                                 m_state(BreakerState::Closed),
+                                                                 m_consecutiveFailures(0),
+                                                                 m_openUntil(),
+                                                                 m_probing(false),
+                                                                 m_rejected(0),
+                                                                 m_trips(0)
+    {
+        m_options.minLimit = std::max<std::size_t>(m_options.minLimit, 1);
+        m_options.maxLimit = std::max(m_options.maxLimit, m_options.minLimit);
+        m_limit = static_cast<double>(std::min(std::max(m_options.initialLimit, m_options.minLimit), m_options.maxLimit));
+    }
+
+    UpstreamGuard::Admission UpstreamGuard::acquire(Clock::time_point deadline, bool &probe)
+    {
+        probe = false;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        const Clock::time_point now = Clock::now();
+        if (m_state == BreakerState::Open)
+        {
+            if (now < m_openUntil)
+            {
+                ++m_rejected;
+                return Admission::CircuitOpen;
+            }
+            m_state = BreakerState::HalfOpen;
+            m_probing = false;
+        }
+        if (m_state == BreakerState::HalfOpen)
+        {
+            // One call tests the water; the rest keep failing fast until it reports back.
+            if (m_probing)
+            {
+                ++m_rejected;
+                return Admission::CircuitOpen;
+            }
+            m_probing = true;
+            probe = true;
+            ++m_inFlight;
+            return Admission::Admitted;
+        }
+
+        const bool admitted = m_permitFreed.wait_until(lock, deadline, [this] {
+            return m_state != BreakerState::Closed || m_inFlight < static_cast<std::size_t>(m_limit);
+        });
+        if (m_state != BreakerState::Closed)
+        {
+            // The breaker tripped while this call was waiting.
+            ++m_rejected;
+            return Admission::CircuitOpen;
+        }
+        if (!admitted)
+        {
+            return Admission::TimedOut;
+        }
+        ++m_inFlight;
+        return Admission::Admitted;
+    }
+
+    void UpstreamGuard::release(bool probe, bool failed, std::chrono::microseconds latency)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            const Clock::time_point now = Clock::now();
+            --m_inFlight;
+
+            const bool slow = latency > std::chrono::milliseconds(m_options.latencyTargetMs);
+            if (probe)
+            {
+                m_probing = false;
+                m_consecutiveFailures = 0;
+                if (failed)
+                {
+                    trip(now);
+                }
+                else
+                {
+                    m_state = BreakerState::Closed;
+                }
+            }
+            else if (m_state == BreakerState::Closed)
+            {
+                m_consecutiveFailures = failed ? m_consecutiveFailures + 1 : 0;
+                if (m_consecutiveFailures >= m_options.failureThreshold)
+                {
+                    trip(now);
+                }
+            }
+
+            if (failed || slow)
+            {
+                // Multiplicative decrease, at most once per latency target so that one
+                // burst of failures landing together does not collapse the limit to the floor.
+                if (now - m_lastBackoff >= std::chrono::milliseconds(m_options.latencyTargetMs))
+                {
+                    m_limit = std::max(static_cast<double>(m_options.minLimit), std::floor(m_limit * m_options.backoffRatio));
+                    m_lastBackoff = now;
+                }
+            }
+            else
+            {
+                // Additive increase: about one more permit per limit's worth of healthy calls.
+                m_limit = std::min(static_cast<double>(m_options.maxLimit), m_limit + 1.0 / m_limit);
+            }
+        }
+        m_permitFreed.notify_all();
+    }
+
+    void UpstreamGuard::trip(Clock::time_point now)
+    {
+        m_state = BreakerState::Open;
+        m_openUntil = now + std::chrono::seconds(m_options.openSeconds);
+        m_probing = false;
+        m_consecutiveFailures = 0;
+        ++m_trips;
+    }
+
+    UpstreamGuard::Stats UpstreamGuard::stats() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return Stats{m_limit, m_inFlight, m_state, m_rejected, m_trips};
+    }
+} // namespace https
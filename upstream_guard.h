@@ -0,0 +1,98 @@
+#ifndef INCLUDED_UPSTREAM_GUARD
+#define INCLUDED_UPSTREAM_GUARD
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace https
+{
+    struct UpstreamGuardOptions
+    {
+        // AIMD bounds on concurrent upstream calls. The limit grows by one per
+        // limit's worth of healthy calls and shrinks by backoffRatio on congestion.
+        std::size_t initialLimit = 8;
+        std::size_t minLimit = 1;
+        std::size_t maxLimit = 16;
+        double backoffRatio = 0.7;
+        // Successful calls slower than this count as congestion too.
+        int latencyTargetMs = 1000;
+        // Consecutive failures (5xx, 429, timeouts, connection errors) that open the breaker.
+        int failureThreshold = 5;
+        // How long an open breaker rejects calls before letting one probe through.
+        int openSeconds = 5;
+    };
+
+    // Admission control for calls to one upstream service: an adaptive
+    // concurrency limit, so a slow upstream is not also flooded, and a circuit
+    // breaker, so an unhealthy one is not called at all. Thread-safe.
+    class UpstreamGuard
+    {
+        public:
+            enum class BreakerState
+            {
+                Closed,   // calls flow normally
+                Open,     // every call is rejected until openSeconds have passed
+                HalfOpen  // one probe call decides whether to close or reopen
+            };
+
+            enum class Admission
+            {
+                Admitted,    // make the call, then report it with release()
+                CircuitOpen, // fail fast without calling
+                TimedOut     // no permit freed up before the deadline
+            };
+
+            struct Stats
+            {
+                double limit;
+                std::size_t inFlight;
+                BreakerState state;
+                std::uint64_t rejected; // calls refused by the breaker
+                std::uint64_t trips;    // times the breaker opened
+            };
+
+            explicit UpstreamGuard(UpstreamGuardOptions options = UpstreamGuardOptions());
+
+            UpstreamGuard(const UpstreamGuard &) = delete;
+            UpstreamGuard &operator=(const UpstreamGuard &) = delete;
+
+            // Waits until the concurrency limit has room, or deadline passes. probe
+            // is set when the call was admitted as the half-open probe.
+            Admission acquire(std::chrono::steady_clock::time_point deadline, bool &probe);
+            // Ends an admitted call and feeds its outcome back into the limit. Only
+            // the probe decides a half-open breaker; calls admitted before it opened
+            // may still be finishing, and count towards the breaker again once it
+            // has closed.
+            void release(bool probe, bool failed, std::chrono::microseconds latency);
+
+            Stats stats() const;
+
+        private:
+            using Clock = std::chrono::steady_clock;
+
+            UpstreamGuardOptions m_options;
+
+            mutable std::mutex m_mutex;
+            std::condition_variable m_permitFreed;
+            double m_limit;
+            std::size_t m_inFlight;
+            Clock::time_point m_lastBackoff;
+
+            BreakerState m_state;
+            int m_consecutiveFailures;
+            Clock::time_point m_openUntil;
+            bool m_probing; // the half-open probe is in flight
+
+            std::uint64_t m_rejected;
+            std::uint64_t m_trips;
+
+            void trip(Clock::time_point now);
+    };
+
+    const char *breakerStateName(UpstreamGuard::BreakerState state);
+} // namespace https
+
+#endif
@@ -0,0 +1,193 @@
+#include "upstream_pool.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace https
+{
+    UpstreamPool::Lease::Lease(UpstreamPool *pool, std::unique_ptr<HttpsClient> client, bool reused) : m_pool(pool),
+                                                                                                       m_client(std::move(client)),
+                                                                                                       m_reused(reused)
+    {
+    }
+
+    UpstreamPool::Lease::Lease(Lease &&other) noexcept : m_pool(other.m_pool),
+                                                         m_client(std::move(other.m_client)),
+                                                         m_reused(other.m_reused),
+                                                         m_keepAlive(other.m_keepAlive)
+    {
+        other.m_pool = nullptr;
+    }
+
+    UpstreamPool::Lease &UpstreamPool::Lease::operator=(Lease &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            m_pool = other.m_pool;
+            m_client = std::move(other.m_client);
+            m_reused = other.m_reused;
+            m_keepAlive = other.m_keepAlive;
+            other.m_pool = nullptr;
+        }
+        return *this;
+    }
+
+    UpstreamPool::Lease::~Lease()
+    {
+        reset();
+    }
+
+    void UpstreamPool::Lease::reset()
+    {
+        if (m_pool && m_client)
+        {
+            m_pool->release(std::move(m_client), m_keepAlive);
+        }
+        m_pool = nullptr;
+        m_client.reset();
+        m_keepAlive = false;
+    }
+
+    UpstreamPool::UpstreamPool(std::string hostname, int port, std::string caCertPath, UpstreamPoolOptions options) : m_hostname(std::move(hostname)),
+                                                                                                                      m_port(port),
+                                                                                                                      m_caCertPath(std::move(caCertPath)),
+                                                                                                                      m_options(options),
+                                                                                                                      m_tls(ClientTlsContext::forCaBundle(m_caCertPath)),
+                                                                                                                      m_open(0)
+    {
+        if (m_options.maxConnections == 0)
+        {
+            m_options.maxConnections = 1;
+        }
+        if (!m_options.dns)
+        {
+            m_options.dns = std::make_shared<DnsCache>(m_options.dnsOptions);
+        }
+        // Resolved in the background while the server starts, so no request waits on it.
+        m_options.dns->prefetch(m_hostname, m_port);
+    }
+
+    UpstreamPool::~UpstreamPool() = default;
+
+    ClientTlsContext::Stats UpstreamPool::tlsStats() const
+    {
+        return m_tls ? m_tls->stats() : ClientTlsContext::Stats{};
+    }
+
+    DnsCache::Stats UpstreamPool::dnsStats() const
+    {
+        return m_options.dns->stats();
+    }
+
+    UpstreamPool::Lease UpstreamPool::acquire(std::chrono::steady_clock::time_point deadline, UpstreamTimings *timings)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const auto waitLimit = std::min(deadline, start + std::chrono::milliseconds(m_options.acquireTimeoutMs));
+        const auto idleTimeout = std::chrono::seconds(m_options.idleTimeoutSeconds);
+        UpstreamTimings scratch;
+        if (!timings)
+        {
+            timings = &scratch;
+        }
+        auto stopWaiting = [&]() {
+            (*timings)[UpstreamStage::Acquire] += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        };
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true)
+        {
+            // Close connections that sat idle too long; the server has likely dropped them anyway.
+            std::vector<std::unique_ptr<HttpsClient>> expired;
+            const auto now = std::chrono::steady_clock::now();
+            while (!m_idle.empty() && now - m_idle.front().idleSince > idleTimeout)
+            {
+                expired.push_back(std::move(m_idle.front().client));
+                m_idle.pop_front();
+                --m_open;
+            }
+
+            if (!m_idle.empty())
+            {
+                // Most recently used first: it is the least likely to have been closed by the server.
+                std::unique_ptr<HttpsClient> client = std::move(m_idle.back().client);
+                m_idle.pop_back();
+                lock.unlock();
+                expired.clear();
+
+                if (client->isReusable())
+                {
+                    stopWaiting();
+                    return Lease(this, std::move(client), true);
+                }
+
+                client.reset();
+                lock.lock();
+                --m_open;
+                continue;
+            }
+
+            if (m_open < m_options.maxConnections)
+            {
+                ++m_open;
+                lock.unlock();
+                expired.clear();
+                stopWaiting();
+
+                auto client = std::make_unique<HttpsClient>(m_hostname, m_port, m_caCertPath, m_options.dns);
+                client->setDeadline(deadline);
+                const bool connected = client->connectToServer();
+                timings->add(client->timings());
+                if (connected)
+                {
+                    return Lease(this, std::move(client), false);
+                }
+
+                client.reset();
+                lock.lock();
+                --m_open;
+                m_available.notify_one();
+                return Lease();
+            }
+
+            if (!expired.empty())
+            {
+                // Shut the expired connections down without holding the lock, then look again.
+                lock.unlock();
+                expired.clear();
+                lock.lock();
+                continue;
+            }
+
+            if (m_available.wait_until(lock, waitLimit) == std::cv_status::timeout &&
+                m_idle.empty() && m_open >= m_options.maxConnections)
+            {
+                stopWaiting();
+                if (waitLimit == deadline)
+                {
+                    timings->timedOut = UpstreamStage::Acquire;
+                }
+                return Lease();
+            }
+        }
+    }
+
+    void UpstreamPool::release(std::unique_ptr<HttpsClient> client, bool keepAlive)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (keepAlive)
+        {
+            m_idle.push_back(IdleConnection{std::move(client), std::chrono::steady_clock::now()});
+        }
+        else
+        {
+            --m_open;
+        }
+        lock.unlock();
+        m_available.notify_one();
+
+        // A discarded connection is shut down here, outside the lock.
+        client.reset();
+    }
+} // namespace https
@@ -0,0 +1,105 @@
+#ifndef INCLUDED_UPSTREAM_POOL
+#define INCLUDED_UPSTREAM_POOL
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "dns_cache.h"
+#include "https_client.h"
+#include "tls_client_context.h"
+
+namespace https
+{
+    struct UpstreamPoolOptions
+    {
+        // Connections open at once, leased and idle together.
+        std::size_t maxConnections = 16;
+        // Idle connections older than this are closed instead of reused.
+        int idleTimeoutSeconds = 30;
+        // How long acquire() waits for a free slot when the pool is full.
+        int acquireTimeoutMs = 5000;
+        // Resolver cache for the upstream host. Left empty, the pool builds its own from
+        // dnsOptions; tests can pass one constructed with a fake resolver.
+        std::shared_ptr<DnsCache> dns;
+        DnsCacheOptions dnsOptions;
+    };
+
+    // Keep-alive TLS connections to one upstream host, shared by every thread
+    // that calls acquire().
+    class UpstreamPool
+    {
+        public:
+            // Exclusive use of one connection. Unless keepAlive() is called the
+            // connection is closed when the lease ends; otherwise it goes back
+            // to the pool for the next caller.
+            class Lease
+            {
+                public:
+                    Lease() = default;
+                    Lease(Lease &&other) noexcept;
+                    Lease &operator=(Lease &&other) noexcept;
+                    ~Lease();
+
+                    explicit operator bool() const { return m_client != nullptr; }
+                    HttpsClient *operator->() const { return m_client.get(); }
+
+                    // True when the connection was taken from the pool rather than opened for this lease.
+                    bool reused() const { return m_reused; }
+                    void keepAlive() { m_keepAlive = true; }
+
+                private:
+                    friend class UpstreamPool;
+                    Lease(UpstreamPool *pool, std::unique_ptr<HttpsClient> client, bool reused);
+                    void reset();
+
+                    UpstreamPool *m_pool = nullptr;
+                    std::unique_ptr<HttpsClient> m_client;
+                    bool m_reused = false;
+                    bool m_keepAlive = false;
+            };
+
+            UpstreamPool(std::string hostname, int port, std::string caCertPath, UpstreamPoolOptions options = UpstreamPoolOptions());
+            ~UpstreamPool();
+
+            UpstreamPool(const UpstreamPool &) = delete;
+            UpstreamPool &operator=(const UpstreamPool &) = delete;
+
+            // Returns a healthy idle connection, or opens a new one. The lease is
+            // empty if connecting fails or no slot frees up within the timeout or
+            // before deadline. When given, timings receives the time spent waiting
+            // and connecting, and the stage the deadline ran out in.
+            Lease acquire(std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max(),
+                          UpstreamTimings *timings = nullptr);
+
+            // Session resumption counters of the shared client TLS context.
+            ClientTlsContext::Stats tlsStats() const;
+            DnsCache::Stats dnsStats() const;
+
+        private:
+            struct IdleConnection
+            {
+                std::unique_ptr<HttpsClient> client;
+                std::chrono::steady_clock::time_point idleSince;
+            };
+
+            std::string m_hostname;
+            int m_port;
+            std::string m_caCertPath;
+            UpstreamPoolOptions m_options;
+            std::shared_ptr<ClientTlsContext> m_tls; // built up front so the first fetch does not pay for it
+
+            std::mutex m_mutex;
+            std::condition_variable m_available;
+            std::deque<IdleConnection> m_idle; // oldest at the front
+            std::size_t m_open;                // leased + idle
+
+            void release(std::unique_ptr<HttpsClient> client, bool keepAlive);
+    };
+} // namespace https
+
+#endif
@@ -0,0 +1,41 @@
+#include "upstream_timing.h"
+
+namespace https
+{
+    const char *stageName(UpstreamStage stage)
+    {
+        switch (stage)
+        {
+        case UpstreamStage::Queue:
+            return "queue";
+        case UpstreamStage::Acquire:
+            return "acquire";
+        case UpstreamStage::Dns:
+            return "dns";
+        case UpstreamStage::Connect:
+            return "connect";
+        case UpstreamStage::Handshake:
+            return "handshake";
+        case UpstreamStage::Write:
+            return "write";
+        case UpstreamStage::Ttfb:
+            return "ttfb";
+        case UpstreamStage::Body:
+            return "body";
+        default:
+            return "none";
+        }
+    }
+
+    void UpstreamTimings::add(const UpstreamTimings &other)
+    {
+        for (std::size_t i = 0; i < kUpstreamStageCount; ++i)
+        {
+            elapsed[i] += other.elapsed[i];
+        }
+        if (other.timedOut != UpstreamStage::None)
+        {
+            timedOut = other.timedOut;
+        }
+    }
+} // namespace https
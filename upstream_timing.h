@@ -0,0 +1,44 @@
+#ifndef INCLUDED_UPSTREAM_TIMING
+#define INCLUDED_UPSTREAM_TIMING
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+
+namespace https
+{
+    // The steps of one upstream request, in the order they happen. Pooled
+    // connections skip Dns, Connect and Handshake.
+    enum class UpstreamStage
+    {
+        None,
+        Queue,   // waiting for an upstream thread
+        Acquire, // waiting for a free pool slot
+        Dns,
+        Connect,
+        Handshake,
+        Write,
+        Ttfb, // request written to the first response bytes
+        Body, // first response bytes to the end of the body
+        Count
+    };
+
+    constexpr std::size_t kUpstreamStageCount = static_cast<std::size_t>(UpstreamStage::Count);
+
+    // Lower-case name used in logs, error messages and metrics, e.g. "handshake".
+    const char *stageName(UpstreamStage stage);
+
+    // Where one upstream request spent its time.
+    struct UpstreamTimings
+    {
+        std::array<std::chrono::microseconds, kUpstreamStageCount> elapsed{};
+        // The stage the deadline ran out in, or None.
+        UpstreamStage timedOut = UpstreamStage::None;
+
+        std::chrono::microseconds &operator[](UpstreamStage stage) { return elapsed[static_cast<std::size_t>(stage)]; }
+        // Adds other's times to these and takes its timeout, if it has one.
+        void add(const UpstreamTimings &other);
+    };
+} // namespace https
+
+#endif
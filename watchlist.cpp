@@ -0,0 +1,200 @@
+#include "watchlist.h"
+
+#include <algorithm>
+#include <functional>
+#include <unordered_set>
+#include <utility>
+
+namespace {
+    constexpr std::size_t kCounterShards = 16;
+    // The scheduler wakes this often to look for players coming due.
+    constexpr std::chrono::milliseconds kTick(250);
+}
+
+namespace osrs {
+
+Watchlist::Watchlist(PlayerService &service, PlayerCache &cache, WatchlistOptions options)
+    : m_service(service),
+      m_cache(cache),
+      m_options(std::move(options)),
+      m_counters(kCounterShards),
+      // Room for several times the players that can be promoted, so newcomers can compete.
+      m_shardCapacity(std::max<std::size_t>(m_options.topPlayers * 8 / kCounterShards, 64)),
+      m_cursor(0),
+      m_random(std::random_device{}()),
+      m_watchedCount(0),
+      m_refreshes(0),
+      m_stopping(false)
+{
+    std::unordered_set<std::string> seen;
+    std::vector<std::string> names;
+    for (const std::string &name : m_options.names)
+    {
+        std::string key = normalizeName(name);
+        if (!key.empty() && seen.insert(key).second)
+        {
+            m_keys.push_back(std::move(key));
+            names.push_back(name);
+        }
+    }
+    m_options.names = std::move(names);
+
+    m_scheduler = std::thread(&Watchlist::run, this);
+}
+
+Watchlist::~Watchlist()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    m_scheduler.join();
+}
+
+void Watchlist::recordAccess(const std::string &key)
+{
+    if (m_options.topPlayers == 0)
+    {
+        return;
+    }
+
+    CounterShard &shard = m_counters[std::hash<std::string>()(key) % m_counters.size()];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.counts.find(key);
+    if (it != shard.counts.end())
+    {
+        if (it->second != UINT32_MAX)
+        {
+            ++it->second;
+        }
+    }
+    else if (shard.counts.size() < m_shardCapacity)
+    {
+        shard.counts.emplace(key, 1);
+    }
+}
+
+Watchlist::Stats Watchlist::stats() const
+{
+    return Stats{m_watchedCount.load(std::memory_order_relaxed), m_refreshes.load(std::memory_order_relaxed)};
+}
+
+Watchlist::Clock::duration Watchlist::jitteredLead()
+{
+    const int jitterMs = std::max(m_options.refreshJitterSeconds, 0) * 1000;
+    return std::chrono::seconds(m_options.refreshAheadSeconds) +
+           std::chrono::milliseconds(std::uniform_int_distribution<int>(0, jitterMs)(m_random));
+}
+
+void Watchlist::rank(Clock::time_point now)
+{
+    std::vector<std::pair<std::uint32_t, std::string>> candidates;
+    if (m_options.topPlayers > 0)
+    {
+        for (CounterShard &shard : m_counters)
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            for (auto it = shard.counts.begin(); it != shard.counts.end();)
+            {
+                if (it->second >= m_options.minRequests)
+                {
+                    candidates.emplace_back(it->second, it->first);
+                }
+                it->second /= 2;
+                it = it->second == 0 ? shard.counts.erase(it) : std::next(it);
+            }
+        }
+
+        const std::size_t top = std::min(candidates.size(), m_options.topPlayers);
+        std::partial_sort(candidates.begin(), candidates.begin() + static_cast<std::ptrdiff_t>(top), candidates.end(),
+                          [](const auto &a, const auto &b) { return a.first > b.first; });
+        candidates.resize(top);
+    }
+
+    // Players that stay on the list keep their schedule.
+    std::unordered_map<std::string, Watched> previous;
+    for (Watched &watched : m_watched)
+    {
+        std::string key = watched.key;
+        previous.emplace(std::move(key), std::move(watched));
+    }
+    m_watched.clear();
+
+    auto watch = [&](const std::string &key, const std::string &name) {
+        auto it = previous.find(key);
+        if (it == previous.end())
+        {
+            m_watched.push_back(Watched{key, name, jitteredLead(), now});
+            return;
+        }
+        m_watched.push_back(std::move(it->second));
+        previous.erase(it);
+    };
+    for (std::size_t i = 0; i < m_keys.size(); ++i)
+    {
+        watch(m_keys[i], m_options.names[i]);
+    }
+    for (const auto &candidate : candidates)
+    {
+        if (std::find(m_keys.begin(), m_keys.end(), candidate.second) == m_keys.end())
+        {
+            // Only the key was counted; a cached entry supplies the display name.
+            watch(candidate.second, candidate.second);
+        }
+    }
+
+    m_cursor = m_watched.empty() ? 0 : m_cursor % m_watched.size();
+    m_watchedCount.store(m_watched.size(), std::memory_order_relaxed);
+}
+
+void Watchlist::run()
+{
+    const double rate = std::max(m_options.refreshesPerSecond, 1);
+    double tokens = rate; // a second's worth, so the configured names are fetched right away
+    Clock::time_point last = Clock::now();
+    Clock::time_point nextRank = last;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopping)
+    {
+        const Clock::time_point now = Clock::now();
+        tokens = std::min(rate, tokens + rate * std::chrono::duration<double>(now - last).count());
+        last = now;
+        lock.unlock();
+
+        if (now >= nextRank)
+        {
+            rank(now);
+            nextRank = now + std::chrono::seconds(std::max(m_options.rankSeconds, 1));
+        }
+
+        // Round robin from where the last tick ran out of budget, so every player gets its turn.
+        std::vector<std::string> due;
+        for (std::size_t seen = 0; seen < m_watched.size() && tokens >= 1; ++seen)
+        {
+            Watched &watched = m_watched[m_cursor];
+            m_cursor = (m_cursor + 1) % m_watched.size();
+            if (now < watched.nextCheck || !m_cache.expiresWithin(watched.key, watched.lead))
+            {
+                continue;
+            }
+
+            due.push_back(watched.name);
+            tokens -= 1;
+            // Leaves the fetch time to land; if it fails, this is when it is retried.
+            watched.lead = jitteredLead();
+            watched.nextCheck = now + std::chrono::seconds(std::max(m_options.refreshAheadSeconds / 2, 1));
+        }
+        if (!due.empty())
+        {
+            m_refreshes.fetch_add(due.size(), std::memory_order_relaxed);
+            m_service.refreshManyAsync(std::move(due), m_options.parallelism);
+        }
+
+        lock.lock();
+        m_wake.wait_for(lock, kTick, [this] { return m_stopping; });
+    }
+}
+
+} // namespace osrs
@@ -0,0 +1,111 @@
+#ifndef OSRS_WATCHLIST_H
+#define OSRS_WATCHLIST_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "player_cache.h"
+#include "player_service.h"
+
+namespace osrs {
+
+struct WatchlistOptions {
+    // Always watched, e.g. from HTTPS_WATCHLIST, and fetched under this spelling
+    // until the cache holds one.
+    std::vector<std::string> names;
+    // The most requested players are watched too, re-ranked every
+    // rankSeconds from recordAccess() counts (0 watches only names).
+    std::size_t topPlayers = 0;
+    int rankSeconds = 60;
+    // Requests a player needs since the last ranking to be considered.
+    std::uint32_t minRequests = 3;
+    // Watched players are fetched again this long before their cache entry
+    // expires, plus a random extra of up to refreshJitterSeconds so that
+    // players loaded together do not come due together.
+    int refreshAheadSeconds = 10;
+    int refreshJitterSeconds = 5;
+    // Background fetches started per second at most, and how many of them
+    // may run at once, so prefetching never crowds out user requests.
+    int refreshesPerSecond = 5;
+    std::size_t parallelism = 4;
+
+    bool enabled() const { return !names.empty() || topPlayers > 0; }
+};
+
+// Keeps popular players fresh in the cache: a scheduler thread fetches each
+// watched player again shortly before its entry expires, so requests for
+// them keep hitting the cache. Thread-safe.
+class Watchlist {
+public:
+    struct Stats {
+        std::size_t watched;
+        std::uint64_t refreshes; // background fetches handed to the player service
+    };
+
+    Watchlist(PlayerService &service, PlayerCache &cache, WatchlistOptions options);
+    ~Watchlist();
+
+    Watchlist(const Watchlist &) = delete;
+    Watchlist &operator=(const Watchlist &) = delete;
+
+    // Counts a request for a normalized key towards the next ranking. A lock
+    // on one of several shards; new names are dropped while a shard is full.
+    void recordAccess(const std::string &key);
+
+    Stats stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Watched {
+        std::string key;
+        std::string name;          // display name to fetch under when nothing is cached
+        Clock::duration lead;      // refreshAheadSeconds plus this player's jitter
+        Clock::time_point nextCheck; // not looked at again before this
+    };
+
+    struct alignas(64) CounterShard {
+        std::mutex mutex;
+        std::unordered_map<std::string, std::uint32_t> counts;
+    };
+
+    // Rebuilds m_watched from the configured names and the most requested
+    // players, then halves every count so the ranking follows current traffic.
+    void rank(Clock::time_point now);
+    Clock::duration jitteredLead();
+    void run();
+
+    PlayerService &m_service;
+    PlayerCache &m_cache;
+    WatchlistOptions m_options;
+    std::vector<std::string> m_keys; // normalized m_options.names, without duplicates
+
+    std::vector<CounterShard> m_counters;
+    std::size_t m_shardCapacity;
+
+    // Only the scheduler thread touches these.
+    std::vector<Watched> m_watched;
+    std::size_t m_cursor;
+    std::mt19937 m_random;
+
+    std::atomic<std::size_t> m_watchedCount;
+    std::atomic<std::uint64_t> m_refreshes;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_stopping;
+    std::thread m_scheduler; // started last, once everything above is initialized
+};
+
+} // namespace osrs
+
+#endif // OSRS_WATCHLIST_H